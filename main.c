@@ -30,6 +30,7 @@
 #include "py/gc.h"
 #include "py/mperrno.h"
 #include "py/stackctrl.h"
+#include "shared/runtime/interrupt_char.h"
 #include "shared/runtime/pyexec.h"
 #include "shared/readline/readline.h"
 #include "nrf_sdm.h"
@@ -40,6 +41,7 @@
 #include "ble.h"
 #include "modmachine.h"
 #include "main.h"
+#include "ring_buffer.h"
 
 /**
  * @brief Variable that holds the Softdevice NVIC state.
@@ -91,6 +93,8 @@ static struct
     uint8_t advertising;
     ble_gatts_char_handles_t rx_characteristic;
     ble_gatts_char_handles_t tx_characteristic;
+    ble_gatts_char_handles_t bulk_rx_characteristic;
+    ble_gatts_char_handles_t bulk_tx_characteristic;
 } ble_handles = {
     .connection = BLE_CONN_HANDLE_INVALID,
     .advertising = BLE_GAP_ADV_SET_HANDLE_NOT_SET,
@@ -109,38 +113,160 @@ static struct
 };
 
 /**
- * @brief Maximum MTU size that our device will support
+ * @brief BLE link settings for the selected throughput profile. The high
+ *        throughput profile uses the largest MTU, with data length extension
+ *        so that each notification fits into a single link layer packet. This
+ *        needs more softdevice RAM, as set by the Makefile.
  */
+#if BLE_HIGH_THROUGHPUT
+#define MAX_MTU_LENGTH 247
+#define MAX_DATA_LENGTH 251
+#define CONN_EVENT_LENGTH 6
+#else
 #define MAX_MTU_LENGTH 128
+#define MAX_DATA_LENGTH BLE_GAP_DATA_LENGTH_DEFAULT
+#define CONN_EVENT_LENGTH 3
+#endif
 
 /**
- * @brief This is the negotiated MTU length. Not used for anything currently.
+ * @brief Number of notifications the softdevice can hold in its queue. A deeper
+ *        queue allows multiple packets to be sent per connection event.
  */
-static uint16_t negotiated_mtu;
+#define BLE_HVN_TX_QUEUE_SIZE 4
 
 /**
- * @brief Buffer sizes for REPL ring buffers. +45 allows for a bytearray(256) to
- *        be printed in one go.
+ * @brief This is the negotiated MTU payload length, i.e. the largest chunk of
+ *        data that fits into a single notification.
  */
-#define RING_BUFFER_LENGTH (1024 + 45)
+static uint16_t negotiated_mtu = BLE_GATT_ATT_MTU_DEFAULT - 3;
+
+/**
+ * @brief Storage for the REPL ring buffers. Sizes must be powers of two.
+ */
+static uint8_t rx_buffer[1024];
+static uint8_t tx_buffer[1024];
+
+/**
+ * @brief Raw paste mode relies on a full window of data fitting into the rx
+ *        ring buffer, otherwise data would be lost.
+ */
+_Static_assert(sizeof(rx_buffer) > MICROPY_REPL_STDIN_BUFFER_MAX,
+               "rx ring buffer must be larger than the raw paste window");
 
 /**
  * @brief Ring buffers for the repl rx and tx data which goes over BLE.
  */
+static ring_buffer_t rx = RING_BUFFER_INIT(rx_buffer);
+static ring_buffer_t tx = RING_BUFFER_INIT(tx_buffer);
+
+/**
+ * @brief Count of REPL bytes dropped because the rx buffer was full.
+ */
+static uint32_t stdin_dropped = 0;
+
+/**
+ * @brief Ring buffer for raw data received on the bulk data service. Bulk tx
+ *        data is queued straight from the caller's buffer, so needs no buffer.
+ */
+static uint8_t bulk_rx_buffer[512];
+static ring_buffer_t bulk_rx = RING_BUFFER_INIT(bulk_rx_buffer);
+
+/**
+ * @brief Flag set while the central has notifications enabled on the tx
+ *        characteristic, i.e. when it's able to receive stdout data.
+ */
+static volatile bool ble_tx_subscribed = false;
+
+/**
+ * @brief Flag set while the central has notifications enabled on the bulk data
+ *        tx characteristic.
+ */
+static volatile bool bulk_tx_subscribed = false;
+
+/**
+ * @brief Count of bulk data bytes dropped because the rx buffer was full.
+ */
+static uint32_t bulk_rx_dropped = 0;
+
+/**
+ * @brief How long stdout waits for a central to connect once the tx ring
+ *        buffer is full. After this, the remaining data is dropped.
+ */
+static uint32_t stdout_timeout_ms = 0;
+
+/**
+ * @brief Count of stdout bytes dropped while no central was able to receive.
+ */
+static uint32_t stdout_dropped = 0;
+
+/**
+ * @brief Count of stdout bytes dropped because they were printed from within
+ *        an interrupt while the tx ring buffer was full.
+ */
+static uint32_t stdout_dropped_irq = 0;
+
+/**
+ * @brief Set by the RTC once stdout has waited stdout_timeout_ms for a
+ *        central to subscribe.
+ */
+static volatile bool stdout_timed_out = false;
+
+/**
+ * @brief Coalescing of small stdout writes. Less than a full MTU of data is
+ *        held back for up to delay_ms, so that short bursts of output such as
+ *        REPL echo go out in one notification rather than many.
+ */
 static struct
 {
-    uint8_t buffer[RING_BUFFER_LENGTH];
-    uint16_t head;
-    uint16_t tail;
-} rx = {
-    .buffer = "",
-    .head = 0,
-    .tail = 0,
-},
-  tx = {
-      .buffer = "",
-      .head = 0,
-      .tail = 0,
+    uint32_t delay_ms;
+    volatile bool timer_running;
+    volatile bool flush;
+} tx_coalesce = {
+    .delay_ms = 5,
+    .timer_running = false,
+    .flush = false,
+};
+
+/**
+ * @brief Connection parameters used during bulk transfers. These give the
+ *        shortest possible interval with no slave latency.
+ */
+static const ble_gap_conn_params_t conn_params_fast = {
+    .min_conn_interval = (7500) / 1250,
+    .max_conn_interval = (7500) / 1250,
+    .slave_latency = 0,
+    .conn_sup_timeout = (2000 * 1000) / 10000,
+};
+
+/**
+ * @brief Connection parameters used while idle. A longer interval and slave
+ *        latency save power, at the cost of REPL latency.
+ */
+static const ble_gap_conn_params_t conn_params_idle = {
+    .min_conn_interval = (30 * 1000) / 1250,
+    .max_conn_interval = (30 * 1000) / 1250,
+    .slave_latency = 3,
+    .conn_sup_timeout = (2000 * 1000) / 10000,
+};
+
+/**
+ * @brief State for switching between the fast and idle connection parameters.
+ */
+static struct
+{
+    uint16_t threshold;
+    uint32_t idle_timeout_ms;
+    volatile bool fast_wanted;
+    volatile bool bulk_active;
+    bool fast_requested;
+    ble_gap_conn_params_t current;
+} conn_profile = {
+    .threshold = 256,
+    .idle_timeout_ms = 2000,
+    .fast_wanted = false,
+    .bulk_active = false,
+    .fast_requested = false,
+    .current = {0},
 };
 
 /**
@@ -201,113 +327,481 @@ void nlr_jump_fail(void *val)
 }
 
 /**
- * @brief Sends data to BLE central device.
- * @param str: String to send.
- * @param len: Length of string.
+ * @brief Queues as much of the tx ring buffer as the softdevice will accept.
+ *        Only ever called from the BLE event handler, so it's safe to re-enter
+ *        whenever the softdevice reports that a notification has completed.
  */
-void mp_hal_stdout_tx_strn(const char *str, mp_uint_t len)
+static void ble_tx_pump(void)
 {
-    // For the entire incoming string
-    for (uint16_t length = 0;
-         length < len;
-         length++)
+    // Keep queuing notifications until the buffer is empty or the queue is full
+    while (ble_tx_subscribed && ring_buffer_used(&tx) > 0)
     {
-        // Check the next position we want to write at
-        uint16_t next = tx.head + 1;
-
-        // Roll back to 0 once we hit the limit
-        if (next == RING_BUFFER_LENGTH)
+        // Hold back partial packets until the coalescing delay has passed
+        if (ring_buffer_used(&tx) < negotiated_mtu &&
+            tx_coalesce.delay_ms != 0 &&
+            !tx_coalesce.flush)
         {
-            next = 0;
+            return;
         }
 
-        // Break if the ring buffer is full, we can't write more
-        if (next == tx.tail)
+        // Local buffer for sending data
+        uint8_t out_buffer[MAX_MTU_LENGTH];
+
+        // Peek at the data without consuming it, so it can be retried later
+        uint16_t out_len = ring_buffer_peek(&tx, out_buffer, negotiated_mtu);
+
+        // Initialise the handle value parameters
+        ble_gatts_hvx_params_t hvx_params = {0};
+        hvx_params.handle = ble_handles.tx_characteristic.value_handle;
+        hvx_params.p_data = out_buffer;
+        hvx_params.p_len = &out_len;
+        hvx_params.type = BLE_GATT_HVX_NOTIFICATION;
+
+        // Queue the data
+        uint32_t err = sd_ble_gatts_hvx(ble_handles.connection, &hvx_params);
+
+        // If the queue is full, we continue on BLE_GATTS_EVT_HVN_TX_COMPLETE.
+        // If not connected or subscribed, the data stays buffered until we are
+        if (err == NRF_ERROR_RESOURCES ||
+            err == NRF_ERROR_INVALID_STATE ||
+            err == BLE_ERROR_INVALID_CONN_HANDLE)
         {
-            // TODO Figure out a way to defer writes when the buffer is full
-            break;
+            return;
         }
 
-        // Copy a character into the ring buffer
-        tx.buffer[tx.head] = str[length];
+        // Catch other errors
+        assert_if(err);
 
-        // Update the head to the incremented value
-        tx.head = next;
+        // Consume the data that was queued
+        ring_buffer_consume(&tx, out_len);
     }
+
+    // Everything has been queued, so any new data starts a new delay
+    if (ring_buffer_used(&tx) == 0)
+    {
+        tx_coalesce.flush = false;
+    }
+}
+
+/**
+ * @brief Called from the RTC interrupt once the coalescing delay has passed.
+ *        The BLE event handler then sends any partial packet.
+ */
+static void ble_tx_flush_timeout(void)
+{
+    tx_coalesce.timer_running = false;
+    tx_coalesce.flush = true;
+
+    sd_nvic_SetPendingIRQ(SD_EVT_IRQn);
 }
 
 /**
- * @brief Sends all buffered data in the tx ring buffer over BLE.
+ * @brief Requests that all buffered data in the tx ring buffer is sent over
+ *        BLE. Full packets are sent straight away, and any partial packet once
+ *        the coalescing delay has passed. The data is queued from within the
+ *        BLE event handler, which also refills the softdevice queue as each
+ *        notification completes.
  */
 void ble_send_pending_data(void)
 {
-    // Local buffer for sending data
-    uint8_t out_buffer[MAX_MTU_LENGTH] = "";
-    uint16_t out_len = 0;
+    size_t used = ring_buffer_used(&tx);
 
     // If there's no data to send, simply return
-    while (tx.head == tx.tail)
+    if (used == 0)
     {
         return;
     }
 
-    // For all the remaining characters, i.e until the heads come back together
-    while (tx.tail != tx.head)
+    // Start the delay for any partial packet. It isn't restarted by further
+    // writes, so a steady trickle of data still goes out every delay_ms
+    if (tx_coalesce.delay_ms != 0 && !tx_coalesce.timer_running)
     {
-        // Next is where the tail will point to after the read
-        uint16_t next = tx.tail + 1;
+        tx_coalesce.timer_running = true;
+        machine_rtc_timeout_start(MACHINE_RTC_TIMEOUT_TX_FLUSH,
+                                  tx_coalesce.delay_ms,
+                                  ble_tx_flush_timeout);
+    }
 
-        // Roll next back to 0 once we hit the end of the max buffer length
-        if (next == RING_BUFFER_LENGTH)
-        {
-            next = 0;
-        }
+    // Wait for the delay unless there's at least one full packet to send
+    if (used < negotiated_mtu && tx_coalesce.delay_ms != 0)
+    {
+        return;
+    }
+
+    // Pend the BLE event interrupt which will run the tx pump
+    sd_nvic_SetPendingIRQ(SD_EVT_IRQn);
+}
+
+/**
+ * @brief Wakes up stdout once it's waited long enough for a central.
+ */
+static void stdout_timeout(void)
+{
+    stdout_timed_out = true;
+}
+
+/**
+ * @brief Waits for space to free up in the tx ring buffer. Never called from
+ *        an interrupt.
+ * @returns true if it's worth trying again, or false if the data should be
+ *          dropped.
+ */
+static bool stdout_wait_for_space(void)
+{
+    // Don't hold up a KeyboardInterrupt. The rest of the output is dropped
+    if (MP_STATE_THREAD(mp_pending_exception) != MP_OBJ_NULL)
+    {
+        return false;
+    }
+
+    // If a central is listening, sleep until a notification frees up space
+    if (ble_tx_subscribed)
+    {
+        ble_send_pending_data();
+        sd_app_evt_wait();
+        return true;
+    }
+
+    // Otherwise, sleep while a central has some time to connect and subscribe
+    if (stdout_timeout_ms == 0)
+    {
+        return false;
+    }
+
+    stdout_timed_out = false;
+    machine_rtc_timeout_start(MACHINE_RTC_TIMEOUT_STDOUT, stdout_timeout_ms, stdout_timeout);
 
-        // Copy over a character from the tail to the outgoing buffer
-        out_buffer[out_len++] = tx.buffer[tx.tail];
+    while (!ble_tx_subscribed && !stdout_timed_out &&
+           MP_STATE_THREAD(mp_pending_exception) == MP_OBJ_NULL)
+    {
+        sd_app_evt_wait();
+    }
+
+    machine_rtc_timeout_stop(MACHINE_RTC_TIMEOUT_STDOUT);
+
+    return ble_tx_subscribed;
+}
+
+/**
+ * @brief Sends data to BLE central device. Blocks while the tx ring buffer is
+ *        full, rather than losing data. Safe to call from interrupts, which
+ *        never block, and drop whatever doesn't fit.
+ * @param str: String to send.
+ * @param len: Length of string.
+ */
+void mp_hal_stdout_tx_strn(const char *str, mp_uint_t len)
+{
+    // Copy in as much as fits, and keep going as space frees up
+    while (true)
+    {
+        // Hard IRQ callbacks can print from within an interrupt, which makes
+        // them a second producer. Each write is kept atomic so that one can't
+        // interrupt another part way through
+        mp_uint_t atomic_state = MICROPY_BEGIN_ATOMIC_SECTION();
+        size_t written = ring_buffer_write(&tx, (const uint8_t *)str, len);
+        MICROPY_END_ATOMIC_SECTION(atomic_state);
 
-        // Apply the increment for next read
-        tx.tail = next;
+        str += written;
+        len -= written;
 
-        // Break if we over-run the negotiated MTU size, send the rest later
-        if (out_len >= negotiated_mtu)
+        if (len == 0)
         {
             break;
         }
+
+        // Blocking inside an interrupt could prevent the BLE handler from
+        // running, so the rest is dropped
+        if (__get_IPSR() != 0)
+        {
+            stdout_dropped_irq += len;
+            return;
+        }
+
+        // If the ring buffer is full and nobody is listening, drop the rest
+        if (!stdout_wait_for_space())
+        {
+            stdout_dropped += len;
+            return;
+        }
     }
 
-    // Initialise the handle value parameters
-    ble_gatts_hvx_params_t hvx_params = {0};
-    hvx_params.handle = ble_handles.tx_characteristic.value_handle;
-    hvx_params.p_data = out_buffer;
-    hvx_params.p_len = (uint16_t *)&out_len;
-    hvx_params.type = BLE_GATT_HVX_NOTIFICATION;
+    // Start sending straight away rather than waiting for the REPL to idle
+    ble_send_pending_data();
+}
+
+/**
+ * @brief Returns the number of stdout bytes that have been dropped.
+ */
+uint32_t ble_stdout_dropped(void)
+{
+    return stdout_dropped;
+}
+
+/**
+ * @brief Returns the number of stdout bytes that were dropped because they
+ *        were printed from an interrupt while the tx buffer was full.
+ */
+uint32_t ble_stdout_dropped_irq(void)
+{
+    return stdout_dropped_irq;
+}
+
+/**
+ * @brief Returns the number of REPL bytes that were dropped because the rx
+ *        buffer was full.
+ */
+uint32_t ble_stdin_dropped(void)
+{
+    return stdin_dropped;
+}
+
+/**
+ * @brief Returns the current stdout timeout in milliseconds.
+ */
+uint32_t ble_stdout_timeout_get(void)
+{
+    return stdout_timeout_ms;
+}
+
+/**
+ * @brief Sets how long stdout will wait for a central to connect before
+ *        dropping data.
+ */
+void ble_stdout_timeout_set(uint32_t timeout_ms)
+{
+    stdout_timeout_ms = timeout_ms;
+}
+
+/**
+ * @brief Returns the current tx coalescing delay in milliseconds.
+ */
+uint32_t ble_tx_coalesce_get(void)
+{
+    return tx_coalesce.delay_ms;
+}
 
-// TODO Is there a cleaner way to retry sending data?
-hvx_try_again:
+/**
+ * @brief Sets how long partial packets of stdout data are held back.
+ */
+void ble_tx_coalesce_set(uint32_t delay_ms)
 {
+    tx_coalesce.delay_ms = delay_ms;
+
+    // Send anything being held back if coalescing is being turned off
+    if (delay_ms == 0)
+    {
+        ble_send_pending_data();
+    }
 }
-    // Send the data
-    uint32_t err = sd_ble_gatts_hvx(ble_handles.connection, &hvx_params);
 
-    // Ignore errors if not connected
-    if (err == NRF_ERROR_INVALID_STATE || err == BLE_ERROR_INVALID_CONN_HANDLE)
+/**
+ * @brief Called from the RTC interrupt once no bulk data has been seen for the
+ *        idle timeout. The BLE event handler then requests the idle parameters.
+ */
+static void ble_conn_idle_timeout(void)
+{
+    conn_profile.fast_wanted = false;
+
+    sd_nvic_SetPendingIRQ(SD_EVT_IRQn);
+}
+
+/**
+ * @brief Requests the fast connection parameters whenever either ring buffer
+ *        fills beyond the threshold, and the idle ones after the idle timeout.
+ *        Only ever called from the BLE event handler.
+ */
+static void ble_conn_profile_update(void)
+{
+    // Nothing to do if not connected
+    if (ble_handles.connection == BLE_CONN_HANDLE_INVALID)
     {
         return;
     }
 
-    // If there is an overflow
-    if (err == NRF_ERROR_RESOURCES)
+    // Check how full the ring buffers are
+    size_t tx_used = ring_buffer_used(&tx);
+    size_t rx_used = ring_buffer_used(&rx);
+
+    // While data is flowing in bulk, keep pushing back the idle timeout
+    if (tx_used >= conn_profile.threshold ||
+        rx_used >= conn_profile.threshold ||
+        conn_profile.bulk_active)
     {
-        // Try to send again after 100us
-        NRFX_DELAY_US(100);
+        conn_profile.bulk_active = false;
+        conn_profile.fast_wanted = true;
+        machine_rtc_timeout_start(MACHINE_RTC_TIMEOUT_CONN_IDLE,
+                                  conn_profile.idle_timeout_ms,
+                                  ble_conn_idle_timeout);
+    }
 
-        // TODO Is there a cleaner way to retry sending data?
-        goto hvx_try_again;
+    // Nothing to do if the right parameters have already been requested
+    if (conn_profile.fast_wanted == conn_profile.fast_requested)
+    {
+        return;
+    }
+
+    // Request the new parameters
+    uint32_t err = sd_ble_gap_conn_param_update(
+        ble_handles.connection,
+        conn_profile.fast_wanted ? &conn_params_fast : &conn_params_idle);
+
+    // If an update is already in progress, retry once that one completes
+    if (err == NRF_ERROR_BUSY)
+    {
+        return;
     }
 
     // Catch other errors
     assert_if(err);
+
+    conn_profile.fast_requested = conn_profile.fast_wanted;
+}
+
+/**
+ * @brief Returns the current connection parameters. These are all zero when
+ *        no central is connected.
+ */
+void ble_conn_params_get(ble_gap_conn_params_t *params)
+{
+    if (ble_handles.connection == BLE_CONN_HANDLE_INVALID)
+    {
+        memset(params, 0, sizeof(ble_gap_conn_params_t));
+        return;
+    }
+
+    *params = conn_profile.current;
+}
+
+/**
+ * @brief Returns the ring buffer occupancy which triggers the fast connection
+ *        parameters.
+ */
+uint16_t ble_fast_threshold_get(void)
+{
+    return conn_profile.threshold;
+}
+
+/**
+ * @brief Sets the ring buffer occupancy which triggers the fast connection
+ *        parameters.
+ */
+void ble_fast_threshold_set(uint16_t threshold)
+{
+    conn_profile.threshold = threshold;
+}
+
+/**
+ * @brief Returns how long the link stays fast after the last bulk data.
+ */
+uint32_t ble_idle_timeout_get(void)
+{
+    return conn_profile.idle_timeout_ms;
+}
+
+/**
+ * @brief Sets how long the link stays fast after the last bulk data.
+ */
+void ble_idle_timeout_set(uint32_t timeout_ms)
+{
+    conn_profile.idle_timeout_ms = timeout_ms;
+}
+
+/**
+ * @brief Returns the number of bytes waiting in the bulk data rx buffer.
+ */
+size_t ble_bulk_any(void)
+{
+    return ring_buffer_used(&bulk_rx);
+}
+
+/**
+ * @brief Copies as much received bulk data as is available, up to len bytes.
+ * @returns The number of bytes copied, or 0 if no data is waiting.
+ */
+size_t ble_bulk_read(uint8_t *buffer, size_t len)
+{
+    return ring_buffer_read(&bulk_rx, buffer, len);
+}
+
+/**
+ * @brief Returns true if the central is able to receive bulk data.
+ */
+bool ble_bulk_ready(void)
+{
+    return bulk_tx_subscribed;
+}
+
+/**
+ * @brief Queues bulk data as notifications directly from the caller's buffer,
+ *        until all of it is queued, or the softdevice queue is full.
+ * @returns The number of bytes queued.
+ */
+size_t ble_bulk_write(const uint8_t *buffer, size_t len)
+{
+    size_t queued = 0;
+
+    // Bulk transfers should run with the fast connection parameters
+    conn_profile.bulk_active = true;
+    sd_nvic_SetPendingIRQ(SD_EVT_IRQn);
+
+    while (queued < len)
+    {
+        // Send as much as fits into a single notification
+        uint16_t chunk_len = MIN(len - queued, negotiated_mtu);
+
+        ble_gatts_hvx_params_t hvx_params = {0};
+        hvx_params.handle = ble_handles.bulk_tx_characteristic.value_handle;
+        hvx_params.p_data = buffer + queued;
+        hvx_params.p_len = &chunk_len;
+        hvx_params.type = BLE_GATT_HVX_NOTIFICATION;
+
+        uint32_t err = sd_ble_gatts_hvx(ble_handles.connection, &hvx_params);
+
+        // If the queue is full or we've disconnected, the caller should wait
+        if (err == NRF_ERROR_RESOURCES ||
+            err == NRF_ERROR_INVALID_STATE ||
+            err == BLE_ERROR_INVALID_CONN_HANDLE)
+        {
+            break;
+        }
+
+        // Catch other errors
+        assert_if(err);
+
+        queued += chunk_len;
+    }
+
+    return queued;
+}
+
+/**
+ * @brief Returns the number of bulk data bytes dropped because the rx buffer
+ *        was full.
+ */
+uint32_t ble_bulk_dropped(void)
+{
+    return bulk_rx_dropped;
+}
+
+/**
+ * @brief Enters a critical section. Only application interrupts are masked, so
+ *        the softdevice keeps running.
+ * @returns The state to give to mp_hal_end_atomic_section().
+ */
+mp_uint_t mp_hal_begin_atomic_section(void)
+{
+    uint8_t is_nested;
+    sd_nvic_critical_region_enter(&is_nested);
+
+    return is_nested;
+}
+
+/**
+ * @brief Leaves a critical section started with mp_hal_begin_atomic_section().
+ */
+void mp_hal_end_atomic_section(mp_uint_t state)
+{
+    sd_nvic_critical_region_exit(state);
 }
 
 /**
@@ -317,37 +811,106 @@ hvx_try_again:
 int mp_hal_stdin_rx_chr(void)
 {
     // Wait until data is ready
-    while (rx.head == rx.tail)
+    while (ring_buffer_used(&rx) == 0)
     {
+        // Run scheduled callbacks, or raise a KeyboardInterrupt if Ctrl-C
+        // arrived while waiting
+        mp_handle_pending(true);
+
         // While waiting for incoming data, we can push outgoing data
         ble_send_pending_data();
 
-        // If there's nothing to do
-        if (tx.head == tx.tail &&
-            rx.head == rx.tail)
-        {
-            // Wait for events to save power
-            sd_app_evt_wait();
-        }
-    }
+        // Wait for events to save power. Sending continues in the background
+        sd_app_evt_wait();
+    }
+
+    // Read a character from the tail
+    uint8_t character;
+    ring_buffer_read(&rx, &character, 1);
+
+    // Return character
+    return character;
+}
+
+/**
+ * @brief Adds a service with an rx and tx characteristic, using the same layout
+ *        as the Nordic UART service.
+ * @param uuid128: The base UUID of the service.
+ * @param service_uuid: Returns the UUID of the service for advertising.
+ * @param rx_handles: Returns the handles of the rx characteristic.
+ * @param tx_handles: Returns the handles of the tx characteristic.
+ */
+static void ble_add_service(ble_uuid128_t *uuid128,
+                            ble_uuid_t *service_uuid,
+                            ble_gatts_char_handles_t *rx_handles,
+                            ble_gatts_char_handles_t *tx_handles)
+{
+    // Error code variable
+    uint32_t err;
+
+    // Set the 16 bit UUIDs for the service and characteristics
+    service_uuid->uuid = 0x0001;
+    ble_uuid_t rx_uuid = {.uuid = 0x0002};
+    ble_uuid_t tx_uuid = {.uuid = 0x0003};
+
+    // Temporary service handle
+    uint16_t service_handle;
+
+    err = sd_ble_uuid_vs_add(uuid128, &service_uuid->type);
+    assert_if(err);
+
+    err = sd_ble_gatts_service_add(BLE_GATTS_SRVC_TYPE_PRIMARY,
+                                   service_uuid, &service_handle);
+    assert_if(err);
+
+    // Copy the service UUID type to both rx and tx UUID
+    rx_uuid.type = service_uuid->type;
+    tx_uuid.type = service_uuid->type;
+
+    // Add rx characterisic
+    ble_gatts_char_md_t rx_char_md = {0};
+    rx_char_md.char_props.write = 1;
+    rx_char_md.char_props.write_wo_resp = 1;
 
-    // Next is where the tail will point to after the read
-    uint16_t next = rx.tail + 1;
+    ble_gatts_attr_md_t rx_attr_md = {0};
+    BLE_GAP_CONN_SEC_MODE_SET_OPEN(&rx_attr_md.read_perm);
+    BLE_GAP_CONN_SEC_MODE_SET_OPEN(&rx_attr_md.write_perm);
+    rx_attr_md.vloc = BLE_GATTS_VLOC_STACK;
+    rx_attr_md.vlen = 1;
 
-    // Roll next back to 0 once we hit the end of the max buffer length
-    if (next == RING_BUFFER_LENGTH)
-    {
-        next = 0;
-    }
+    ble_gatts_attr_t rx_attr = {0};
+    rx_attr.p_uuid = &rx_uuid;
+    rx_attr.p_attr_md = &rx_attr_md;
+    rx_attr.init_len = sizeof(uint8_t);
+    rx_attr.max_len = MAX_MTU_LENGTH - 3;
 
-    // Read a character from the tail
-    int character = rx.buffer[rx.tail];
+    err = sd_ble_gatts_characteristic_add(service_handle,
+                                          &rx_char_md,
+                                          &rx_attr,
+                                          rx_handles);
+    assert_if(err);
 
-    // Apply the increment
-    rx.tail = next;
+    // Add tx characterisic
+    ble_gatts_char_md_t tx_char_md = {0};
+    tx_char_md.char_props.notify = 1;
 
-    // Return character
-    return character;
+    ble_gatts_attr_md_t tx_attr_md = {0};
+    BLE_GAP_CONN_SEC_MODE_SET_OPEN(&tx_attr_md.read_perm);
+    BLE_GAP_CONN_SEC_MODE_SET_OPEN(&tx_attr_md.write_perm);
+    tx_attr_md.vloc = BLE_GATTS_VLOC_STACK;
+    tx_attr_md.vlen = 1;
+
+    ble_gatts_attr_t tx_attr = {0};
+    tx_attr.p_uuid = &tx_uuid;
+    tx_attr.p_attr_md = &tx_attr_md;
+    tx_attr.init_len = sizeof(uint8_t);
+    tx_attr.max_len = MAX_MTU_LENGTH - 3;
+
+    err = sd_ble_gatts_characteristic_add(service_handle,
+                                          &tx_char_md,
+                                          &tx_attr,
+                                          tx_handles);
+    assert_if(err);
 }
 
 /**
@@ -381,7 +944,7 @@ static void ble_init(void)
     ble_cfg_t ble_conf;
     ble_conf.conn_cfg.conn_cfg_tag = 1;
     ble_conf.conn_cfg.params.gap_conn_cfg.conn_count = 1;
-    ble_conf.conn_cfg.params.gap_conn_cfg.event_length = 3;
+    ble_conf.conn_cfg.params.gap_conn_cfg.event_length = CONN_EVENT_LENGTH;
     err = sd_ble_cfg_set(BLE_CONN_CFG_GAP, &ble_conf, ram_start);
     assert_if(err);
 
@@ -398,16 +961,16 @@ static void ble_init(void)
     err = sd_ble_cfg_set(BLE_CONN_CFG_GATT, &ble_conf, ram_start);
     assert_if(err);
 
-    // Configure a single queued transfer
+    // Configure the depth of the notification queue
     memset(&ble_conf, 0, sizeof(ble_conf));
     ble_conf.conn_cfg.conn_cfg_tag = 1;
-    ble_conf.conn_cfg.params.gatts_conn_cfg.hvn_tx_queue_size = 1;
+    ble_conf.conn_cfg.params.gatts_conn_cfg.hvn_tx_queue_size = BLE_HVN_TX_QUEUE_SIZE;
     err = sd_ble_cfg_set(BLE_CONN_CFG_GATTS, &ble_conf, ram_start);
     assert_if(err);
 
     // Configure number of custom UUIDs
     memset(&ble_conf, 0, sizeof(ble_conf));
-    ble_conf.common_cfg.vs_uuid_cfg.vs_uuid_count = 1;
+    ble_conf.common_cfg.vs_uuid_cfg.vs_uuid_count = 2;
     err = sd_ble_cfg_set(BLE_COMMON_CFG_VS_UUID, &ble_conf, ram_start);
     assert_if(err);
 
@@ -448,83 +1011,35 @@ static void ble_init(void)
                                      (uint16_t)strlen((const char *)device_name));
     assert_if(err);
 
-    // Set connection parameters
-    ble_gap_conn_params_t gap_conn_params = {0};
-    gap_conn_params.min_conn_interval = (15 * 1000) / 1250;
-    gap_conn_params.max_conn_interval = (15 * 1000) / 1250;
-    gap_conn_params.slave_latency = 3;
-    gap_conn_params.conn_sup_timeout = (2000 * 1000) / 10000;
-    err = sd_ble_gap_ppcp_set(&gap_conn_params);
-    assert_if(err);
-
-    // Add the Nordic UART service long UUID
-    ble_uuid128_t uuid128 = {.uuid128 = {0x9E, 0xCA, 0xDC, 0x24,
-                                         0x0E, 0xE5, 0xA9, 0xE0,
-                                         0x93, 0xF3, 0xA3, 0xB5,
-                                         0x00, 0x00, 0x40, 0x6E}};
-
-    // Set the 16 bit UUIDs for the service and characteristics
-    ble_uuid_t service_uuid = {.uuid = 0x0001};
-    ble_uuid_t rx_uuid = {.uuid = 0x0002};
-    ble_uuid_t tx_uuid = {.uuid = 0x0003};
-
-    // Temporary NUS handle
-    uint16_t nordic_uart_service_handle;
-
-    err = sd_ble_uuid_vs_add(&uuid128, &service_uuid.type);
+    // Start new connections with the idle connection parameters
+    err = sd_ble_gap_ppcp_set(&conn_params_idle);
     assert_if(err);
 
-    err = sd_ble_gatts_service_add(BLE_GATTS_SRVC_TYPE_PRIMARY,
-                                   &service_uuid, &nordic_uart_service_handle);
-
-    // Copy the service UUID type to both rx and tx UUID
-    rx_uuid.type = service_uuid.type;
-    tx_uuid.type = service_uuid.type;
-
-    // Add rx characterisic
-    ble_gatts_char_md_t rx_char_md = {0};
-    rx_char_md.char_props.write = 1;
-    rx_char_md.char_props.write_wo_resp = 1;
-
-    ble_gatts_attr_md_t rx_attr_md = {0};
-    BLE_GAP_CONN_SEC_MODE_SET_OPEN(&rx_attr_md.read_perm);
-    BLE_GAP_CONN_SEC_MODE_SET_OPEN(&rx_attr_md.write_perm);
-    rx_attr_md.vloc = BLE_GATTS_VLOC_STACK;
-    rx_attr_md.vlen = 1;
-
-    ble_gatts_attr_t rx_attr = {0};
-    rx_attr.p_uuid = &rx_uuid;
-    rx_attr.p_attr_md = &rx_attr_md;
-    rx_attr.init_len = sizeof(uint8_t);
-    rx_attr.max_len = MAX_MTU_LENGTH - 3;
+    // Add the Nordic UART service for the REPL
+    ble_uuid128_t nus_uuid128 = {.uuid128 = {0x9E, 0xCA, 0xDC, 0x24,
+                                             0x0E, 0xE5, 0xA9, 0xE0,
+                                             0x93, 0xF3, 0xA3, 0xB5,
+                                             0x00, 0x00, 0x40, 0x6E}};
 
-    err = sd_ble_gatts_characteristic_add(nordic_uart_service_handle,
-                                          &rx_char_md,
-                                          &rx_attr,
-                                          &ble_handles.rx_characteristic);
-    assert_if(err);
+    ble_uuid_t service_uuid;
 
-    // Add tx characterisic
-    ble_gatts_char_md_t tx_char_md = {0};
-    tx_char_md.char_props.notify = 1;
+    ble_add_service(&nus_uuid128,
+                    &service_uuid,
+                    &ble_handles.rx_characteristic,
+                    &ble_handles.tx_characteristic);
 
-    ble_gatts_attr_md_t tx_attr_md = {0};
-    BLE_GAP_CONN_SEC_MODE_SET_OPEN(&tx_attr_md.read_perm);
-    BLE_GAP_CONN_SEC_MODE_SET_OPEN(&tx_attr_md.write_perm);
-    tx_attr_md.vloc = BLE_GATTS_VLOC_STACK;
-    tx_attr_md.vlen = 1;
+    // Add the bulk data service for raw binary transfers
+    ble_uuid128_t bulk_uuid128 = {.uuid128 = {0x9D, 0x47, 0x0F, 0x90,
+                                              0xFF, 0x57, 0xCE, 0xB4,
+                                              0x9A, 0x42, 0xAC, 0x7B,
+                                              0x00, 0x00, 0x70, 0xE5}};
 
-    ble_gatts_attr_t tx_attr = {0};
-    tx_attr.p_uuid = &tx_uuid;
-    tx_attr.p_attr_md = &tx_attr_md;
-    tx_attr.init_len = sizeof(uint8_t);
-    tx_attr.max_len = MAX_MTU_LENGTH - 3;
+    ble_uuid_t bulk_service_uuid;
 
-    err = sd_ble_gatts_characteristic_add(nordic_uart_service_handle,
-                                          &tx_char_md,
-                                          &tx_attr,
-                                          &ble_handles.tx_characteristic);
-    assert_if(err);
+    ble_add_service(&bulk_uuid128,
+                    &bulk_service_uuid,
+                    &ble_handles.bulk_rx_characteristic,
+                    &ble_handles.bulk_tx_characteristic);
 
     // Add name to advertising payload
     adv.payload[adv.length++] = strlen((const char *)device_name) + 1;
@@ -594,6 +1109,104 @@ static void hardware_init(void)
     machine_fpga_init();
 }
 
+/**
+ * @brief Chip select pin shared by the Flash and FPGA.
+ */
+#define SPIM_CS_PIN 12
+
+/**
+ * @brief The largest number of bytes the SPI can send or receive in one DMA
+ *        transfer.
+ */
+#define SPIM_MAX_XFER_LEN ((1 << SPIM0_EASYDMA_MAXCNT_SIZE) - 1)
+
+/**
+ * @brief SPI clock frequencies supported by SPIM0, in Hz, alongside their
+ *        register values.
+ */
+static const struct
+{
+    uint32_t hz;
+    nrf_spim_frequency_t frequency;
+} spim_frequencies[] = {
+    {125000, NRF_SPIM_FREQ_125K},
+    {250000, NRF_SPIM_FREQ_250K},
+    {500000, NRF_SPIM_FREQ_500K},
+    {1000000, NRF_SPIM_FREQ_1M},
+    {2000000, NRF_SPIM_FREQ_2M},
+    {4000000, NRF_SPIM_FREQ_4M},
+    {8000000, NRF_SPIM_FREQ_8M},
+};
+
+/**
+ * @brief The SPI clock frequency used for each device. The flash runs at the
+ *        fastest clock SPIM0 supports, while the FPGA keeps the default.
+ */
+static nrf_spim_frequency_t spim_device_frequency[] = {
+    [FPGA] = NRF_SPIM_FREQ_4M,
+    [FLASH] = NRF_SPIM_FREQ_8M,
+};
+
+/**
+ * @brief Initialises the SPI the first time it's used. The chip select is
+ *        driven manually so that it can be held across several transfers.
+ */
+static void spim_init(void)
+{
+    static bool initialised = false;
+
+    if (initialised)
+    {
+        return;
+    }
+
+    // Use a default SPI configuration and set the pins, except chip select
+    nrfx_spim_config_t spi_config = NRFX_SPIM_DEFAULT_CONFIG(15, 11, 8,
+                                                             NRFX_SPIM_PIN_NOT_USED);
+
+    nrfx_err_t err = nrfx_spim_init(&spi, &spi_config, NULL, NULL);
+    assert_if(err);
+
+    // Chip select starts deselected for the Flash
+    nrf_gpio_pin_set(SPIM_CS_PIN);
+    nrf_gpio_cfg_output(SPIM_CS_PIN);
+
+    initialised = true;
+}
+
+/**
+ * @brief Asserts or releases the chip select for a device.
+ * @param device: Which device to communicate with
+ * @param select: True to assert the chip select, false to release it
+ */
+static void spim_select(spi_device_t device, bool select)
+{
+    // Each device can have its own clock. The SPI is idle here, so it can be
+    // changed without initialising the driver again
+    if (select)
+    {
+        nrf_spim_frequency_set(spi.p_reg, spim_device_frequency[device]);
+    }
+
+    // The FPGA uses an inverted chip select
+    nrf_gpio_pin_write(SPIM_CS_PIN, (device == FPGA) == select);
+}
+
+/**
+ * @brief Runs a single blocking DMA transfer on the SPI.
+ */
+static void spim_xfer(const uint8_t *tx_buffer, size_t tx_len,
+                      uint8_t *rx_buffer, size_t rx_len)
+{
+    // Configure the transfer descriptor
+    nrfx_spim_xfer_desc_t spi_xfer = NRFX_SPIM_XFER_TRX(tx_buffer, tx_len,
+                                                        rx_buffer, rx_len);
+
+    // Initiate the transfer
+    nrfx_err_t err = nrfx_spim_xfer(&spi, &spi_xfer, 0);
+    assert_if(err);
+}
+
 /**
  * @brief Function for communicating with the Flash and FPGA.
  * @param tx_buffer: Pointer to the transmit data buffer
@@ -605,25 +1218,106 @@ static void hardware_init(void)
 void spim_tx_rx(uint8_t *tx_buffer, size_t tx_len,
                 uint8_t *rx_buffer, size_t rx_len, spi_device_t device)
 {
-    // Use a default SPI configuration and set the pins
-    nrfx_spim_config_t spi_config = NRFX_SPIM_DEFAULT_CONFIG(15, 11, 8, 12);
+    spim_init();
+
+    spim_select(device, true);
+    spim_xfer(tx_buffer, tx_len, rx_buffer, rx_len);
+    spim_select(device, false);
+}
 
-    // If the FPGA is selected, we use an inverted chip select
-    if (device == FPGA)
+/**
+ * @brief Returns the SPI clock frequency used for a device in Hz.
+ * @param device: Which device to get the frequency of
+ */
+uint32_t spim_frequency_get(spi_device_t device)
+{
+    for (size_t i = 0; i < MP_ARRAY_SIZE(spim_frequencies); i++)
     {
-        spi_config.ss_active_high = true;
+        if (spim_frequencies[i].frequency == spim_device_frequency[device])
+        {
+            return spim_frequencies[i].hz;
+        }
     }
 
-    // Initialise the SPI if it was not already
-    nrfx_spim_init(&spi, &spi_config, NULL, NULL);
+    return 0;
+}
 
-    // Configure the transfer descriptor
-    nrfx_spim_xfer_desc_t spi_xfer = NRFX_SPIM_XFER_TRX(tx_buffer, tx_len,
-                                                        rx_buffer, rx_len);
+/**
+ * @brief Sets the SPI clock frequency used for a device.
+ * @param device: Which device to set the frequency of
+ * @param hz: The frequency in Hz
+ * @returns False if the frequency isn't supported by the SPI
+ */
+bool spim_frequency_set(spi_device_t device, uint32_t hz)
+{
+    for (size_t i = 0; i < MP_ARRAY_SIZE(spim_frequencies); i++)
+    {
+        if (spim_frequencies[i].hz == hz)
+        {
+            spim_device_frequency[device] = spim_frequencies[i].frequency;
+            return true;
+        }
+    }
 
-    // Initiate the transfer
-    nrfx_err_t err = nrfx_spim_xfer(&spi, &spi_xfer, 0);
-    assert_if(err);
+    return false;
+}
+
+/**
+ * @brief Sends a command, followed by a data phase of any length, all within
+ *        a single chip select assertion. The data is sent from, or received
+ *        into the buffers given directly, using as many DMA transfers as
+ *        needed.
+ * @param command: Pointer to the command bytes, such as an opcode and address
+ * @param command_len: How many command bytes to send
+ * @param tx_data: Data to send after the command, or NULL if receiving
+ * @param rx_data: Where to receive data after the command, or NULL if sending
+ * @param len: How many bytes to send or receive after the command
+ * @param device: Which device to communicate with
+ */
+void spim_command(const uint8_t *command, size_t command_len,
+                  const uint8_t *tx_data, uint8_t *rx_data, size_t len,
+                  spi_device_t device)
+{
+    spim_init();
+
+    spim_select(device, true);
+
+    // Send the command on its own, discarding anything clocked in
+    if (command_len > 0)
+    {
+        spim_xfer(command, command_len, NULL, 0);
+    }
+
+    // Then chain as many transfers as needed for the data
+    while (len > 0)
+    {
+        size_t chunk = len < SPIM_MAX_XFER_LEN ? len : SPIM_MAX_XFER_LEN;
+
+        if (tx_data && !nrfx_is_in_ram(tx_data))
+        {
+            // DMA can only read from RAM, so constant data is copied first
+            uint8_t bounce[64];
+
+            chunk = chunk < sizeof(bounce) ? chunk : sizeof(bounce);
+            memcpy(bounce, tx_data, chunk);
+            spim_xfer(bounce, chunk, NULL, 0);
+            tx_data += chunk;
+        }
+        else if (tx_data)
+        {
+            spim_xfer(tx_data, chunk, NULL, 0);
+            tx_data += chunk;
+        }
+        else
+        {
+            spim_xfer(NULL, 0, rx_data, chunk);
+            rx_data += chunk;
+        }
+
+        len -= chunk;
+    }
+
+    spim_select(device, false);
 }
 
 /**
@@ -652,6 +1346,9 @@ int main()
     // Initialise the readline module for REPL
     readline_init0();
 
+    // Mount the filesystem, formatting the flash if it doesn't contain one
+    pyexec_frozen_module("_mkfs.py");
+
     // REPL mode can change, or it can request a soft reset
     for (;;)
     {
@@ -690,24 +1387,13 @@ int main()
 void SWI2_IRQHandler(void)
 {
     uint32_t evt_id;
-    uint8_t ble_evt_buffer[sizeof(ble_evt_t) + MAX_MTU_LENGTH];
+    uint8_t ble_evt_buffer[sizeof(ble_evt_t) + MAX_MTU_LENGTH]
+        __attribute__((aligned(BLE_EVT_PTR_ALIGNMENT)));
 
-    // While any softdevice events are pending, handle flash operations
+    // Drain any softdevice events. The filesystem is stored in the SPI flash
+    // rather than the internal flash, so the flash operation events are unused
     while (sd_evt_get(&evt_id) != NRF_ERROR_NOT_FOUND)
     {
-        switch (evt_id)
-        {
-        case NRF_EVT_FLASH_OPERATION_SUCCESS:
-            // TODO In case we add a filesystem in the future
-            break;
-
-        case NRF_EVT_FLASH_OPERATION_ERROR:
-            // TODO In case we add a filesystem in the future
-            break;
-
-        default:
-            break;
-        }
     }
 
     // While any BLE events are pending
@@ -742,16 +1428,52 @@ void SWI2_IRQHandler(void)
             // Set the connection handle
             ble_handles.connection = ble_evt->evt.gap_evt.conn_handle;
 
-            // Update connection parameters
-            ble_gap_conn_params_t conn_params;
+            // Keep track of the parameters chosen by the central
+            conn_profile.current =
+                ble_evt->evt.gap_evt.params.connected.conn_params;
 
-            err = sd_ble_gap_ppcp_get(&conn_params);
-            assert_if(err);
+            // Request the idle connection parameters to begin with
+            conn_profile.fast_wanted = false;
+            conn_profile.fast_requested = false;
 
             err = sd_ble_gap_conn_param_update(ble_evt->evt.gap_evt.conn_handle,
-                                               &conn_params);
+                                               &conn_params_idle);
             assert_if(err);
 
+#if BLE_HIGH_THROUGHPUT
+            // Prefer the 2M PHY. The central may still decide to stay on 1M
+            ble_gap_phys_t const phys = {
+                .rx_phys = BLE_GAP_PHY_2MBPS,
+                .tx_phys = BLE_GAP_PHY_2MBPS,
+            };
+
+            err = sd_ble_gap_phy_update(ble_evt->evt.gap_evt.conn_handle, &phys);
+
+            // Not fatal if another procedure is still in progress
+            if (err != NRF_ERROR_BUSY)
+            {
+                assert_if(err);
+            }
+
+            // Ask for the longest link layer packets that fit our MTU
+            ble_gap_data_length_params_t const data_length = {
+                .max_tx_octets = MAX_DATA_LENGTH,
+                .max_rx_octets = MAX_DATA_LENGTH,
+                .max_tx_time_us = BLE_GAP_DATA_LENGTH_AUTO,
+                .max_rx_time_us = BLE_GAP_DATA_LENGTH_AUTO,
+            };
+
+            err = sd_ble_gap_data_length_update(ble_evt->evt.gap_evt.conn_handle,
+                                                &data_length,
+                                                NULL);
+
+            // Not fatal if the central has already started its own procedure
+            if (err != NRF_ERROR_BUSY)
+            {
+                assert_if(err);
+            }
+#endif
+
             break;
         }
 
@@ -761,6 +1483,16 @@ void SWI2_IRQHandler(void)
             // Clear the connection handle
             ble_handles.connection = BLE_CONN_HANDLE_INVALID;
 
+            // Fall back to the default MTU for the next connection
+            negotiated_mtu = BLE_GATT_ATT_MTU_DEFAULT - 3;
+
+            // Hold on to stdout data until the next central subscribes
+            ble_tx_subscribed = false;
+            bulk_tx_subscribed = false;
+
+            // The idle timeout is no longer needed
+            machine_rtc_timeout_stop(MACHINE_RTC_TIMEOUT_CONN_IDLE);
+
             // Start advertising
             err = sd_ble_gap_adv_start(ble_handles.advertising, 1);
             assert_if(err);
@@ -768,6 +1500,15 @@ void SWI2_IRQHandler(void)
             break;
         }
 
+        // Keep track of the connection parameters once they change
+        case BLE_GAP_EVT_CONN_PARAM_UPDATE:
+        {
+            conn_profile.current =
+                ble_evt->evt.gap_evt.params.conn_param_update.conn_params;
+
+            break;
+        }
+
         // On a phy update request, set the phy speed automatically
         case BLE_GAP_EVT_PHY_UPDATE_REQUEST:
         {
@@ -782,6 +1523,24 @@ void SWI2_IRQHandler(void)
             break;
         }
 
+        // Accept data length requests from the central, up to our maximum
+        case BLE_GAP_EVT_DATA_LENGTH_UPDATE_REQUEST:
+        {
+            ble_gap_data_length_params_t const data_length = {
+                .max_tx_octets = MAX_DATA_LENGTH,
+                .max_rx_octets = MAX_DATA_LENGTH,
+                .max_tx_time_us = BLE_GAP_DATA_LENGTH_AUTO,
+                .max_rx_time_us = BLE_GAP_DATA_LENGTH_AUTO,
+            };
+
+            err = sd_ble_gap_data_length_update(ble_evt->evt.gap_evt.conn_handle,
+                                                &data_length,
+                                                NULL);
+            assert_if(err);
+
+            break;
+        }
+
         // Handle requests for changing MTU length
         case BLE_GATTS_EVT_EXCHANGE_MTU_REQUEST:
         {
@@ -804,35 +1563,81 @@ void SWI2_IRQHandler(void)
             break;
         }
 
+        // When queued notifications are sent, the pump below will refill them
+        case BLE_GATTS_EVT_HVN_TX_COMPLETE:
+        {
+            break;
+        }
+
         // When data arrives, we can write it to the buffer
         case BLE_GATTS_EVT_WRITE:
         {
-            // For the entire incoming string
-            for (uint16_t length = 0;
-                 length < ble_evt->evt.gatts_evt.params.write.len;
-                 length++)
+            ble_gatts_evt_write_t *write = &ble_evt->evt.gatts_evt.params.write;
+
+            // Track when the central enables or disables tx notifications
+            if (write->handle == ble_handles.tx_characteristic.cccd_handle &&
+                write->len == 2)
+            {
+                ble_tx_subscribed = write->data[0] & BLE_GATT_HVX_NOTIFICATION;
+                break;
+            }
+
+            // Track when the central enables or disables bulk notifications
+            if (write->handle == ble_handles.bulk_tx_characteristic.cccd_handle &&
+                write->len == 2)
             {
-                // Check the next position we want to write at
-                uint16_t next = rx.head + 1;
+                bulk_tx_subscribed = write->data[0] & BLE_GATT_HVX_NOTIFICATION;
+                break;
+            }
 
-                // Roll back to 0 once we hit the limit
-                if (next == RING_BUFFER_LENGTH)
-                {
-                    next = 0;
-                }
+            // Raw bulk data goes into its own buffer
+            if (write->handle == ble_handles.bulk_rx_characteristic.value_handle)
+            {
+                // Drop whatever doesn't fit if the ring buffer is full
+                bulk_rx_dropped += write->len - ring_buffer_write(&bulk_rx,
+                                                                  write->data,
+                                                                  write->len);
 
-                // Break if the ring buffer is full, we can't write more
-                if (next == rx.tail)
+                // Bulk transfers should run with the fast connection parameters
+                conn_profile.bulk_active = true;
+
+                break;
+            }
+
+            // Ignore writes to anything other than the rx characteristic
+            if (write->handle != ble_handles.rx_characteristic.value_handle)
+            {
+                break;
+            }
+
+            // Split the data around any interrupt characters
+            const uint8_t *data = write->data;
+            uint16_t remaining = write->len;
+
+            while (remaining > 0)
+            {
+                // Find the next interrupt character, if one is set
+                uint16_t length = 0;
+
+                while (length < remaining && data[length] != mp_interrupt_char)
                 {
-                    break;
+                    length++;
                 }
 
-                // Copy a character into the ring buffer
-                rx.buffer[rx.head] =
-                    ble_evt->evt.gatts_evt.params.write.data[length];
+                // Drop whatever doesn't fit if the ring buffer is full. Hosts
+                // can avoid this by using raw paste mode, which has flow control
+                stdin_dropped += length - ring_buffer_write(&rx, data, length);
+
+                data += length;
+                remaining -= length;
 
-                // Update the head to the incremented value
-                rx.head = next;
+                // Interrupt the running code rather than buffering the character
+                if (remaining > 0)
+                {
+                    mp_sched_keyboard_interrupt();
+                    data++;
+                    remaining--;
+                }
             }
 
             break;
@@ -887,6 +1692,12 @@ void SWI2_IRQHandler(void)
             break;
         }
     }
+
+    // Queue any pending tx data now that events have been handled
+    ble_tx_pump();
+
+    // Switch between fast and idle connection parameters if needed
+    ble_conn_profile_update();
 }
 
 /**
@@ -27,7 +27,10 @@
 #ifndef __MICROPY_INCLUDED_S1MOD_MAIN_H__
 #define __MICROPY_INCLUDED_S1MOD_MAIN_H__
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include "ble_gap.h"
 
 // TODO do we want a list of error codes?
 
@@ -58,4 +61,145 @@ typedef enum
 void spim_tx_rx(uint8_t *tx_buffer, size_t tx_len,
                 uint8_t *rx_buffer, size_t rx_len, spi_device_t device);
 
+/**
+ * @brief Returns the SPI clock frequency used for a device in Hz.
+ * @param device: Which device to get the frequency of
+ */
+uint32_t spim_frequency_get(spi_device_t device);
+
+/**
+ * @brief Sets the SPI clock frequency used for a device. Supported values are
+ *        125kHz, 250kHz, 500kHz, 1MHz, 2MHz, 4MHz and 8MHz.
+ * @param device: Which device to set the frequency of
+ * @param hz: The frequency in Hz
+ * @returns False if the frequency isn't supported by the SPI
+ */
+bool spim_frequency_set(spi_device_t device, uint32_t hz);
+
+/**
+ * @brief Sends a command, followed by a data phase of any length, all within
+ *        a single chip select assertion.
+ * @param command: Pointer to the command bytes, such as an opcode and address
+ * @param command_len: How many command bytes to send
+ * @param tx_data: Data to send after the command, or NULL if receiving
+ * @param rx_data: Where to receive data after the command, or NULL if sending
+ * @param len: How many bytes to send or receive after the command
+ * @param device: Which device to communicate with
+ */
+void spim_command(const uint8_t *command, size_t command_len,
+                  const uint8_t *tx_data, uint8_t *rx_data, size_t len,
+                  spi_device_t device);
+
+/**
+ * @brief Requests that buffered stdout data is sent over BLE.
+ */
+void ble_send_pending_data(void);
+
+/**
+ * @brief Returns the number of stdout bytes that have been dropped because no
+ *        central was able to receive them.
+ */
+uint32_t ble_stdout_dropped(void);
+
+/**
+ * @brief Returns the number of stdout bytes that were dropped because they
+ *        were printed from an interrupt while the tx buffer was full.
+ */
+uint32_t ble_stdout_dropped_irq(void);
+
+/**
+ * @brief Returns the number of REPL bytes that were dropped because the rx
+ *        buffer was full.
+ */
+uint32_t ble_stdin_dropped(void);
+
+/**
+ * @brief Returns the current stdout timeout in milliseconds.
+ */
+uint32_t ble_stdout_timeout_get(void);
+
+/**
+ * @brief Sets how long stdout will wait for a central to connect before
+ *        dropping data.
+ * @param timeout_ms: The timeout in milliseconds.
+ */
+void ble_stdout_timeout_set(uint32_t timeout_ms);
+
+/**
+ * @brief Returns the current tx coalescing delay in milliseconds.
+ */
+uint32_t ble_tx_coalesce_get(void);
+
+/**
+ * @brief Sets how long stdout data less than one MTU in size is held back, in
+ *        case more follows. 0 sends data straight away.
+ * @param delay_ms: The delay in milliseconds.
+ */
+void ble_tx_coalesce_set(uint32_t delay_ms);
+
+/**
+ * @brief Gets the current connection parameters. These are all zero when no
+ *        central is connected.
+ * @param params: Pointer to where the parameters will be copied.
+ */
+void ble_conn_params_get(ble_gap_conn_params_t *params);
+
+/**
+ * @brief Returns the number of bytes in either ring buffer which triggers the
+ *        fast connection parameters.
+ */
+uint16_t ble_fast_threshold_get(void);
+
+/**
+ * @brief Sets the number of bytes in either ring buffer which triggers the
+ *        fast connection parameters.
+ * @param threshold: The threshold in bytes.
+ */
+void ble_fast_threshold_set(uint16_t threshold);
+
+/**
+ * @brief Returns how long the link stays fast after the last bulk transfer.
+ */
+uint32_t ble_idle_timeout_get(void);
+
+/**
+ * @brief Sets how long the link stays fast after the last bulk transfer.
+ * @param timeout_ms: The timeout in milliseconds.
+ */
+void ble_idle_timeout_set(uint32_t timeout_ms);
+
+/**
+ * @brief Returns the number of bytes waiting in the bulk data rx buffer.
+ */
+size_t ble_bulk_any(void);
+
+/**
+ * @brief Copies as much received bulk data as is available, without blocking.
+ * @param buffer: Pointer to where the data will be copied.
+ * @param len: The maximum number of bytes to copy.
+ * @returns The number of bytes copied, or 0 if no data is waiting.
+ */
+size_t ble_bulk_read(uint8_t *buffer, size_t len);
+
+/**
+ * @brief Returns true if the central is able to receive bulk data.
+ */
+bool ble_bulk_ready(void);
+
+/**
+ * @brief Queues bulk data as notifications directly from the given buffer,
+ *        without blocking.
+ * @param buffer: Pointer to the data to send.
+ * @param len: The number of bytes to send.
+ * @returns The number of bytes queued, which is less than len once the
+ *          softdevice queue is full.
+ */
+size_t ble_bulk_write(const uint8_t *buffer, size_t len);
+
+/**
+ * @brief Returns the number of bulk data bytes dropped because the rx buffer
+ *        was full.
+ */
+uint32_t ble_bulk_dropped(void);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,379 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 Raj Nakarja - Silicon Witchery AB
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "py/runtime.h"
+#include "py/mperrno.h"
+#include "py/stream.h"
+#include "main.h"
+#include "nrf_soc.h"
+
+/**
+ * @brief Forward declaration of the Bulk class object.
+ */
+const mp_obj_type_t machine_ble_bulk_type;
+
+/**
+ * @brief The single instance of the bulk data stream.
+ */
+STATIC const mp_obj_base_t machine_ble_bulk_obj = {&machine_ble_bulk_type};
+
+/**
+ * @brief Reads bulk data directly into the given buffer. Blocks until at least
+ *        one byte is available.
+ */
+STATIC mp_uint_t machine_ble_bulk_read(mp_obj_t self_in, void *buf, mp_uint_t size, int *errcode)
+{
+    mp_uint_t len = 0;
+
+    // Wait until at least some data has arrived
+    while (size > 0 && (len = ble_bulk_read(buf, size)) == 0)
+    {
+        // Allow the wait to be interrupted
+        mp_handle_pending(true);
+
+        // Wait for events to save power
+        sd_app_evt_wait();
+    }
+
+    return len;
+}
+
+/**
+ * @brief Sends bulk data directly from the given buffer. Blocks until all of
+ *        the data has been queued.
+ */
+STATIC mp_uint_t machine_ble_bulk_write(mp_obj_t self_in, const void *buf, mp_uint_t size, int *errcode)
+{
+    mp_uint_t sent = 0;
+
+    while (sent < size)
+    {
+        // The central must be connected, and have notifications enabled
+        if (!ble_bulk_ready())
+        {
+            if (sent == 0)
+            {
+                *errcode = MP_ENOTCONN;
+                return MP_STREAM_ERROR;
+            }
+
+            return sent;
+        }
+
+        // Queue as much as the softdevice will take
+        sent += ble_bulk_write((const uint8_t *)buf + sent, size - sent);
+
+        // If there's more to send, wait for queued notifications to complete
+        if (sent < size)
+        {
+            mp_handle_pending(true);
+            sd_app_evt_wait();
+        }
+    }
+
+    return sent;
+}
+
+/**
+ * @brief Handles stream polling, so that the bulk stream can be used with
+ *        select and uasyncio.
+ */
+STATIC mp_uint_t machine_ble_bulk_ioctl(mp_obj_t self_in, mp_uint_t request, uintptr_t arg, int *errcode)
+{
+    if (request != MP_STREAM_POLL)
+    {
+        *errcode = MP_EINVAL;
+        return MP_STREAM_ERROR;
+    }
+
+    mp_uint_t ret = 0;
+
+    if ((arg & MP_STREAM_POLL_RD) && ble_bulk_any())
+    {
+        ret |= MP_STREAM_POLL_RD;
+    }
+
+    if ((arg & MP_STREAM_POLL_WR) && ble_bulk_ready())
+    {
+        ret |= MP_STREAM_POLL_WR;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Returns the number of bytes waiting to be read.
+ */
+STATIC mp_obj_t machine_ble_bulk_any(mp_obj_t self_in)
+{
+    return MP_OBJ_NEW_SMALL_INT(ble_bulk_any());
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(machine_ble_bulk_any_obj, machine_ble_bulk_any);
+
+/**
+ * @brief Returns the number of received bytes dropped because the rx buffer was
+ *        full.
+ */
+STATIC mp_obj_t machine_ble_bulk_dropped(mp_obj_t self_in)
+{
+    return mp_obj_new_int_from_uint(ble_bulk_dropped());
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(machine_ble_bulk_dropped_obj, machine_ble_bulk_dropped);
+
+/**
+ * @brief Local class dictionary. Contains all the methods of Bulk.
+ */
+STATIC const mp_rom_map_elem_t machine_ble_bulk_locals_dict_table[] = {
+
+    // Stream methods
+    {MP_ROM_QSTR(MP_QSTR_read), MP_ROM_PTR(&mp_stream_read_obj)},
+    {MP_ROM_QSTR(MP_QSTR_readinto), MP_ROM_PTR(&mp_stream_readinto_obj)},
+    {MP_ROM_QSTR(MP_QSTR_write), MP_ROM_PTR(&mp_stream_write_obj)},
+
+    // Class methods
+    {MP_ROM_QSTR(MP_QSTR_any), MP_ROM_PTR(&machine_ble_bulk_any_obj)},
+    {MP_ROM_QSTR(MP_QSTR_dropped), MP_ROM_PTR(&machine_ble_bulk_dropped_obj)},
+};
+STATIC MP_DEFINE_CONST_DICT(machine_ble_bulk_locals_dict, machine_ble_bulk_locals_dict_table);
+
+/**
+ * @brief Stream protocol for the Bulk object.
+ */
+STATIC const mp_stream_p_t machine_ble_bulk_stream_p = {
+    .read = machine_ble_bulk_read,
+    .write = machine_ble_bulk_write,
+    .ioctl = machine_ble_bulk_ioctl,
+    .is_text = false,
+};
+
+/**
+ * @brief Class structure for the Bulk object.
+ */
+const mp_obj_type_t machine_ble_bulk_type = {
+    .base = {&mp_type_type},
+    .name = MP_QSTR_Bulk,
+    .print = NULL,
+    .make_new = NULL,
+    .call = NULL,
+    .protocol = &machine_ble_bulk_stream_p,
+    .locals_dict = (mp_obj_dict_t *)&machine_ble_bulk_locals_dict,
+};
+
+/**
+ * @brief Returns how many bytes of stdout data have been dropped because no
+ *        central was connected and listening.
+ */
+STATIC mp_obj_t machine_ble_stdout_dropped(void)
+{
+    return mp_obj_new_int_from_uint(ble_stdout_dropped());
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(machine_ble_stdout_dropped_obj, machine_ble_stdout_dropped);
+
+/**
+ * @brief Returns how many bytes of stdout data have been dropped because they
+ *        were printed from an interrupt, such as a hard Pin or Timer callback,
+ *        while the buffer was full. Interrupts can't wait for space.
+ */
+STATIC mp_obj_t machine_ble_stdout_dropped_irq(void)
+{
+    return mp_obj_new_int_from_uint(ble_stdout_dropped_irq());
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(machine_ble_stdout_dropped_irq_obj, machine_ble_stdout_dropped_irq);
+
+/**
+ * @brief Returns how many bytes of REPL input have been dropped because they
+ *        arrived faster than the REPL could consume them.
+ */
+STATIC mp_obj_t machine_ble_stdin_dropped(void)
+{
+    return mp_obj_new_int_from_uint(ble_stdin_dropped());
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(machine_ble_stdin_dropped_obj, machine_ble_stdin_dropped);
+
+/**
+ * @brief Returns the time in ms that stdout will wait for a central to connect
+ *        once its buffer is full. If an argument is given, the timeout is set
+ *        to that value. A timeout of 0 drops data immediately.
+ */
+STATIC mp_obj_t machine_ble_stdout_timeout(size_t n_args, const mp_obj_t *args)
+{
+    // If no arguments are given, return the current timeout
+    if (n_args == 0)
+    {
+        return mp_obj_new_int_from_uint(ble_stdout_timeout_get());
+    }
+
+    // Otherwise, ensure the timeout is valid
+    mp_int_t timeout = mp_obj_get_int(args[0]);
+
+    if (timeout < 0)
+    {
+        mp_raise_ValueError(MP_ERROR_TEXT("timeout cannot be negative"));
+    }
+
+    // Set the timeout
+    ble_stdout_timeout_set(timeout);
+
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(machine_ble_stdout_timeout_obj, 0, 1, machine_ble_stdout_timeout);
+
+/**
+ * @brief Returns the time in ms that stdout data smaller than one packet is
+ *        held back, in case more data follows. If an argument is given, the
+ *        delay is set to that value. A delay of 0 sends data straight away.
+ */
+STATIC mp_obj_t machine_ble_tx_coalesce(size_t n_args, const mp_obj_t *args)
+{
+    // If no arguments are given, return the current delay
+    if (n_args == 0)
+    {
+        return mp_obj_new_int_from_uint(ble_tx_coalesce_get());
+    }
+
+    // Otherwise, ensure the delay is valid
+    mp_int_t delay = mp_obj_get_int(args[0]);
+
+    if (delay < 0)
+    {
+        mp_raise_ValueError(MP_ERROR_TEXT("delay cannot be negative"));
+    }
+
+    // Set the delay
+    ble_tx_coalesce_set(delay);
+
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(machine_ble_tx_coalesce_obj, 0, 1, machine_ble_tx_coalesce);
+
+/**
+ * @brief Returns the current connection parameters as a tuple of the interval
+ *        in ms, the slave latency, and the supervision timeout in ms.
+ */
+STATIC mp_obj_t machine_ble_conn_params(void)
+{
+    // Get the parameters. The actual interval is held in both min and max
+    ble_gap_conn_params_t params;
+    ble_conn_params_get(&params);
+
+    mp_obj_t tuple[3] = {
+        mp_obj_new_float(params.max_conn_interval * 1.25f),
+        MP_OBJ_NEW_SMALL_INT(params.slave_latency),
+        MP_OBJ_NEW_SMALL_INT(params.conn_sup_timeout * 10),
+    };
+
+    return mp_obj_new_tuple(3, tuple);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(machine_ble_conn_params_obj, machine_ble_conn_params);
+
+/**
+ * @brief Returns the number of buffered bytes which switches the link to fast
+ *        connection parameters. If an argument is given, the threshold is set
+ *        to that value.
+ */
+STATIC mp_obj_t machine_ble_fast_threshold(size_t n_args, const mp_obj_t *args)
+{
+    // If no arguments are given, return the current threshold
+    if (n_args == 0)
+    {
+        return MP_OBJ_NEW_SMALL_INT(ble_fast_threshold_get());
+    }
+
+    // Otherwise, ensure the threshold is valid
+    mp_int_t threshold = mp_obj_get_int(args[0]);
+
+    if (threshold < 1 || threshold > UINT16_MAX)
+    {
+        mp_raise_ValueError(MP_ERROR_TEXT("threshold out of range"));
+    }
+
+    // Set the threshold
+    ble_fast_threshold_set(threshold);
+
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(machine_ble_fast_threshold_obj, 0, 1, machine_ble_fast_threshold);
+
+/**
+ * @brief Returns the time in ms after the last bulk transfer that the link goes
+ *        back to idle connection parameters. If an argument is given, the
+ *        timeout is set to that value.
+ */
+STATIC mp_obj_t machine_ble_idle_timeout(size_t n_args, const mp_obj_t *args)
+{
+    // If no arguments are given, return the current timeout
+    if (n_args == 0)
+    {
+        return mp_obj_new_int_from_uint(ble_idle_timeout_get());
+    }
+
+    // Otherwise, ensure the timeout is valid
+    mp_int_t timeout = mp_obj_get_int(args[0]);
+
+    if (timeout < 1)
+    {
+        mp_raise_ValueError(MP_ERROR_TEXT("timeout must be at least 1ms"));
+    }
+
+    // Set the timeout
+    ble_idle_timeout_set(timeout);
+
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(machine_ble_idle_timeout_obj, 0, 1, machine_ble_idle_timeout);
+
+/**
+ * @brief Local class dictionary. Contains all the methods and constants of BLE.
+ */
+STATIC const mp_rom_map_elem_t machine_ble_locals_dict_table[] = {
+
+    // Class methods
+    {MP_ROM_QSTR(MP_QSTR_stdin_dropped), MP_ROM_PTR(&machine_ble_stdin_dropped_obj)},
+    {MP_ROM_QSTR(MP_QSTR_stdout_dropped), MP_ROM_PTR(&machine_ble_stdout_dropped_obj)},
+    {MP_ROM_QSTR(MP_QSTR_stdout_dropped_irq), MP_ROM_PTR(&machine_ble_stdout_dropped_irq_obj)},
+    {MP_ROM_QSTR(MP_QSTR_stdout_timeout), MP_ROM_PTR(&machine_ble_stdout_timeout_obj)},
+    {MP_ROM_QSTR(MP_QSTR_tx_coalesce), MP_ROM_PTR(&machine_ble_tx_coalesce_obj)},
+    {MP_ROM_QSTR(MP_QSTR_conn_params), MP_ROM_PTR(&machine_ble_conn_params_obj)},
+    {MP_ROM_QSTR(MP_QSTR_fast_threshold), MP_ROM_PTR(&machine_ble_fast_threshold_obj)},
+    {MP_ROM_QSTR(MP_QSTR_idle_timeout), MP_ROM_PTR(&machine_ble_idle_timeout_obj)},
+
+    // Bulk data stream
+    {MP_ROM_QSTR(MP_QSTR_bulk), MP_ROM_PTR(&machine_ble_bulk_obj)},
+};
+STATIC MP_DEFINE_CONST_DICT(machine_ble_locals_dict, machine_ble_locals_dict_table);
+
+/**
+ * @brief Class structure for the BLE object.
+ */
+const mp_obj_type_t machine_ble_type = {
+    .base = {&mp_type_type},
+    .name = MP_QSTR_BLE,
+    .print = NULL,
+    .make_new = NULL,
+    .call = NULL,
+    .locals_dict = (mp_obj_dict_t *)&machine_ble_locals_dict,
+};
@@ -26,13 +26,67 @@
 
 #include "py/obj.h"
 #include "py/runtime.h"
+#include "py/mphal.h"
+#include "extmod/vfs.h"
 #include "main.h"
+#include "modmachine.h"
 #include "nrfx_glue.h"
 
 /**
- * @brief Local flag to indicate if the flash is asleep
+ * @brief Flash object. Each one is a block device over a region of the flash.
  */
-static bool flash_asleep = true;
+typedef struct _machine_flash_obj_t
+{
+    mp_obj_base_t base;
+    uint32_t start;
+    uint32_t len;
+} machine_flash_obj_t;
+
+/**
+ * @brief Power state of the flash. It's put into deep sleep automatically once
+ *        it hasn't been used for the idle timeout, which is 0 when disabled.
+ *        The counters track how often it's woken up, and how long it's awake.
+ */
+static struct
+{
+    bool asleep;
+    uint32_t idle_timeout_ms;
+    uint32_t wakes;
+    uint64_t awake_since;
+    uint64_t awake_ticks;
+    bool status_checked;
+} flash_power = {
+    .asleep = true,
+    .idle_timeout_ms = 50,
+};
+
+/**
+ * @brief Erase or program operation which has been started, and which the
+ *        flash may still be carrying out in the background.
+ */
+static struct
+{
+    bool busy;
+    bool erasing;
+    bool suspendable;
+    uint32_t resumed_cycles;
+} flash_op = {0};
+
+/**
+ * @brief An erase has to run for tSUS after it's resumed before it can be
+ *        suspended again, or back to back reads could stop it making progress.
+ *        The time is kept in CPU cycles, which run at 64MHz, and wrap around
+ *        every 67 seconds.
+ */
+#define FLASH_SUSPEND_SPACING_US (20)
+#define FLASH_CPU_CYCLES_PER_US (64)
+
+/**
+ * @brief How often the flash is checked for completion in the background,
+ *        depending on the operation.
+ */
+#define FLASH_POLL_ERASE_MS (10)
+#define FLASH_POLL_PROGRAM_MS (1)
 
 /**
  * @brief Helper function to check if the flash is currently busy during a
@@ -54,38 +108,117 @@ static bool flash_busy(void)
 }
 
 /**
- * @brief Wakes up the flash from deep sleep.
+ * @brief Returns true once the last erase or program operation has completed.
+ *        Only reads the status register while an operation is outstanding.
  */
-static void machine_flash_wake(void)
+static bool flash_op_done(void)
 {
-    // Wake up the flash using the 9 byte sequence
-    uint8_t wake_seq[4] = {0xAB, 0, 0, 0};
-    uint8_t wake_res[5] = {0};
-    spim_tx_rx((uint8_t *)&wake_seq, 4, (uint8_t *)&wake_res, 5, FLASH);
+    if (flash_op.busy && !flash_busy())
+    {
+        flash_op.busy = false;
+    }
 
-    // Wait tRES1 to come out of sleep
-    NRFX_DELAY_US(3);
+    return !flash_op.busy;
+}
+
+/**
+ * @brief Waits until the last erase or program operation has completed.
+ */
+void machine_flash_wait_ready(void)
+{
+    while (!flash_op_done())
+    {
+        // Erases take milliseconds, whereas programs take microseconds
+        NRFX_DELAY_US(flash_op.erasing ? 1000 : 50);
+    }
+}
 
-    // Enable the reset command
-    uint8_t reset_en_cmd = 0x66;
-    spim_tx_rx((uint8_t *)&reset_en_cmd, 1, NULL, 0, FLASH);
+/**
+ * @brief Handler for the background poll timeout. This runs inside the RTC
+ *        interrupt, so the status check is scheduled to run from the main
+ *        thread, where it can't collide with other SPI transfers.
+ */
+static void flash_poll_timeout(void);
 
-    // Issue the reset command
-    uint8_t reset_cmd = 0x99;
-    spim_tx_rx((uint8_t *)&reset_cmd + 1, 1, NULL, 0, FLASH);
+/**
+ * @brief Scheduled check for completion of the operation. Calls the handler
+ *        set with Flash.irq() once the flash is ready, or checks again later.
+ */
+STATIC mp_obj_t machine_flash_poll(mp_obj_t arg)
+{
+    // The status can't be read while the FPGA is using the flash
+    if (machine_fpga_configuring() || !flash_op_done())
+    {
+        machine_rtc_timeout_start(MACHINE_RTC_TIMEOUT_FLASH_POLL,
+                                  flash_op.erasing
+                                      ? FLASH_POLL_ERASE_MS
+                                      : FLASH_POLL_PROGRAM_MS,
+                                  flash_poll_timeout);
+        return mp_const_none;
+    }
 
-    // Wait tRST to fully reset
-    NRFX_DELAY_US(30);
+    mp_obj_t handler = MP_STATE_PORT(flash_irq_handler);
 
-    // Mark the flash as awake
-    flash_asleep = false;
+    if (handler != MP_OBJ_NULL && handler != mp_const_none)
+    {
+        mp_call_function_0(handler);
+    }
+
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(machine_flash_poll_obj, machine_flash_poll);
+
+static void flash_poll_timeout(void)
+{
+    machine_irq_schedule(MP_OBJ_FROM_PTR(&machine_flash_poll_obj), mp_const_none);
 }
 
 /**
- * @brief Puts the flash into deep sleep.
+ * @brief Records that an erase or program was started, and starts polling for
+ *        its completion if a handler is waiting for it.
+ * @param erasing: True if the operation is an erase.
+ * @param suspendable: True if the operation can be suspended to allow reads.
  */
-STATIC mp_obj_t machine_flash_sleep(void)
+static void flash_op_start(bool erasing, bool suspendable)
 {
+    flash_op.busy = true;
+    flash_op.erasing = erasing;
+    flash_op.suspendable = suspendable;
+
+    mp_obj_t handler = MP_STATE_PORT(flash_irq_handler);
+
+    if (handler != MP_OBJ_NULL && handler != mp_const_none)
+    {
+        machine_rtc_timeout_start(MACHINE_RTC_TIMEOUT_FLASH_POLL,
+                                  erasing
+                                      ? FLASH_POLL_ERASE_MS
+                                      : FLASH_POLL_PROGRAM_MS,
+                                  flash_poll_timeout);
+    }
+}
+
+/**
+ * @brief Handler for the idle timeout. Like the poll timeout, this runs inside
+ *        the RTC interrupt, so the flash is put to sleep from the main thread.
+ */
+static void flash_idle_timeout(void);
+
+/**
+ * @brief Puts the flash into deep sleep. Waits for any erase or write to
+ *        complete first.
+ */
+static void flash_sleep(void)
+{
+    machine_rtc_timeout_stop(MACHINE_RTC_TIMEOUT_FLASH_IDLE);
+
+    if (flash_power.asleep)
+    {
+        return;
+    }
+
+    // The flash ignores the sleep command while it's busy
+    machine_flash_wait_ready();
+
     // Issue the deep sleep command
     uint8_t sleep_cmd = 0xB9;
     spim_tx_rx((uint8_t *)&sleep_cmd, 1, NULL, 0, FLASH);
@@ -93,42 +226,444 @@ STATIC mp_obj_t machine_flash_sleep(void)
     // Wait tDB to sleep
     NRFX_DELAY_US(2);
 
-    // Mark the flash as asleep
-    flash_asleep = true;
+    // Mark the flash as asleep, and count how long it was awake for
+    flash_power.asleep = true;
+    flash_power.awake_ticks += machine_rtc_ticks() - flash_power.awake_since;
+}
+
+/**
+ * @brief Scheduled once the flash has been idle for the idle timeout. Puts it
+ *        to sleep, unless an erase or write is still running.
+ */
+STATIC mp_obj_t machine_flash_idle(mp_obj_t arg)
+{
+    // The FPGA reads its image from the flash while configuring, so the flash
+    // is left awake, and its bus alone, until it's done
+    if (machine_fpga_configuring() || !flash_op_done())
+    {
+        machine_rtc_timeout_start(MACHINE_RTC_TIMEOUT_FLASH_IDLE,
+                                  flash_power.idle_timeout_ms,
+                                  flash_idle_timeout);
+        return mp_const_none;
+    }
+
+    flash_sleep();
 
     return mp_const_none;
 }
-STATIC MP_DEFINE_CONST_FUN_OBJ_0(machine_flash_sleep_obj, machine_flash_sleep);
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(machine_flash_idle_obj, machine_flash_idle);
+
+static void flash_idle_timeout(void)
+{
+    machine_irq_schedule(MP_OBJ_FROM_PTR(&machine_flash_idle_obj), mp_const_none);
+}
 
 /**
- * @brief Erases the entire flash if no block number is given. Otherwise erases
- *        the the 4k block provided. Automatically wakes up the flash if needed.
+ * @brief The flash keeps running while the nRF resets, so an erase or write
+ *        from before the reset may still be in progress, or be suspended.
+ *        Checked once after boot, so that the driver starts from whatever
+ *        state the flash is in.
  */
-STATIC mp_obj_t machine_flash_erase(size_t n_args, const mp_obj_t *args)
+static void flash_status_check(void)
 {
-    // If flash is asleep, wake it up first
-    if (flash_asleep)
+    flash_power.status_checked = true;
+
+    // Resume a suspended erase or write, as nothing will resume it otherwise
+    uint8_t status_reg[1] = {0x35};
+    uint8_t status_res[2] = {0};
+    spim_tx_rx((uint8_t *)&status_reg, 1, (uint8_t *)&status_res, 2, FLASH);
+
+    if (status_res[1] & 0x80)
     {
-        machine_flash_wake();
+        uint8_t resume_cmd = 0x7A;
+        spim_tx_rx((uint8_t *)&resume_cmd, 1, NULL, 0, FLASH);
+
+        flash_op.resumed_cycles = mp_hal_ticks_cpu();
+    }
+
+    // Whatever is running can't be known, so treat it as a long erase which
+    // can't be suspended
+    if (flash_busy())
+    {
+        flash_op.busy = true;
+        flash_op.erasing = true;
+        flash_op.suspendable = false;
+    }
+}
+
+/**
+ * @brief Wakes up the flash from deep sleep if needed. Must be called before
+ *        each use of the flash, as it also pushes back the idle timeout.
+ */
+void machine_flash_wake(void)
+{
+    if (flash_power.idle_timeout_ms != 0)
+    {
+        machine_rtc_timeout_start(MACHINE_RTC_TIMEOUT_FLASH_IDLE,
+                                  flash_power.idle_timeout_ms,
+                                  flash_idle_timeout);
+    }
+
+    if (!flash_power.asleep)
+    {
+        return;
+    }
+
+    // Release the flash from deep sleep
+    uint8_t wake_cmd = 0xAB;
+    spim_tx_rx((uint8_t *)&wake_cmd, 1, NULL, 0, FLASH);
+
+    // Wait tRES1 to come out of sleep
+    NRFX_DELAY_US(3);
+
+    // Mark the flash as awake
+    flash_power.asleep = false;
+    flash_power.awake_since = machine_rtc_ticks();
+    flash_power.wakes++;
+
+    if (!flash_power.status_checked)
+    {
+        flash_status_check();
+    }
+}
+
+/**
+ * @brief Reads any number of bytes from any address of the flash, directly
+ *        into the buffer given. A block erase in progress is suspended while
+ *        the data is read. Automatically wakes up the flash if needed.
+ * @param address: The 24bit address to read from.
+ * @param buffer: Where the data will be copied.
+ * @param len: The number of bytes to read.
+ */
+void machine_flash_read(uint32_t address, uint8_t *buffer, size_t len)
+{
+    // Wake up the flash if it's asleep
+    machine_flash_wake();
+
+    bool suspended = false;
+
+    if (!flash_op_done())
+    {
+        // Programs are short, so just let them finish
+        if (!flash_op.suspendable)
+        {
+            machine_flash_wait_ready();
+        }
+
+        // Otherwise suspend the erase, and wait tSUS for it to pause
+        else
+        {
+            // Give the erase its tSUS since it was last resumed first
+            uint32_t since_resume_us = (uint32_t)(mp_hal_ticks_cpu() - flash_op.resumed_cycles) /
+                                       FLASH_CPU_CYCLES_PER_US;
+
+            if (since_resume_us < FLASH_SUSPEND_SPACING_US)
+            {
+                NRFX_DELAY_US(FLASH_SUSPEND_SPACING_US - since_resume_us);
+            }
+
+            uint8_t suspend_cmd = 0x75;
+            spim_tx_rx((uint8_t *)&suspend_cmd, 1, NULL, 0, FLASH);
+
+            while (flash_busy())
+            {
+                NRFX_DELAY_US(5);
+            }
+
+            suspended = true;
+        }
     }
 
+    // Prepare the fast read command along with address and a dummy byte
+    uint8_t read_cmd[5] = {
+        0x0B,
+        (uint8_t)(address >> 16),
+        (uint8_t)(address >> 8),
+        (uint8_t)address,
+        0x00,
+    };
+
+    // The flash streams out data for as long as the chip select is held
+    spim_command(read_cmd, sizeof(read_cmd), NULL, buffer, len, FLASH);
+
+    // Let the erase carry on
+    if (suspended)
+    {
+        uint8_t resume_cmd = 0x7A;
+        spim_tx_rx((uint8_t *)&resume_cmd, 1, NULL, 0, FLASH);
+
+        flash_op.resumed_cycles = mp_hal_ticks_cpu();
+    }
+}
+
+/**
+ * @brief Programs any number of bytes to any address of the flash, splitting
+ *        the data at page boundaries. Each page is sent straight from the
+ *        buffer given once the previous page has completed, and the last page
+ *        is left to complete in the background. The area must have been erased
+ *        first. Automatically wakes up the flash if needed.
+ * @param address: The 24bit address to write to.
+ * @param buffer: The data to write.
+ * @param len: The number of bytes to write.
+ */
+void machine_flash_program(uint32_t address, const uint8_t *buffer, size_t len)
+{
+    // Wake up the flash if it's asleep
+    machine_flash_wake();
+
+    while (len > 0)
+    {
+        // Write up to the end of the current page
+        size_t chunk = MACHINE_FLASH_PAGE_SIZE -
+                       (address & (MACHINE_FLASH_PAGE_SIZE - 1));
+
+        if (chunk > len)
+        {
+            chunk = len;
+        }
+
+        // Populate the write sequence
+        uint8_t write_cmd[4] = {
+            0x02,
+            (uint8_t)(address >> 16),
+            (uint8_t)(address >> 8),
+            (uint8_t)address,
+        };
+
+        // The flash can only accept a new page once it's ready
+        machine_flash_wait_ready();
+
+        // Write sequence always starts with a write enable instruction
+        uint8_t write_enable_cmd = 0x06;
+        spim_tx_rx((uint8_t *)&write_enable_cmd, 1, NULL, 0, FLASH);
+
+        // Send the command followed by the page data, without copying it
+        spim_command(write_cmd, sizeof(write_cmd), buffer, NULL, chunk, FLASH);
+
+        flash_op_start(false, false);
+
+        address += chunk;
+        buffer += chunk;
+        len -= chunk;
+    }
+}
+
+/**
+ * @brief Starts an erase of the 4k, 32k or 64k block at the address given,
+ *        and leaves it to complete in the background. Automatically wakes up
+ *        the flash if needed.
+ * @param address: The 24bit address of the block, aligned to its size.
+ * @param size: The size of the block in bytes.
+ */
+static void flash_erase_block(uint32_t address, uint32_t size)
+{
+    // Wake up the flash if it's asleep
+    machine_flash_wake();
+
+    // The previous operation has to complete first
+    machine_flash_wait_ready();
+
     // An erase sequence always starts with a write enable instruction
     uint8_t write_enable_cmd = 0x06;
     spim_tx_rx((uint8_t *)&write_enable_cmd, 1, NULL, 0, FLASH);
 
+    // Pick the 64k, 32k or 4k block erase command
+    uint8_t erase_cmd = 0x20;
+
+    if (size == 0x10000)
+    {
+        erase_cmd = 0xD8;
+    }
+    else if (size == 0x8000)
+    {
+        erase_cmd = 0x52;
+    }
+
+    // Erase the block from the 24bit address given
+    uint8_t erase_block[4] = {
+        erase_cmd,
+        (uint8_t)(address >> 16),
+        (uint8_t)(address >> 8),
+        0x00 // Bottom byte is always 0
+    };
+    spim_tx_rx((uint8_t *)&erase_block, 4, NULL, 0, FLASH);
+
+    flash_op_start(true, true);
+}
+
+/**
+ * @brief Erases a range of the flash using the largest block erases which fit
+ *        each part of it. Each erase waits for the previous one, and the last
+ *        one is left to complete in the background.
+ * @param address: The 24bit address to start from, aligned to 4k.
+ * @param len: The number of bytes to erase, a multiple of 4k.
+ */
+void machine_flash_erase_range(uint32_t address, uint32_t len)
+{
+    uint32_t end = address + len;
+
+    while (address < end)
+    {
+        // Pick the largest block which is aligned, and fits in what's left.
+        // The flash only has 64k, 32k and 4k erases, so there's no 16k or 8k
+        uint32_t size = 0x10000;
+
+        if ((address & (size - 1)) || address + size > end)
+        {
+            size = 0x8000;
+        }
+
+        if ((address & (size - 1)) || address + size > end)
+        {
+            size = MACHINE_FLASH_BLOCK_SIZE;
+        }
+
+        flash_erase_block(address, size);
+
+        address += size;
+    }
+}
+
+/**
+ * @brief Puts the flash into deep sleep straight away. Waits for any erase or
+ *        write to complete first.
+ */
+STATIC mp_obj_t machine_flash_sleep(void)
+{
+    flash_sleep();
+
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(machine_flash_sleep_obj, machine_flash_sleep);
+STATIC MP_DEFINE_CONST_STATICMETHOD_OBJ(machine_flash_sleep_static_obj, MP_ROM_PTR(&machine_flash_sleep_obj));
+
+/**
+ * @brief Gets or sets how long the flash can be idle, in milliseconds, before
+ *        it's put into deep sleep. 0 disables the automatic sleep.
+ */
+STATIC mp_obj_t machine_flash_idle_timeout(size_t n_args, const mp_obj_t *args)
+{
+    // If no args are given, return the current timeout
+    if (n_args == 0)
+    {
+        return mp_obj_new_int_from_uint(flash_power.idle_timeout_ms);
+    }
+
+    mp_int_t timeout_ms = mp_obj_get_int(args[0]);
+
+    if (timeout_ms < 0)
+    {
+        mp_raise_ValueError(MP_ERROR_TEXT("timeout must be positive"));
+    }
+
+    flash_power.idle_timeout_ms = timeout_ms;
+
+    // Apply the new timeout to a flash which is already awake
+    if (timeout_ms == 0)
+    {
+        machine_rtc_timeout_stop(MACHINE_RTC_TIMEOUT_FLASH_IDLE);
+    }
+    else if (!flash_power.asleep)
+    {
+        machine_rtc_timeout_start(MACHINE_RTC_TIMEOUT_FLASH_IDLE,
+                                  flash_power.idle_timeout_ms,
+                                  flash_idle_timeout);
+    }
+
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(machine_flash_idle_timeout_obj, 0, 1, machine_flash_idle_timeout);
+STATIC MP_DEFINE_CONST_STATICMETHOD_OBJ(machine_flash_idle_timeout_static_obj, MP_ROM_PTR(&machine_flash_idle_timeout_obj));
+
+/**
+ * @brief Returns a tuple of how many times the flash has been woken up, and
+ *        for how many milliseconds in total it has been awake.
+ */
+STATIC mp_obj_t machine_flash_power_stats(void)
+{
+    uint64_t awake_ticks = flash_power.awake_ticks;
+
+    // Include the time it has been awake for so far
+    if (!flash_power.asleep)
+    {
+        awake_ticks += machine_rtc_ticks() - flash_power.awake_since;
+    }
+
+    mp_obj_t tuple[2] = {
+        mp_obj_new_int_from_uint(flash_power.wakes),
+        mp_obj_new_int_from_ull(awake_ticks * 1000 / MACHINE_RTC_FREQUENCY),
+    };
+
+    return mp_obj_new_tuple(2, tuple);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(machine_flash_power_stats_obj, machine_flash_power_stats);
+STATIC MP_DEFINE_CONST_STATICMETHOD_OBJ(machine_flash_power_stats_static_obj, MP_ROM_PTR(&machine_flash_power_stats_obj));
+
+/**
+ * @brief Returns true while an erase or write is still being carried out.
+ */
+STATIC mp_obj_t machine_flash_busy(void)
+{
+    return mp_obj_new_bool(!flash_op_done());
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(machine_flash_busy_obj, machine_flash_busy);
+STATIC MP_DEFINE_CONST_STATICMETHOD_OBJ(machine_flash_busy_static_obj, MP_ROM_PTR(&machine_flash_busy_obj));
+
+/**
+ * @brief Sets a handler which is scheduled once an erase or write completes.
+ *        Setting the handler to None disables it.
+ */
+STATIC mp_obj_t machine_flash_irq(mp_obj_t handler)
+{
+    if (handler != mp_const_none && !mp_obj_is_callable(handler))
+    {
+        mp_raise_ValueError(MP_ERROR_TEXT("handler must be callable"));
+    }
+
+    MP_STATE_PORT(flash_irq_handler) = handler;
+
+    // Stop polling if there's no handler, otherwise catch any operation
+    // which is already in progress
+    if (handler == mp_const_none)
+    {
+        machine_rtc_timeout_stop(MACHINE_RTC_TIMEOUT_FLASH_POLL);
+    }
+    else if (flash_op.busy)
+    {
+        flash_op_start(flash_op.erasing, flash_op.suspendable);
+    }
+
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(machine_flash_irq_obj, machine_flash_irq);
+STATIC MP_DEFINE_CONST_STATICMETHOD_OBJ(machine_flash_irq_static_obj, MP_ROM_PTR(&machine_flash_irq_obj));
+
+/**
+ * @brief Erases the entire flash if no block number is given. Otherwise erases
+ *        the the 4k block provided. Returns straight away, while the flash
+ *        carries out the erase. Automatically wakes up the flash if needed.
+ */
+STATIC mp_obj_t machine_flash_erase(size_t n_args, const mp_obj_t *args)
+{
     // If no args are given
     if (n_args == 0)
     {
+        // Wake up the flash if it's asleep
+        machine_flash_wake();
+
+        // The previous operation has to complete first
+        machine_flash_wait_ready();
+
+        // An erase sequence always starts with a write enable instruction
+        uint8_t write_enable_cmd = 0x06;
+        spim_tx_rx((uint8_t *)&write_enable_cmd, 1, NULL, 0, FLASH);
+
         // Issue the chip erase command
         uint8_t chip_erase_cmd = 0x60;
         spim_tx_rx((uint8_t *)&chip_erase_cmd, 1, NULL, 0, FLASH);
 
-        // Wait until the erase is complete
-        while (flash_busy())
-        {
-            // Wait 1ms to check again
-            NRFX_DELAY_US(1000);
-        }
+        // A chip erase can't be suspended
+        flash_op_start(true, false);
 
         return mp_const_none;
     }
@@ -139,128 +674,292 @@ STATIC mp_obj_t machine_flash_erase(size_t n_args, const mp_obj_t *args)
         mp_raise_ValueError(MP_ERROR_TEXT("block number must be less than 1024"));
     }
 
-    // Determine address from the page number
-    uint32_t address = mp_obj_get_int(args[0]) * 0x1000;
+    // Erase the block at the address of the block number
+    flash_erase_block(mp_obj_get_int(args[0]) * MACHINE_FLASH_BLOCK_SIZE,
+                      MACHINE_FLASH_BLOCK_SIZE);
 
-    // Erase a 4k page from the 24bit address given
-    uint8_t erase_block[4] = {
-        0x20,
-        (uint8_t)(address >> 16),
-        (uint8_t)(address >> 8),
-        0x00 // Bottom byte is always 0
-    };
-    spim_tx_rx((uint8_t *)&erase_block, 4, NULL, 0, FLASH);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(machine_flash_erase_obj, 0, 1, machine_flash_erase);
+STATIC MP_DEFINE_CONST_STATICMETHOD_OBJ(machine_flash_erase_static_obj, MP_ROM_PTR(&machine_flash_erase_obj));
+
+/**
+ * @brief Erases length bytes of the Flash starting from address. Both must be
+ *        multiples of 4k. Uses 64k and 32k block erases wherever they fit,
+ *        and 4k erases for the rest. Returns once the last erase has been
+ *        started, while the flash carries it out.
+ * @param address_obj: The byte address to start erasing from.
+ * @param length_obj: The number of bytes to erase.
+ */
+STATIC mp_obj_t machine_flash_erase_range_method(mp_obj_t address_obj, mp_obj_t length_obj)
+{
+    mp_int_t address = mp_obj_get_int(address_obj);
+    mp_int_t length = mp_obj_get_int(length_obj);
+
+    // The range must be whole 4k blocks
+    if (address % MACHINE_FLASH_BLOCK_SIZE || length % MACHINE_FLASH_BLOCK_SIZE)
+    {
+        mp_raise_ValueError(MP_ERROR_TEXT("address and length must be multiples of 4096"));
+    }
 
-    // Wait until the erase is complete
-    while (flash_busy())
+    // And it must fit inside the flash, checked so that nothing can overflow
+    if (address < 0 || length < 0 || address > MACHINE_FLASH_SIZE ||
+        length > MACHINE_FLASH_SIZE - address)
     {
-        // Wait 1ms to check again
-        NRFX_DELAY_US(1000);
+        mp_raise_ValueError(MP_ERROR_TEXT("erase is outside of the flash"));
     }
 
+    machine_flash_erase_range(address, length);
+
     return mp_const_none;
 }
-STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(machine_flash_erase_obj, 0, 1, machine_flash_erase);
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(machine_flash_erase_range_obj, machine_flash_erase_range_method);
+STATIC MP_DEFINE_CONST_STATICMETHOD_OBJ(machine_flash_erase_range_static_obj, MP_ROM_PTR(&machine_flash_erase_range_obj));
 
 /**
- * @brief Reads n bytes from a page of Flash, where n is the length of the read
- *        buffer. n cannot be bigger than 256 bytes. Automatically wakes up the
- *        flash if needed.
- * @param page: The 256 byte page to read from.
+ * @brief Reads n bytes from any address of the Flash, where n is the length
+ *        of the read buffer. There is no limit on n, and the data is read
+ *        directly into the buffer. Automatically wakes up the flash if needed.
+ *        Available as both Flash.read() and Flash.readinto(), so that reads
+ *        take byte addresses just as writes do.
+ * @param address: The byte address to read from.
  * @param read_obj: The read buffer as a bytearray() object.
  */
-STATIC mp_obj_t machine_flash_read(mp_obj_t page, mp_obj_t read_obj)
+STATIC mp_obj_t machine_flash_readinto(mp_obj_t address_obj, mp_obj_t read_obj)
 {
     // Create a read buffer from the object given
     mp_buffer_info_t read;
     mp_get_buffer_raise(read_obj, &read, MP_BUFFER_WRITE);
 
-    // Check page size
-    if (read.len > 256)
+    mp_int_t address = mp_obj_get_int(address_obj);
+
+    // Check the read fits inside the flash
+    if (address < 0 || address + read.len > MACHINE_FLASH_SIZE)
     {
-        mp_raise_ValueError(MP_ERROR_TEXT("buffer cannot be bigger than 256 bytes"));
+        mp_raise_ValueError(MP_ERROR_TEXT("read is outside of the flash"));
     }
 
-    // If flash is asleep, wake it up first
-    if (flash_asleep)
+    machine_flash_read(address, read.buf, read.len);
+
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(machine_flash_readinto_obj, machine_flash_readinto);
+STATIC MP_DEFINE_CONST_STATICMETHOD_OBJ(machine_flash_readinto_static_obj, MP_ROM_PTR(&machine_flash_readinto_obj));
+
+/**
+ * @brief Writes n bytes to any address of the Flash, where n is the length of
+ *        the write buffer. There is no limit on n, and writes which cross page
+ *        boundaries are split automatically. The area must have been erased
+ *        first. Returns once the last page has been sent, while the flash
+ *        carries on programming it. Automatically wakes up the flash if needed.
+ * @param address: The byte address to write to.
+ * @param write_obj: The write buffer as a bytearray() object.
+ */
+STATIC mp_obj_t machine_flash_write(mp_obj_t address_obj, mp_obj_t write_obj)
+{
+    // Create a write buffer from the object given
+    mp_buffer_info_t write;
+    mp_get_buffer_raise(write_obj, &write, MP_BUFFER_READ);
+
+    mp_int_t address = mp_obj_get_int(address_obj);
+
+    // Check the write fits inside the flash
+    if (address < 0 || address + write.len > MACHINE_FLASH_SIZE)
     {
-        machine_flash_wake();
+        mp_raise_ValueError(MP_ERROR_TEXT("write is outside of the flash"));
     }
 
-    // Get the address from the page give
-    uint32_t address = mp_obj_get_int(page) * 0x100;
+    machine_flash_program(address, write.buf, write.len);
 
-    // Prepare the read command along with address
-    uint8_t read_cmd[4] = {
-        0x03,
-        (uint8_t)(address >> 16),
-        (uint8_t)(address >> 8),
-        0x00, // Bottom byte is always 0
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(machine_flash_write_obj, machine_flash_write);
+STATIC MP_DEFINE_CONST_STATICMETHOD_OBJ(machine_flash_write_static_obj, MP_ROM_PTR(&machine_flash_write_obj));
+
+/**
+ * @brief Gets or sets the SPI clock frequency in Hz used for the flash.
+ *        Supported values are 125kHz, 250kHz, 500kHz, 1MHz, 2MHz, 4MHz and
+ *        8MHz.
+ */
+STATIC mp_obj_t machine_flash_frequency(size_t n_args, const mp_obj_t *args)
+{
+    // If no args are given, return the current frequency
+    if (n_args == 0)
+    {
+        return mp_obj_new_int_from_uint(spim_frequency_get(FLASH));
+    }
+
+    // Otherwise set it, if it's supported
+    if (!spim_frequency_set(FLASH, mp_obj_get_int(args[0])))
+    {
+        mp_raise_ValueError(MP_ERROR_TEXT("unsupported frequency"));
+    }
+
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(machine_flash_frequency_obj, 0, 1, machine_flash_frequency);
+STATIC MP_DEFINE_CONST_STATICMETHOD_OBJ(machine_flash_frequency_static_obj, MP_ROM_PTR(&machine_flash_frequency_obj));
+
+/**
+ * @brief Creates a block device over a region of the flash. Expects the format
+ *        as: machine.Flash(start=0x100000, len=0x200000), where both are
+ *        optional and must be multiples of the 4k block size. The default
+ *        region is the one used by the filesystem.
+ */
+STATIC mp_obj_t machine_flash_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args)
+{
+    // Create the allowed arguments table
+    static const mp_arg_t allowed_args[] = {
+        {MP_QSTR_start, MP_ARG_INT, {.u_int = MACHINE_FLASH_FS_START}},
+        {MP_QSTR_len, MP_ARG_INT, {.u_int = MACHINE_FLASH_FS_SIZE}},
     };
 
-    // Create an rx buffer big enough for the read sequence and payload
-    uint8_t read_buff[4 + 256];
+    // Parse args
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all_kw_array(n_args, n_kw, all_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
 
-    // Send read sequence, and read data into the temporary buffer
-    spim_tx_rx((uint8_t *)&read_cmd, 4, read_buff, read.len + 4, FLASH);
+    mp_int_t start = args[0].u_int;
+    mp_int_t len = args[1].u_int;
 
-    // Copy the data from the temporary buffer into the real one
-    memcpy(read.buf, read_buff + 4, read.len);
+    // The region must be whole blocks
+    if (start % MACHINE_FLASH_BLOCK_SIZE || len % MACHINE_FLASH_BLOCK_SIZE)
+    {
+        mp_raise_ValueError(MP_ERROR_TEXT("start and len must be multiples of 4096"));
+    }
 
-    return mp_const_none;
+    // And it must fit inside the flash
+    if (start < 0 || len <= 0 || start + len > MACHINE_FLASH_SIZE)
+    {
+        mp_raise_ValueError(MP_ERROR_TEXT("region is outside of the flash"));
+    }
+
+    // Create the flash object
+    machine_flash_obj_t *self = m_new_obj(machine_flash_obj_t);
+    self->base.type = &machine_flash_type;
+    self->start = start;
+    self->len = len;
+
+    return MP_OBJ_FROM_PTR(self);
 }
-STATIC MP_DEFINE_CONST_FUN_OBJ_2(machine_flash_read_obj, machine_flash_read);
 
 /**
- * @brief Writes n bytes from a page of Flash, where n is the length of the
- *        write buffer. n cannot be bigger than 256 bytes. Automatically wakes
- *        up the flash if needed.
- * @param page: The 256 byte page to write to.
- * @param write_obj: The write buffer as a bytearray() object.
+ * @brief Converts a block number and offset into a flash address, and checks
+ *        that the access lies inside the region of the block device.
  */
-STATIC mp_obj_t machine_flash_write(mp_obj_t page, mp_obj_t write_obj)
+static uint32_t machine_flash_block_address(machine_flash_obj_t *self,
+                                            mp_obj_t block_num,
+                                            mp_int_t offset,
+                                            size_t len)
 {
-    // Create a write buffer from the object given
-    mp_buffer_info_t write;
-    mp_get_buffer_raise(write_obj, &write, MP_BUFFER_READ);
+    mp_int_t block = mp_obj_get_int(block_num);
 
-    // Check page size
-    if (write.len > 256)
+    // Check each part before they're combined, so that nothing can overflow
+    if (block < 0 || block >= self->len / MACHINE_FLASH_BLOCK_SIZE ||
+        offset < 0 || offset >= self->len)
     {
-        mp_raise_ValueError(MP_ERROR_TEXT("buffer cannot be bigger than 256 bytes"));
+        mp_raise_ValueError(MP_ERROR_TEXT("block is outside of the region"));
     }
 
-    // If flash is asleep, wake it up first
-    if (flash_asleep)
+    uint32_t address = block * MACHINE_FLASH_BLOCK_SIZE + offset;
+
+    if (address >= self->len || len > self->len - address)
     {
-        machine_flash_wake();
+        mp_raise_ValueError(MP_ERROR_TEXT("block is outside of the region"));
     }
 
-    // Write sequence always starts with a write enable instruction
-    uint8_t write_enable_cmd = 0x06;
-    spim_tx_rx((uint8_t *)&write_enable_cmd, 1, NULL, 0, FLASH);
+    return self->start + address;
+}
 
-    // Get the address from the page give
-    uint32_t address = mp_obj_get_int(page) * 0x100;
+/**
+ * @brief Block device read. Reads the length of buf, starting from offset
+ *        bytes into the block given. Any number of blocks can be read at once.
+ */
+STATIC mp_obj_t machine_flash_readblocks(size_t n_args, const mp_obj_t *args)
+{
+    machine_flash_obj_t *self = MP_OBJ_TO_PTR(args[0]);
 
-    // Create a tx buffer big enough for the write sequence and payload
-    uint8_t write_buff[4 + 256];
+    // Create a read buffer from the object given
+    mp_buffer_info_t read;
+    mp_get_buffer_raise(args[2], &read, MP_BUFFER_WRITE);
 
-    // Populate the write sequence
-    write_buff[0] = 0x02;
-    write_buff[1] = (uint8_t)(address >> 16);
-    write_buff[2] = (uint8_t)(address >> 8);
-    write_buff[3] = 0x00; // Bottom byte is always 0
+    // Offset is only given by the extended block device protocol
+    mp_int_t offset = n_args == 4 ? mp_obj_get_int(args[3]) : 0;
 
-    // Copy the payload into the write buffer
-    memcpy(write_buff + 4, write.buf, write.len);
+    // Read directly into the buffer
+    machine_flash_read(machine_flash_block_address(self, args[1], offset, read.len),
+                       read.buf, read.len);
 
-    // Send the data
-    spim_tx_rx((uint8_t *)&write_buff, write.len + 4, NULL, 0, FLASH);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(machine_flash_readblocks_obj, 3, 4, machine_flash_readblocks);
+
+/**
+ * @brief Block device write. Without an offset, every block is erased before
+ *        it's written. With an offset, the data is written to blocks that have
+ *        already been erased using ioctl().
+ */
+STATIC mp_obj_t machine_flash_writeblocks(size_t n_args, const mp_obj_t *args)
+{
+    machine_flash_obj_t *self = MP_OBJ_TO_PTR(args[0]);
+
+    // Create a write buffer from the object given
+    mp_buffer_info_t write;
+    mp_get_buffer_raise(args[2], &write, MP_BUFFER_READ);
+
+    // Offset is only given by the extended block device protocol
+    mp_int_t offset = n_args == 4 ? mp_obj_get_int(args[3]) : 0;
+
+    uint32_t address = machine_flash_block_address(self, args[1], offset, write.len);
+
+    // The simple protocol expects whole blocks to be erased first
+    if (n_args == 3)
+    {
+        machine_flash_erase_range(address, write.len);
+    }
+
+    // Write the data
+    machine_flash_program(address, write.buf, write.len);
 
     return mp_const_none;
 }
-STATIC MP_DEFINE_CONST_FUN_OBJ_2(machine_flash_write_obj, machine_flash_write);
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(machine_flash_writeblocks_obj, 3, 4, machine_flash_writeblocks);
+
+/**
+ * @brief Block device control. Used by the filesystem to get the size of the
+ *        region, and to erase blocks.
+ */
+STATIC mp_obj_t machine_flash_ioctl(mp_obj_t self_in, mp_obj_t op_in, mp_obj_t arg_in)
+{
+    machine_flash_obj_t *self = MP_OBJ_TO_PTR(self_in);
+
+    switch (mp_obj_get_int(op_in))
+    {
+    case MP_BLOCKDEV_IOCTL_INIT:
+        return MP_OBJ_NEW_SMALL_INT(0);
+
+    case MP_BLOCKDEV_IOCTL_DEINIT:
+    case MP_BLOCKDEV_IOCTL_SYNC:
+        // Make sure the last write or erase has completed
+        machine_flash_wait_ready();
+        return MP_OBJ_NEW_SMALL_INT(0);
+
+    case MP_BLOCKDEV_IOCTL_BLOCK_COUNT:
+        return MP_OBJ_NEW_SMALL_INT(self->len / MACHINE_FLASH_BLOCK_SIZE);
+
+    case MP_BLOCKDEV_IOCTL_BLOCK_SIZE:
+        return MP_OBJ_NEW_SMALL_INT(MACHINE_FLASH_BLOCK_SIZE);
+
+    case MP_BLOCKDEV_IOCTL_BLOCK_ERASE:
+        flash_erase_block(machine_flash_block_address(self, arg_in, 0,
+                                                      MACHINE_FLASH_BLOCK_SIZE),
+                          MACHINE_FLASH_BLOCK_SIZE);
+        return MP_OBJ_NEW_SMALL_INT(0);
+
+    default:
+        return mp_const_none;
+    }
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_3(machine_flash_ioctl_obj, machine_flash_ioctl);
 
 /**
  * @brief Global module dictionary containing all of the methods and constants
@@ -269,10 +968,22 @@ STATIC MP_DEFINE_CONST_FUN_OBJ_2(machine_flash_write_obj, machine_flash_write);
 STATIC const mp_rom_map_elem_t machine_flash_locals_dict_table[] = {
 
     // Local methods
-    {MP_ROM_QSTR(MP_QSTR_sleep), MP_ROM_PTR(&machine_flash_sleep_obj)},
-    {MP_ROM_QSTR(MP_QSTR_erase), MP_ROM_PTR(&machine_flash_erase_obj)},
-    {MP_ROM_QSTR(MP_QSTR_read), MP_ROM_PTR(&machine_flash_read_obj)},
-    {MP_ROM_QSTR(MP_QSTR_write), MP_ROM_PTR(&machine_flash_write_obj)},
+    {MP_ROM_QSTR(MP_QSTR_sleep), MP_ROM_PTR(&machine_flash_sleep_static_obj)},
+    {MP_ROM_QSTR(MP_QSTR_idle_timeout), MP_ROM_PTR(&machine_flash_idle_timeout_static_obj)},
+    {MP_ROM_QSTR(MP_QSTR_power_stats), MP_ROM_PTR(&machine_flash_power_stats_static_obj)},
+    {MP_ROM_QSTR(MP_QSTR_busy), MP_ROM_PTR(&machine_flash_busy_static_obj)},
+    {MP_ROM_QSTR(MP_QSTR_irq), MP_ROM_PTR(&machine_flash_irq_static_obj)},
+    {MP_ROM_QSTR(MP_QSTR_erase), MP_ROM_PTR(&machine_flash_erase_static_obj)},
+    {MP_ROM_QSTR(MP_QSTR_erase_range), MP_ROM_PTR(&machine_flash_erase_range_static_obj)},
+    {MP_ROM_QSTR(MP_QSTR_read), MP_ROM_PTR(&machine_flash_readinto_static_obj)},
+    {MP_ROM_QSTR(MP_QSTR_readinto), MP_ROM_PTR(&machine_flash_readinto_static_obj)},
+    {MP_ROM_QSTR(MP_QSTR_write), MP_ROM_PTR(&machine_flash_write_static_obj)},
+    {MP_ROM_QSTR(MP_QSTR_frequency), MP_ROM_PTR(&machine_flash_frequency_static_obj)},
+
+    // Block device protocol
+    {MP_ROM_QSTR(MP_QSTR_readblocks), MP_ROM_PTR(&machine_flash_readblocks_obj)},
+    {MP_ROM_QSTR(MP_QSTR_writeblocks), MP_ROM_PTR(&machine_flash_writeblocks_obj)},
+    {MP_ROM_QSTR(MP_QSTR_ioctl), MP_ROM_PTR(&machine_flash_ioctl_obj)},
 };
 STATIC MP_DEFINE_CONST_DICT(machine_flash_locals_dict, machine_flash_locals_dict_table);
 
@@ -283,7 +994,7 @@ const mp_obj_type_t machine_flash_type = {
     .base = {&mp_type_type},
     .name = MP_QSTR_Flash,
     .print = NULL,
-    .make_new = NULL,
+    .make_new = machine_flash_make_new,
     .call = NULL,
     .locals_dict = (mp_obj_dict_t *)&machine_flash_locals_dict,
 };
\ No newline at end of file
@@ -27,18 +27,24 @@
 #include "py/obj.h"
 #include "py/runtime.h"
 #include "py/qstr.h"
+#include "py/mphal.h"
 #include "main.h"
+#include "modmachine.h"
 #include "nrfx_gpiote.h"
 
 /**
- * @brief Information about the configured done pin interrupt and handler.
+ * @brief Information about the configured done pin interrupt. The handler
+ *        itself is kept in MP_STATE_PORT(fpga_irq_handler).
  */
 static struct
 {
     bool enabled;
-    mp_obj_t handler;
+    bool hard;
+    volatile mp_uint_t time;
 } done_pin_irq = {
     .enabled = false,
+    .hard = false,
+    .time = 0,
 };
 
 /**
@@ -83,9 +89,21 @@ void fpga_done_pin_irq_handler(nrfx_gpiote_pin_t pin, nrfx_gpiote_trigger_t trig
     // Otherwise, in running mode, and if an irq callback is enabled
     if (done_pin_irq.enabled)
     {
-        // Call the handler, and pass the edge polarity to it
-        mp_call_function_1(done_pin_irq.handler,
-                           MP_OBJ_NEW_SMALL_INT(nrf_gpio_pin_read(16)));
+        // Record when the interrupt happened, so the latency can be measured
+        done_pin_irq.time = mp_hal_ticks_us();
+
+        // The edge polarity is passed to the handler
+        mp_obj_t edge = MP_OBJ_NEW_SMALL_INT(nrf_gpio_pin_read(16));
+
+        // Hard handlers are called straight away
+        if (done_pin_irq.hard)
+        {
+            machine_irq_call_hard(MP_STATE_PORT(fpga_irq_handler), 1, &edge);
+            return;
+        }
+
+        // Otherwise the callback runs from the main thread once it's safe to
+        machine_irq_schedule(MP_STATE_PORT(fpga_irq_handler), edge);
     }
 }
 
@@ -122,12 +140,23 @@ void machine_fpga_init(void)
     nrfx_gpiote_in_event_enable(16, true);
 }
 
+/**
+ * @brief Returns true while the FPGA is loading its image from the flash.
+ */
+bool machine_fpga_configuring(void)
+{
+    return fpga_state == FPGA_CONFIGURING;
+}
+
 /**
  * @brief Brings the FPGA out of reset and into the run state.
  */
 STATIC mp_obj_t machine_fpga_run(void)
 {
-    // TODO do we need to wake up the flash first?
+    // The FPGA loads its image from the flash, so the flash must be awake and
+    // finished with any erase or write
+    machine_flash_wake();
+    machine_flash_wait_ready();
 
     // Set nRF pin 20 to bring the FPGA out of reset
     nrf_gpio_pin_set(20);
@@ -181,17 +210,36 @@ STATIC MP_DEFINE_CONST_FUN_OBJ_0(machine_fpga_status_obj, machine_fpga_status);
 
 /**
  * @brief Method for setting up the done pin interrupt when in running mode.
- *        Expects format as FPGA.irq(handler).
+ *        Expects format as FPGA.irq(handler, hard=False). Handlers are
+ *        scheduled to run from the main thread, unless hard is True, in which
+ *        case they're called from the interrupt and must not allocate memory.
  */
-STATIC mp_obj_t machine_fpga_irq(mp_obj_t handler)
+STATIC mp_obj_t machine_fpga_irq(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args)
 {
+    // Create the allowed arguments table
+    static const mp_arg_t allowed_args[] = {
+        {MP_QSTR_handler, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE}},
+        {MP_QSTR_hard, MP_ARG_KW_ONLY | MP_ARG_BOOL, {.u_bool = false}},
+    };
+
+    // Parse args
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args, pos_args, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    // Disable the interrupt while the handler is changed
+    done_pin_irq.enabled = false;
+
     // Set the callback function from the argument
-    done_pin_irq.handler = handler;
+    MP_STATE_PORT(fpga_irq_handler) = args[0].u_obj;
+    done_pin_irq.hard = args[1].u_bool;
+
+    // Enable the interrupt
+    done_pin_irq.enabled = true;
 
     // Return
     return mp_const_none;
 }
-STATIC MP_DEFINE_CONST_FUN_OBJ_1(machine_fpga_irq_obj, machine_fpga_irq);
+STATIC MP_DEFINE_CONST_FUN_OBJ_KW(machine_fpga_irq_obj, 1, machine_fpga_irq);
 
 /**
  * @brief Disables the interrupt for the done pin.
@@ -206,6 +254,18 @@ STATIC mp_obj_t machine_fpga_irq_disable(void)
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_0(machine_fpga_irq_disable_obj, machine_fpga_irq_disable);
 
+/**
+ * @brief Returns the ticks_us() value of when the last interrupt happened.
+ *        Comparing this against ticks_us() from within the handler gives the
+ *        interrupt latency.
+ */
+STATIC mp_obj_t machine_fpga_irq_time(void)
+{
+    return MP_OBJ_NEW_SMALL_INT(done_pin_irq.time &
+                                (MICROPY_PY_UTIME_TICKS_PERIOD - 1));
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(machine_fpga_irq_time_obj, machine_fpga_irq_time);
+
 /**
  * @brief Reads n bytes from the FPGA, where n is the length of the read buffer.
  * @param read_obj: The read buffer as a bytearray() object
@@ -217,7 +277,7 @@ STATIC mp_obj_t machine_fpga_read(mp_obj_t read_obj)
     mp_get_buffer_raise(read_obj, &read, MP_BUFFER_WRITE);
 
     // Receive the data
-    spim_tx_rx(NULL, 0, (uint8_t *)&read.buf, read.len, FPGA);
+    spim_command(NULL, 0, NULL, read.buf, read.len, FPGA);
 
     return mp_const_none;
 }
@@ -234,7 +294,7 @@ STATIC mp_obj_t machine_fpga_write(mp_obj_t write_obj)
     mp_get_buffer_raise(write_obj, &write, MP_BUFFER_READ);
 
     // Send the data
-    spim_tx_rx((uint8_t *)&write.buf, write.len, NULL, 0, FPGA);
+    spim_command(NULL, 0, write.buf, NULL, write.len, FPGA);
 
     return mp_const_none;
 }
@@ -257,12 +317,35 @@ STATIC mp_obj_t machine_fpga_read_write(mp_obj_t read_obj, mp_obj_t write_obj)
     mp_get_buffer_raise(write_obj, &write, MP_BUFFER_READ);
 
     // Send the data
-    spim_tx_rx((uint8_t *)&write.buf, write.len, (uint8_t *)&read.buf, read.len, FPGA);
+    spim_tx_rx(write.buf, write.len, read.buf, read.len, FPGA);
 
     return mp_const_none;
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_2(machine_fpga_read_write_obj, machine_fpga_read_write);
 
+/**
+ * @brief Gets or sets the SPI clock frequency in Hz used for the FPGA.
+ *        Supported values are 125kHz, 250kHz, 500kHz, 1MHz, 2MHz, 4MHz and
+ *        8MHz.
+ */
+STATIC mp_obj_t machine_fpga_frequency(size_t n_args, const mp_obj_t *args)
+{
+    // If no args are given, return the current frequency
+    if (n_args == 0)
+    {
+        return mp_obj_new_int_from_uint(spim_frequency_get(FPGA));
+    }
+
+    // Otherwise set it, if it's supported
+    if (!spim_frequency_set(FPGA, mp_obj_get_int(args[0])))
+    {
+        mp_raise_ValueError(MP_ERROR_TEXT("unsupported frequency"));
+    }
+
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(machine_fpga_frequency_obj, 0, 1, machine_fpga_frequency);
+
 /**
  * @brief Global module dictionary containing all of the methods and constants
  *        for the fpga module.
@@ -275,9 +358,11 @@ STATIC const mp_rom_map_elem_t machine_fpga_locals_dict_table[] = {
     {MP_ROM_QSTR(MP_QSTR_status), MP_ROM_PTR(&machine_fpga_status_obj)},
     {MP_ROM_QSTR(MP_QSTR_irq), MP_ROM_PTR(&machine_fpga_irq_obj)},
     {MP_ROM_QSTR(MP_QSTR_irq_disable), MP_ROM_PTR(&machine_fpga_irq_disable_obj)},
+    {MP_ROM_QSTR(MP_QSTR_irq_time), MP_ROM_PTR(&machine_fpga_irq_time_obj)},
     {MP_ROM_QSTR(MP_QSTR_read), MP_ROM_PTR(&machine_fpga_read_obj)},
     {MP_ROM_QSTR(MP_QSTR_write), MP_ROM_PTR(&machine_fpga_write_obj)},
     {MP_ROM_QSTR(MP_QSTR_read_write), MP_ROM_PTR(&machine_fpga_read_write_obj)},
+    {MP_ROM_QSTR(MP_QSTR_frequency), MP_ROM_PTR(&machine_fpga_frequency_obj)},
 };
 STATIC MP_DEFINE_CONST_DICT(machine_fpga_locals_dict, machine_fpga_locals_dict_table);
 
@@ -0,0 +1,1017 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 Raj Nakarja - Silicon Witchery AB
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <string.h>
+#include "py/obj.h"
+#include "py/objstr.h"
+#include "py/runtime.h"
+#include "py/mperrno.h"
+#include "modmachine.h"
+
+/**
+ * @brief Layout of the key-value store. The region is split into 4k sectors
+ *        which are filled in turn like a ring. Each sector starts with a
+ *        header, followed by records which are only ever appended. Updates
+ *        and deletions append a new record which supersedes the older one.
+ */
+#define KV_SECTOR_SIZE (MACHINE_FLASH_BLOCK_SIZE)
+#define KV_SECTOR_COUNT (MACHINE_FLASH_KV_SIZE / KV_SECTOR_SIZE)
+#define KV_SECTOR_MAGIC (0x3153564B)
+
+/**
+ * @brief Sectors which are always kept free, so that compaction has somewhere
+ *        to copy the live records of the oldest sector to.
+ */
+#define KV_RESERVED_SECTORS (2)
+
+/**
+ * @brief Once fewer than this many sectors are free, the oldest sector is
+ *        compacted in the background after each write, so that writes rarely
+ *        have to wait for compaction themselves.
+ */
+#define KV_COMPACT_SECTORS (KV_RESERVED_SECTORS + 2)
+
+/**
+ * @brief Limits on the size of keys and values.
+ */
+#define KV_MAX_KEY_LEN (64)
+#define KV_MAX_VALUE_LEN (1024)
+
+/**
+ * @brief Size of the RAM index, which limits the number of keys. Must be a
+ *        power of 2.
+ */
+#define KV_INDEX_SIZE (128)
+
+/**
+ * @brief Index locations which mark an unused, or a deleted index entry.
+ *        Neither can be the location of a record.
+ */
+#define KV_INDEX_EMPTY (0x0000)
+#define KV_INDEX_DELETED (0xFFFF)
+
+/**
+ * @brief Header at the start of each sector in use. The sequence number orders
+ *        the sectors from oldest to newest.
+ */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t sequence;
+} kv_sector_header_t;
+
+/**
+ * @brief Header at the start of each record, followed by the key and then the
+ *        value. Records are padded to 4 bytes. The CRC covers the first half
+ *        of the header, the key and the value, so a record torn by a power
+ *        loss is detected. A record with live set to 0 deletes the key.
+ */
+typedef struct
+{
+    uint8_t key_len;
+    uint8_t live;
+    uint16_t value_len;
+    uint32_t crc;
+} kv_record_header_t;
+
+/**
+ * @brief Size of the biggest record including its padding. Up to one less than
+ *        this can be left unused at the end of each sector.
+ */
+#define KV_MAX_RECORD_SIZE \
+    ((sizeof(kv_record_header_t) + KV_MAX_KEY_LEN + KV_MAX_VALUE_LEN + 3) & ~3)
+
+/**
+ * @brief Index entry for a key. Tag holds the top of the key hash to skip most
+ *        mismatches without reading the flash, and location is the offset of
+ *        the record within the region in 4 byte words.
+ */
+typedef struct
+{
+    uint16_t tag;
+    uint16_t location;
+} kv_index_entry_t;
+
+_Static_assert((MACHINE_FLASH_KV_SIZE - KV_MAX_RECORD_SIZE) / 4 < KV_INDEX_DELETED,
+               "record locations must fit in the 16 bit index entries");
+
+/**
+ * @brief Key-value store object. There's only ever one, which is kept as a
+ *        root pointer.
+ */
+typedef struct _machine_kvstore_obj_t
+{
+    mp_obj_base_t base;
+    kv_index_entry_t index[KV_INDEX_SIZE];
+    uint32_t sequence[KV_SECTOR_COUNT];
+    uint64_t erased;
+    uint32_t next_sequence;
+    uint32_t live_bytes;
+    uint16_t count;
+    uint16_t head;
+    uint16_t head_offset;
+} machine_kvstore_obj_t;
+
+_Static_assert(KV_SECTOR_COUNT <= 64, "erased sectors must fit in a 64 bit mask");
+
+/**
+ * @brief Returns the flash address of an offset within a sector.
+ */
+static uint32_t kv_address(uint16_t sector, uint32_t offset)
+{
+    return MACHINE_FLASH_KV_START + sector * KV_SECTOR_SIZE + offset;
+}
+
+/**
+ * @brief Returns the flash address of the record an index entry points to.
+ */
+static uint32_t kv_entry_address(kv_index_entry_t *entry)
+{
+    return MACHINE_FLASH_KV_START + entry->location * 4;
+}
+
+/**
+ * @brief Returns the size of a record including its header and padding.
+ */
+static uint32_t kv_record_size(const kv_record_header_t *header)
+{
+    return (sizeof(kv_record_header_t) + header->key_len + header->value_len + 3) & ~3;
+}
+
+/**
+ * @brief Continues a CRC32 over some data. Start with 0xFFFFFFFF, and invert
+ *        the result once all the data has been added.
+ */
+static uint32_t kv_crc32(uint32_t crc, const uint8_t *data, size_t len)
+{
+    while (len--)
+    {
+        crc ^= *data++;
+
+        for (int i = 0; i < 8; i++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+
+    return crc;
+}
+
+/**
+ * @brief FNV-1a hash of a key.
+ */
+static uint32_t kv_hash(const uint8_t *key, size_t len)
+{
+    uint32_t hash = 2166136261;
+
+    while (len--)
+    {
+        hash = (hash ^ *key++) * 16777619;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Checks if the record an index entry points to has the key given.
+ */
+static bool kv_key_matches(kv_index_entry_t *entry, const uint8_t *key, size_t len)
+{
+    uint8_t record[sizeof(kv_record_header_t) + KV_MAX_KEY_LEN];
+
+    machine_flash_read(kv_entry_address(entry), record, sizeof(kv_record_header_t) + len);
+
+    return ((kv_record_header_t *)record)->key_len == len &&
+           memcmp(record + sizeof(kv_record_header_t), key, len) == 0;
+}
+
+/**
+ * @brief Looks up a key in the index.
+ * @param hash: The hash of the key.
+ * @param found: Set to true if the key was found.
+ * @returns The entry of the key if found. Otherwise the entry where it can be
+ *          added, or NULL if the index is full.
+ */
+static kv_index_entry_t *kv_index_find(machine_kvstore_obj_t *self,
+                                       const uint8_t *key, size_t len,
+                                       uint32_t hash, bool *found)
+{
+    kv_index_entry_t *free_entry = NULL;
+    *found = false;
+
+    // Probe linearly from the hashed entry
+    for (size_t i = 0; i < KV_INDEX_SIZE; i++)
+    {
+        kv_index_entry_t *entry = &self->index[(hash + i) & (KV_INDEX_SIZE - 1)];
+
+        // An empty entry ends the search
+        if (entry->location == KV_INDEX_EMPTY)
+        {
+            return free_entry ? free_entry : entry;
+        }
+
+        // Deleted entries can be reused, but the search has to carry on
+        if (entry->location == KV_INDEX_DELETED)
+        {
+            if (free_entry == NULL)
+            {
+                free_entry = entry;
+            }
+
+            continue;
+        }
+
+        if (entry->tag == (uint16_t)(hash >> 16) &&
+            kv_key_matches(entry, key, len))
+        {
+            *found = true;
+            return entry;
+        }
+    }
+
+    return free_entry;
+}
+
+/**
+ * @brief Points the index at a record which has just been read or written,
+ *        replacing any older record of the same key.
+ */
+static void kv_index_update(machine_kvstore_obj_t *self, uint32_t address,
+                            const kv_record_header_t *header, const uint8_t *key)
+{
+    uint32_t hash = kv_hash(key, header->key_len);
+    bool found;
+    kv_index_entry_t *entry = kv_index_find(self, key, header->key_len, hash, &found);
+
+    // The older record is no longer live
+    if (found)
+    {
+        kv_record_header_t old;
+        machine_flash_read(kv_entry_address(entry), (uint8_t *)&old, sizeof(old));
+
+        self->live_bytes -= kv_record_size(&old);
+        self->count--;
+        entry->location = KV_INDEX_DELETED;
+    }
+
+    // Deletions leave the key out of the index
+    if (!header->live)
+    {
+        return;
+    }
+
+    if (entry == NULL)
+    {
+        mp_raise_msg(&mp_type_OSError, MP_ERROR_TEXT("too many keys"));
+    }
+
+    entry->tag = hash >> 16;
+    entry->location = (address - MACHINE_FLASH_KV_START) / 4;
+
+    self->live_bytes += kv_record_size(header);
+    self->count++;
+}
+
+/**
+ * @brief Checks that a record is intact, and reads its key.
+ * @param address: The address of the record.
+ * @param header: The header which has already been read.
+ * @param key: Where the key will be copied.
+ */
+static bool kv_record_valid(uint32_t address, const kv_record_header_t *header,
+                            uint8_t *key)
+{
+    // The lengths must be sensible, and the record must fit in its sector
+    if (header->key_len == 0 ||
+        header->key_len > KV_MAX_KEY_LEN ||
+        header->value_len > KV_MAX_VALUE_LEN ||
+        (address % KV_SECTOR_SIZE) + kv_record_size(header) > KV_SECTOR_SIZE)
+    {
+        return false;
+    }
+
+    machine_flash_read(address + sizeof(kv_record_header_t), key, header->key_len);
+
+    uint32_t crc = kv_crc32(0xFFFFFFFF, (const uint8_t *)header, 4);
+    crc = kv_crc32(crc, key, header->key_len);
+
+    // Check the value in chunks
+    uint32_t value_address = address + sizeof(kv_record_header_t) + header->key_len;
+    uint8_t chunk[64];
+
+    for (uint32_t done = 0; done < header->value_len; done += sizeof(chunk))
+    {
+        uint32_t len = MIN(sizeof(chunk), header->value_len - done);
+        machine_flash_read(value_address + done, chunk, len);
+        crc = kv_crc32(crc, chunk, len);
+    }
+
+    return ~crc == header->crc;
+}
+
+/**
+ * @brief Adds all of the intact records in a sector to the index.
+ * @returns The offset where the next record can be written, or the sector
+ *          size if a torn record was found and the sector can't be used.
+ */
+static uint32_t kv_scan_sector(machine_kvstore_obj_t *self, uint16_t sector)
+{
+    uint32_t offset = sizeof(kv_sector_header_t);
+
+    while (offset + sizeof(kv_record_header_t) <= KV_SECTOR_SIZE)
+    {
+        uint32_t address = kv_address(sector, offset);
+        kv_record_header_t header;
+        uint8_t key[KV_MAX_KEY_LEN];
+
+        machine_flash_read(address, (uint8_t *)&header, sizeof(header));
+
+        // Unwritten space marks the end of the sector
+        if (header.key_len == 0xFF && header.value_len == 0xFFFF)
+        {
+            return offset;
+        }
+
+        // Nothing more can be written after a torn record
+        if (!kv_record_valid(address, &header, key))
+        {
+            return KV_SECTOR_SIZE;
+        }
+
+        kv_index_update(self, address, &header, key);
+
+        offset += kv_record_size(&header);
+    }
+
+    return KV_SECTOR_SIZE;
+}
+
+/**
+ * @brief Returns the number of sectors which aren't in use.
+ */
+static size_t kv_free_sectors(machine_kvstore_obj_t *self)
+{
+    size_t free = 0;
+
+    for (size_t i = 0; i < KV_SECTOR_COUNT; i++)
+    {
+        if (self->sequence[i] == 0)
+        {
+            free++;
+        }
+    }
+
+    return free;
+}
+
+/**
+ * @brief Returns the sector in use with the lowest sequence number after the
+ *        one given, or KV_SECTOR_COUNT if there are none.
+ */
+static uint16_t kv_next_oldest(machine_kvstore_obj_t *self, uint32_t after)
+{
+    uint16_t oldest = KV_SECTOR_COUNT;
+
+    for (uint16_t i = 0; i < KV_SECTOR_COUNT; i++)
+    {
+        if (self->sequence[i] > after &&
+            (oldest == KV_SECTOR_COUNT ||
+             self->sequence[i] < self->sequence[oldest]))
+        {
+            oldest = i;
+        }
+    }
+
+    return oldest;
+}
+
+/**
+ * @brief Checks if a sector is fully erased.
+ */
+static bool kv_sector_blank(uint16_t sector)
+{
+    uint32_t chunk[16];
+
+    for (uint32_t offset = 0; offset < KV_SECTOR_SIZE; offset += sizeof(chunk))
+    {
+        machine_flash_read(kv_address(sector, offset), (uint8_t *)chunk, sizeof(chunk));
+
+        for (size_t i = 0; i < MP_ARRAY_SIZE(chunk); i++)
+        {
+            if (chunk[i] != 0xFFFFFFFF)
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Starts a new head sector after the current one, erasing it first if
+ *        needed.
+ */
+static void kv_open_head(machine_kvstore_obj_t *self)
+{
+    // Use the next free sector along, so that wear is spread over them all
+    for (uint16_t i = 1; i <= KV_SECTOR_COUNT; i++)
+    {
+        uint16_t sector = (self->head + i) % KV_SECTOR_COUNT;
+
+        if (self->sequence[sector] != 0)
+        {
+            continue;
+        }
+
+        // Sectors freed by compaction are already erased. Others are checked
+        if (!(self->erased & (1ULL << sector)) && !kv_sector_blank(sector))
+        {
+            machine_flash_erase_range(kv_address(sector, 0), KV_SECTOR_SIZE);
+        }
+
+        kv_sector_header_t header = {
+            .magic = KV_SECTOR_MAGIC,
+            .sequence = self->next_sequence++,
+        };
+
+        // The magic goes last, so that a torn header never looks valid
+        machine_flash_program(kv_address(sector, sizeof(header.magic)),
+                              (const uint8_t *)&header.sequence, sizeof(header.sequence));
+        machine_flash_program(kv_address(sector, 0),
+                              (const uint8_t *)&header.magic, sizeof(header.magic));
+
+        self->erased &= ~(1ULL << sector);
+        self->sequence[sector] = header.sequence;
+        self->head = sector;
+        self->head_offset = sizeof(kv_sector_header_t);
+        return;
+    }
+
+    mp_raise_OSError(MP_ENOSPC);
+}
+
+/**
+ * @brief Appends a record to the head sector, which must have room for it. The
+ *        value is either given in RAM, or copied from another flash address.
+ * @returns The address of the new record.
+ */
+static uint32_t kv_write_record(machine_kvstore_obj_t *self,
+                                const kv_record_header_t *header,
+                                const uint8_t *key,
+                                const uint8_t *value,
+                                uint32_t value_address)
+{
+    uint32_t address = kv_address(self->head, self->head_offset);
+    uint32_t value_start = address + sizeof(kv_record_header_t) + header->key_len;
+
+    // The header goes first, so that a torn record always fails its CRC
+    machine_flash_program(address, (const uint8_t *)header, sizeof(kv_record_header_t));
+    machine_flash_program(address + sizeof(kv_record_header_t), key, header->key_len);
+
+    if (value)
+    {
+        machine_flash_program(value_start, value, header->value_len);
+    }
+    else
+    {
+        uint8_t chunk[64];
+
+        for (uint32_t done = 0; done < header->value_len; done += sizeof(chunk))
+        {
+            uint32_t len = MIN(sizeof(chunk), header->value_len - done);
+            machine_flash_read(value_address + done, chunk, len);
+            machine_flash_program(value_start + done, chunk, len);
+        }
+    }
+
+    self->head_offset += kv_record_size(header);
+
+    return address;
+}
+
+static void kv_make_room(machine_kvstore_obj_t *self, uint32_t size, bool compacting);
+
+/**
+ * @brief Moves the live records out of the oldest sector, and then erases it
+ *        in the background. Superseded records and deletions are dropped.
+ */
+static void kv_compact(machine_kvstore_obj_t *self)
+{
+    uint16_t tail = kv_next_oldest(self, 0);
+
+    // The head is being written to, so it can't be compacted
+    if (tail == self->head)
+    {
+        mp_raise_OSError(MP_ENOSPC);
+    }
+
+    uint32_t offset = sizeof(kv_sector_header_t);
+
+    while (offset + sizeof(kv_record_header_t) <= KV_SECTOR_SIZE)
+    {
+        uint32_t address = kv_address(tail, offset);
+        kv_record_header_t header;
+        uint8_t key[KV_MAX_KEY_LEN];
+
+        machine_flash_read(address, (uint8_t *)&header, sizeof(header));
+
+        if ((header.key_len == 0xFF && header.value_len == 0xFFFF) ||
+            !kv_record_valid(address, &header, key))
+        {
+            break;
+        }
+
+        offset += kv_record_size(&header);
+
+        // Only records which the index points to are still live
+        bool found;
+        kv_index_entry_t *entry = kv_index_find(self, key, header.key_len,
+                                                kv_hash(key, header.key_len),
+                                                &found);
+
+        if (!found || kv_entry_address(entry) != address)
+        {
+            continue;
+        }
+
+        kv_make_room(self, kv_record_size(&header), true);
+
+        uint32_t moved = kv_write_record(self, &header, key, NULL,
+                                         address + sizeof(kv_record_header_t) + header.key_len);
+
+        entry->location = (moved - MACHINE_FLASH_KV_START) / 4;
+    }
+
+    // Clear the magic first, so that if the erase is cut short, the half
+    // erased sector is taken for a free one at mount rather than a used one
+    uint32_t cleared = 0;
+    machine_flash_program(kv_address(tail, 0), (const uint8_t *)&cleared, sizeof(cleared));
+
+    // Free the sector
+    machine_flash_erase_range(kv_address(tail, 0), KV_SECTOR_SIZE);
+    self->sequence[tail] = 0;
+    self->erased |= 1ULL << tail;
+}
+
+/**
+ * @brief Makes sure that the head sector has room for a record, compacting the
+ *        oldest sectors if they're needed to keep enough sectors free.
+ * @param size: The size of the record.
+ * @param compacting: True if called during compaction, which may use the
+ *                    reserved sectors.
+ */
+static void kv_make_room(machine_kvstore_obj_t *self, uint32_t size, bool compacting)
+{
+    if (self->head_offset + size <= KV_SECTOR_SIZE)
+    {
+        return;
+    }
+
+    if (!compacting)
+    {
+        for (size_t i = 0; kv_free_sectors(self) < KV_RESERVED_SECTORS; i++)
+        {
+            // Only fails if the live data can't fit in the remaining sectors
+            if (i == KV_SECTOR_COUNT)
+            {
+                mp_raise_OSError(MP_ENOSPC);
+            }
+
+            kv_compact(self);
+        }
+
+        // Compaction may have opened a new head with enough room
+        if (self->head_offset + size <= KV_SECTOR_SIZE)
+        {
+            return;
+        }
+    }
+
+    kv_open_head(self);
+}
+
+/**
+ * @brief Rebuilds the index by replaying every sector from oldest to newest.
+ *        Records torn by a power loss are ignored.
+ */
+static void kv_mount(machine_kvstore_obj_t *self)
+{
+    memset(self->index, 0, sizeof(self->index));
+    memset(self->sequence, 0, sizeof(self->sequence));
+    self->erased = 0;
+    self->next_sequence = 1;
+    self->live_bytes = 0;
+    self->count = 0;
+    self->head = KV_SECTOR_COUNT - 1;
+    self->head_offset = KV_SECTOR_SIZE;
+
+    // Find the sectors in use from their headers
+    for (uint16_t i = 0; i < KV_SECTOR_COUNT; i++)
+    {
+        kv_sector_header_t header;
+        machine_flash_read(kv_address(i, 0), (uint8_t *)&header, sizeof(header));
+
+        if (header.magic != KV_SECTOR_MAGIC ||
+            header.sequence == 0 ||
+            header.sequence == 0xFFFFFFFF)
+        {
+            continue;
+        }
+
+        self->sequence[i] = header.sequence;
+
+        if (header.sequence >= self->next_sequence)
+        {
+            self->next_sequence = header.sequence + 1;
+            self->head = i;
+        }
+    }
+
+    // Replay the records
+    for (uint16_t sector = kv_next_oldest(self, 0);
+         sector != KV_SECTOR_COUNT;
+         sector = kv_next_oldest(self, self->sequence[sector]))
+    {
+        uint32_t end = kv_scan_sector(self, sector);
+
+        if (sector == self->head)
+        {
+            self->head_offset = end;
+        }
+    }
+}
+
+/**
+ * @brief Scheduled after a write which leaves few sectors free. Compacts one
+ *        sector at a time outside of the write, so that the next writes
+ *        usually find the sectors they need already free.
+ */
+STATIC mp_obj_t machine_kvstore_compact_step(mp_obj_t self_in)
+{
+    machine_kvstore_obj_t *self = MP_OBJ_TO_PTR(self_in);
+
+    // The store may have been cleared, or compacted, since this was scheduled
+    if (kv_free_sectors(self) < KV_COMPACT_SECTORS &&
+        KV_SECTOR_COUNT - kv_free_sectors(self) > 1)
+    {
+        kv_compact(self);
+    }
+
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(machine_kvstore_compact_step_obj, machine_kvstore_compact_step);
+
+/**
+ * @brief Adds, replaces or deletes a key. Only has to compact sectors itself if
+ *        the background compaction hasn't kept up.
+ * @param live: False to delete the key.
+ */
+static void kv_put(machine_kvstore_obj_t *self, mp_obj_t key_obj, mp_obj_t value_obj, bool live)
+{
+    mp_buffer_info_t key;
+    mp_get_buffer_raise(key_obj, &key, MP_BUFFER_READ);
+
+    mp_buffer_info_t value = {.buf = NULL, .len = 0};
+
+    if (live)
+    {
+        mp_get_buffer_raise(value_obj, &value, MP_BUFFER_READ);
+    }
+
+    if (key.len == 0 || key.len > KV_MAX_KEY_LEN)
+    {
+        mp_raise_ValueError(MP_ERROR_TEXT("key must be 1 to 64 bytes"));
+    }
+
+    if (value.len > KV_MAX_VALUE_LEN)
+    {
+        mp_raise_ValueError(MP_ERROR_TEXT("value cannot be bigger than 1024 bytes"));
+    }
+
+    // Check the key can be added or deleted before writing anything
+    bool found;
+    kv_index_entry_t *entry = kv_index_find(self, key.buf, key.len,
+                                            kv_hash(key.buf, key.len), &found);
+
+    if (!live && !found)
+    {
+        nlr_raise(mp_obj_new_exception_arg1(&mp_type_KeyError, key_obj));
+    }
+
+    if (live && !found && entry == NULL)
+    {
+        mp_raise_msg(&mp_type_OSError, MP_ERROR_TEXT("too many keys"));
+    }
+
+    kv_record_header_t header = {
+        .key_len = key.len,
+        .live = live,
+        .value_len = value.len,
+    };
+
+    uint32_t crc = kv_crc32(0xFFFFFFFF, (const uint8_t *)&header, 4);
+    crc = kv_crc32(crc, key.buf, key.len);
+    crc = kv_crc32(crc, value.buf, value.len);
+    header.crc = ~crc;
+
+    uint32_t size = kv_record_size(&header);
+
+    // Make sure the live data will still fit once everything is compacted
+    if (live &&
+        self->live_bytes + size >
+            (KV_SECTOR_COUNT - KV_RESERVED_SECTORS) *
+                (KV_SECTOR_SIZE - sizeof(kv_sector_header_t) - KV_MAX_RECORD_SIZE))
+    {
+        mp_raise_OSError(MP_ENOSPC);
+    }
+
+    kv_make_room(self, size, false);
+
+    uint32_t address = kv_write_record(self, &header, key.buf, value.buf, 0);
+
+    kv_index_update(self, address, &header, key.buf);
+
+    // Free the next sectors in the background before they're needed
+    if (kv_free_sectors(self) < KV_COMPACT_SECTORS)
+    {
+        machine_irq_schedule(MP_OBJ_FROM_PTR(&machine_kvstore_compact_step_obj),
+                             MP_OBJ_FROM_PTR(self));
+    }
+}
+
+/**
+ * @brief Returns the value of a key as bytes, or MP_OBJ_NULL if it's missing.
+ */
+static mp_obj_t kv_get(machine_kvstore_obj_t *self, mp_obj_t key_obj)
+{
+    mp_buffer_info_t key;
+    mp_get_buffer_raise(key_obj, &key, MP_BUFFER_READ);
+
+    if (key.len == 0 || key.len > KV_MAX_KEY_LEN)
+    {
+        return MP_OBJ_NULL;
+    }
+
+    bool found;
+    kv_index_entry_t *entry = kv_index_find(self, key.buf, key.len,
+                                            kv_hash(key.buf, key.len), &found);
+
+    if (!found)
+    {
+        return MP_OBJ_NULL;
+    }
+
+    kv_record_header_t header;
+    machine_flash_read(kv_entry_address(entry), (uint8_t *)&header, sizeof(header));
+
+    // Read the value straight into a new bytes object
+    vstr_t vstr;
+    vstr_init_len(&vstr, header.value_len);
+    machine_flash_read(kv_entry_address(entry) + sizeof(header) + header.key_len,
+                       (uint8_t *)vstr.buf, header.value_len);
+
+    return mp_obj_new_str_from_vstr(&mp_type_bytes, &vstr);
+}
+
+/**
+ * @brief Returns the key-value store, mounting it the first time. Expects the
+ *        format as: machine.KVStore().
+ */
+STATIC mp_obj_t machine_kvstore_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args)
+{
+    mp_arg_check_num(n_args, n_kw, 0, 0, false);
+
+    if (MP_STATE_PORT(kvstore) == MP_OBJ_NULL)
+    {
+        machine_kvstore_obj_t *self = m_new_obj(machine_kvstore_obj_t);
+        self->base.type = &machine_kvstore_type;
+
+        kv_mount(self);
+
+        MP_STATE_PORT(kvstore) = MP_OBJ_FROM_PTR(self);
+    }
+
+    return MP_STATE_PORT(kvstore);
+}
+
+/**
+ * @brief Gets, sets or deletes a key using kv[key] syntax.
+ */
+STATIC mp_obj_t machine_kvstore_subscr(mp_obj_t self_in, mp_obj_t index, mp_obj_t value)
+{
+    machine_kvstore_obj_t *self = MP_OBJ_TO_PTR(self_in);
+
+    // Load
+    if (value == MP_OBJ_SENTINEL)
+    {
+        mp_obj_t result = kv_get(self, index);
+
+        if (result == MP_OBJ_NULL)
+        {
+            nlr_raise(mp_obj_new_exception_arg1(&mp_type_KeyError, index));
+        }
+
+        return result;
+    }
+
+    // Delete, or store
+    kv_put(self, index, value, value != MP_OBJ_NULL);
+
+    return mp_const_none;
+}
+
+/**
+ * @brief Supports len() and truth testing of the store.
+ */
+STATIC mp_obj_t machine_kvstore_unary_op(mp_unary_op_t op, mp_obj_t self_in)
+{
+    machine_kvstore_obj_t *self = MP_OBJ_TO_PTR(self_in);
+
+    switch (op)
+    {
+    case MP_UNARY_OP_BOOL:
+        return mp_obj_new_bool(self->count != 0);
+
+    case MP_UNARY_OP_LEN:
+        return MP_OBJ_NEW_SMALL_INT(self->count);
+
+    default:
+        return MP_OBJ_NULL;
+    }
+}
+
+/**
+ * @brief Supports the in operator for checking if a key exists.
+ */
+STATIC mp_obj_t machine_kvstore_binary_op(mp_binary_op_t op, mp_obj_t lhs_in, mp_obj_t rhs_in)
+{
+    machine_kvstore_obj_t *self = MP_OBJ_TO_PTR(lhs_in);
+
+    if (op != MP_BINARY_OP_CONTAINS)
+    {
+        return MP_OBJ_NULL;
+    }
+
+    mp_buffer_info_t key;
+    mp_get_buffer_raise(rhs_in, &key, MP_BUFFER_READ);
+
+    bool found = false;
+
+    if (key.len > 0 && key.len <= KV_MAX_KEY_LEN)
+    {
+        kv_index_find(self, key.buf, key.len, kv_hash(key.buf, key.len), &found);
+    }
+
+    return mp_obj_new_bool(found);
+}
+
+/**
+ * @brief Returns the value of a key, or the default if it doesn't exist.
+ */
+STATIC mp_obj_t machine_kvstore_get(size_t n_args, const mp_obj_t *args)
+{
+    mp_obj_t result = kv_get(MP_OBJ_TO_PTR(args[0]), args[1]);
+
+    if (result == MP_OBJ_NULL)
+    {
+        return n_args == 3 ? args[2] : mp_const_none;
+    }
+
+    return result;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(machine_kvstore_get_obj, 2, 3, machine_kvstore_get);
+
+/**
+ * @brief Returns a list of all the keys as bytes.
+ */
+STATIC mp_obj_t machine_kvstore_keys(mp_obj_t self_in)
+{
+    machine_kvstore_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_obj_t list = mp_obj_new_list(0, NULL);
+
+    for (size_t i = 0; i < KV_INDEX_SIZE; i++)
+    {
+        kv_index_entry_t *entry = &self->index[i];
+
+        if (entry->location == KV_INDEX_EMPTY ||
+            entry->location == KV_INDEX_DELETED)
+        {
+            continue;
+        }
+
+        uint8_t record[sizeof(kv_record_header_t) + KV_MAX_KEY_LEN];
+        machine_flash_read(kv_entry_address(entry), record, sizeof(record));
+
+        mp_obj_list_append(list, mp_obj_new_bytes(record + sizeof(kv_record_header_t),
+                                                  ((kv_record_header_t *)record)->key_len));
+    }
+
+    return list;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(machine_kvstore_keys_obj, machine_kvstore_keys);
+
+/**
+ * @brief Compacts the oldest sector straight away, rather than waiting until
+ *        few sectors are free. Useful to call while the application is idle.
+ */
+STATIC mp_obj_t machine_kvstore_compact(mp_obj_t self_in)
+{
+    machine_kvstore_obj_t *self = MP_OBJ_TO_PTR(self_in);
+
+    // Only sectors other than the head can be compacted
+    if (KV_SECTOR_COUNT - kv_free_sectors(self) > 1)
+    {
+        kv_compact(self);
+    }
+
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(machine_kvstore_compact_obj, machine_kvstore_compact);
+
+/**
+ * @brief Erases all of the keys.
+ */
+STATIC mp_obj_t machine_kvstore_clear(mp_obj_t self_in)
+{
+    machine_kvstore_obj_t *self = MP_OBJ_TO_PTR(self_in);
+
+    machine_flash_erase_range(MACHINE_FLASH_KV_START, MACHINE_FLASH_KV_SIZE);
+
+    kv_mount(self);
+
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(machine_kvstore_clear_obj, machine_kvstore_clear);
+
+/**
+ * @brief Returns a tuple of the number of keys, the bytes used by live records
+ *        and the number of free sectors.
+ */
+STATIC mp_obj_t machine_kvstore_stats(mp_obj_t self_in)
+{
+    machine_kvstore_obj_t *self = MP_OBJ_TO_PTR(self_in);
+
+    mp_obj_t tuple[3] = {
+        MP_OBJ_NEW_SMALL_INT(self->count),
+        mp_obj_new_int_from_uint(self->live_bytes),
+        MP_OBJ_NEW_SMALL_INT(kv_free_sectors(self)),
+    };
+
+    return mp_obj_new_tuple(3, tuple);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(machine_kvstore_stats_obj, machine_kvstore_stats);
+
+/**
+ * @brief Global module dictionary containing all of the methods for the
+ *        KVStore class.
+ */
+STATIC const mp_rom_map_elem_t machine_kvstore_locals_dict_table[] = {
+
+    // Local methods
+    {MP_ROM_QSTR(MP_QSTR_get), MP_ROM_PTR(&machine_kvstore_get_obj)},
+    {MP_ROM_QSTR(MP_QSTR_keys), MP_ROM_PTR(&machine_kvstore_keys_obj)},
+    {MP_ROM_QSTR(MP_QSTR_compact), MP_ROM_PTR(&machine_kvstore_compact_obj)},
+    {MP_ROM_QSTR(MP_QSTR_clear), MP_ROM_PTR(&machine_kvstore_clear_obj)},
+    {MP_ROM_QSTR(MP_QSTR_stats), MP_ROM_PTR(&machine_kvstore_stats_obj)},
+};
+STATIC MP_DEFINE_CONST_DICT(machine_kvstore_locals_dict, machine_kvstore_locals_dict_table);
+
+/**
+ * @brief Module structure for the KVStore object.
+ */
+const mp_obj_type_t machine_kvstore_type = {
+    .base = {&mp_type_type},
+    .name = MP_QSTR_KVStore,
+    .print = NULL,
+    .make_new = machine_kvstore_make_new,
+    .call = NULL,
+    .unary_op = machine_kvstore_unary_op,
+    .binary_op = machine_kvstore_binary_op,
+    .subscr = machine_kvstore_subscr,
+    .locals_dict = (mp_obj_dict_t *)&machine_kvstore_locals_dict,
+};
@@ -0,0 +1,726 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 Raj Nakarja - Silicon Witchery AB
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stddef.h>
+#include <string.h>
+#include "py/obj.h"
+#include "py/objstr.h"
+#include "py/runtime.h"
+#include "modmachine.h"
+
+/**
+ * @brief Layout of the logger. Pages are written in order around the region
+ *        like a ring, so the address of a page comes from its sequence number.
+ *        The sector after the one being written is always kept erased, which
+ *        means the oldest sector is lost each time a new one is started.
+ */
+#define LOG_PAGE_SIZE (MACHINE_FLASH_PAGE_SIZE)
+#define LOG_SECTOR_SIZE (MACHINE_FLASH_BLOCK_SIZE)
+#define LOG_PAGES_PER_SECTOR (LOG_SECTOR_SIZE / LOG_PAGE_SIZE)
+#define LOG_SECTOR_COUNT (MACHINE_FLASH_LOG_SIZE / LOG_SECTOR_SIZE)
+#define LOG_PAGE_COUNT (MACHINE_FLASH_LOG_SIZE / LOG_PAGE_SIZE)
+
+/**
+ * @brief Largest record which can be logged.
+ */
+#define LOG_MAX_RECORD_SIZE (64)
+
+/**
+ * @brief Largest size of an encoded record, which is the record itself, plus
+ *        a mask byte for every 8 bytes.
+ */
+#define LOG_MAX_ENCODED_SIZE (LOG_MAX_RECORD_SIZE + LOG_MAX_RECORD_SIZE / 8)
+
+/**
+ * @brief Header at the start of every page. The first page of each sector also
+ *        serves as the sector header when scanning for the newest page. The
+ *        check is a Fletcher-16 of the header fields before it and of the
+ *        data, to catch pages torn by a power loss.
+ */
+typedef struct
+{
+    uint32_t sequence;
+    uint8_t record_size;
+    uint8_t count;
+    uint16_t length;
+    uint16_t check;
+    uint16_t reserved;
+} log_page_header_t;
+
+#define LOG_PAGE_DATA_SIZE (LOG_PAGE_SIZE - sizeof(log_page_header_t))
+
+/**
+ * @brief Page of records. Each page starts with a full record, and the rest
+ *        are encoded as a difference from the record before, so pages can be
+ *        decoded on their own.
+ */
+typedef struct
+{
+    log_page_header_t header;
+    uint8_t data[LOG_PAGE_DATA_SIZE];
+} log_page_t;
+
+/**
+ * @brief Logger object. There's only ever one, which is kept as a root
+ *        pointer.
+ */
+typedef struct _machine_logger_obj_t
+{
+    mp_obj_base_t base;
+    log_page_t page;
+    uint8_t previous[LOG_MAX_RECORD_SIZE];
+    uint8_t record_size;
+    uint32_t first_sequence;
+    uint32_t next_sequence;
+    uint16_t erased_sector;
+} machine_logger_obj_t;
+
+/**
+ * @brief Iterator over all of the records, from oldest to newest.
+ */
+typedef struct _machine_logger_iter_obj_t
+{
+    mp_obj_base_t base;
+    machine_logger_obj_t *logger;
+    log_page_t page;
+    uint8_t previous[LOG_MAX_RECORD_SIZE];
+    uint32_t sequence;
+    uint16_t offset;
+    uint8_t remaining;
+} machine_logger_iter_obj_t;
+
+/**
+ * @brief Returns the flash address of a page from its sequence number.
+ */
+static uint32_t log_page_address(uint32_t sequence)
+{
+    return MACHINE_FLASH_LOG_START + (sequence % LOG_PAGE_COUNT) * LOG_PAGE_SIZE;
+}
+
+/**
+ * @brief Returns the sector a page is stored in.
+ */
+static uint16_t log_page_sector(uint32_t sequence)
+{
+    return (sequence % LOG_PAGE_COUNT) / LOG_PAGES_PER_SECTOR;
+}
+
+/**
+ * @brief Fletcher-16 checksum of some data.
+ * @param check: The checksum of the data before, or 0 to start a new one.
+ */
+static uint16_t log_check(uint16_t check, const uint8_t *data, size_t len)
+{
+    uint16_t sum1 = check & 0xFF;
+    uint16_t sum2 = check >> 8;
+
+    while (len--)
+    {
+        sum1 = (sum1 + *data++) % 255;
+        sum2 = (sum2 + sum1) % 255;
+    }
+
+    return (sum2 << 8) | sum1;
+}
+
+/**
+ * @brief Checksum of a page, covering the sequence number, record size, count
+ *        and length from its header, as well as its data.
+ */
+static uint16_t log_page_check(const log_page_t *page)
+{
+    uint16_t check = log_check(0, (const uint8_t *)&page->header,
+                               offsetof(log_page_header_t, check));
+
+    return log_check(check, page->data, page->header.length);
+}
+
+/**
+ * @brief Encodes a record as a difference from the previous one. For every 8
+ *        bytes there's a mask byte showing which bytes changed, followed by
+ *        the differences of only those bytes. Slowly changing values mostly
+ *        encode to just their mask bytes.
+ * @returns The encoded size.
+ */
+static size_t log_encode(const uint8_t *record, const uint8_t *previous,
+                         size_t size, uint8_t *encoded)
+{
+    size_t len = 0;
+
+    for (size_t group = 0; group < size; group += 8)
+    {
+        uint8_t *mask = &encoded[len++];
+        *mask = 0;
+
+        for (size_t i = group; i < size && i < group + 8; i++)
+        {
+            uint8_t delta = record[i] - previous[i];
+
+            if (delta)
+            {
+                *mask |= 1 << (i - group);
+                encoded[len++] = delta;
+            }
+        }
+    }
+
+    return len;
+}
+
+/**
+ * @brief Decodes a record in place over the previous one.
+ * @returns The number of encoded bytes used, or 0 if they ran out.
+ */
+static size_t log_decode(const uint8_t *encoded, size_t available,
+                         uint8_t *record, size_t size)
+{
+    size_t len = 0;
+
+    for (size_t group = 0; group < size; group += 8)
+    {
+        if (len >= available)
+        {
+            return 0;
+        }
+
+        uint8_t mask = encoded[len++];
+
+        for (size_t i = group; i < size && i < group + 8; i++)
+        {
+            if (mask & (1 << (i - group)))
+            {
+                if (len >= available)
+                {
+                    return 0;
+                }
+
+                record[i] += encoded[len++];
+            }
+        }
+    }
+
+    return len;
+}
+
+/**
+ * @brief Reads a page, and checks that it's intact and holds the sequence
+ *        number given.
+ */
+static bool log_page_read(uint32_t sequence, log_page_t *page)
+{
+    machine_flash_read(log_page_address(sequence), (uint8_t *)page, sizeof(log_page_t));
+
+    return page->header.sequence == sequence &&
+           page->header.record_size != 0 &&
+           page->header.record_size <= LOG_MAX_RECORD_SIZE &&
+           page->header.length <= LOG_PAGE_DATA_SIZE &&
+           page->header.check == log_page_check(page);
+}
+
+/**
+ * @brief Returns the oldest page which is still stored.
+ */
+static uint32_t log_oldest(machine_logger_obj_t *self)
+{
+    // Every sector apart from the current one and the erased one is kept
+    uint32_t current = self->next_sequence - self->next_sequence % LOG_PAGES_PER_SECTOR;
+    uint32_t kept = (LOG_SECTOR_COUNT - 2) * LOG_PAGES_PER_SECTOR;
+    uint32_t oldest = current > kept ? current - kept : 0;
+
+    return oldest > self->first_sequence ? oldest : self->first_sequence;
+}
+
+/**
+ * @brief Checks if part of the flash is fully erased.
+ * @param len: A multiple of 64 bytes.
+ */
+static bool log_blank(uint32_t address, uint32_t len)
+{
+    uint32_t chunk[16];
+
+    for (uint32_t offset = 0; offset < len; offset += sizeof(chunk))
+    {
+        machine_flash_read(address + offset, (uint8_t *)chunk, sizeof(chunk));
+
+        for (size_t i = 0; i < MP_ARRAY_SIZE(chunk); i++)
+        {
+            if (chunk[i] != 0xFFFFFFFF)
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Starts erasing a sector in the background, unless it's already been
+ *        erased.
+ * @param check: True to read the sector first, in case it's already blank.
+ */
+static void log_erase_sector(machine_logger_obj_t *self, uint16_t sector, bool check)
+{
+    if (sector == self->erased_sector)
+    {
+        return;
+    }
+
+    uint32_t address = MACHINE_FLASH_LOG_START + sector * LOG_SECTOR_SIZE;
+
+    if (!check || !log_blank(address, LOG_SECTOR_SIZE))
+    {
+        machine_flash_erase_range(address, LOG_SECTOR_SIZE);
+    }
+
+    self->erased_sector = sector;
+}
+
+/**
+ * @brief Empties the buffered page. The first record of a page is encoded
+ *        against zeros, so it's stored in full.
+ */
+static void log_page_reset(machine_logger_obj_t *self)
+{
+    memset(&self->page, 0xFF, sizeof(self->page));
+    self->page.header.record_size = self->record_size;
+    self->page.header.count = 0;
+    self->page.header.length = 0;
+    memset(self->previous, 0, sizeof(self->previous));
+}
+
+/**
+ * @brief Writes the buffered page to the flash, and starts a new one.
+ */
+static void log_flush(machine_logger_obj_t *self)
+{
+    if (self->page.header.count == 0)
+    {
+        return;
+    }
+
+    uint32_t sequence = self->next_sequence;
+
+    self->page.header.sequence = sequence;
+    self->page.header.check = log_page_check(&self->page);
+
+    // Unused space is left erased
+    machine_flash_program(log_page_address(sequence),
+                          (const uint8_t *)&self->page,
+                          sizeof(log_page_header_t) + self->page.header.length);
+
+    self->next_sequence++;
+
+    // Entering a new sector erases the one ahead of it
+    if (self->next_sequence % LOG_PAGES_PER_SECTOR == 0)
+    {
+        log_erase_sector(self, log_page_sector(self->next_sequence + LOG_PAGES_PER_SECTOR), false);
+    }
+
+    log_page_reset(self);
+}
+
+/**
+ * @brief Finds the newest page from the sector headers, and gets ready to
+ *        carry on after it.
+ */
+static void log_mount(machine_logger_obj_t *self)
+{
+    log_page_header_t header;
+    bool found = false;
+    uint32_t newest = 0;
+    uint32_t oldest = 0;
+
+    // The first page of each sector tells us which pages it holds, as long as
+    // it wasn't torn. The page buffer is free to check it with until the end
+    for (uint16_t sector = 0; sector < LOG_SECTOR_COUNT; sector++)
+    {
+        uint32_t page = sector * LOG_PAGES_PER_SECTOR;
+
+        machine_flash_read(MACHINE_FLASH_LOG_START + page * LOG_PAGE_SIZE,
+                           (uint8_t *)&header, sizeof(header));
+
+        if (header.sequence == 0xFFFFFFFF ||
+            header.sequence % LOG_PAGE_COUNT != page ||
+            !log_page_read(header.sequence, &self->page))
+        {
+            continue;
+        }
+
+        if (!found || header.sequence > newest)
+        {
+            newest = header.sequence;
+        }
+
+        if (!found || header.sequence < oldest)
+        {
+            oldest = header.sequence;
+        }
+
+        found = true;
+    }
+
+    // Then the pages of the newest sector are scanned for the last one
+    if (found)
+    {
+        for (uint16_t i = 1; i < LOG_PAGES_PER_SECTOR; i++)
+        {
+            machine_flash_read(log_page_address(newest + 1), (uint8_t *)&header, sizeof(header));
+
+            if (header.sequence != newest + 1)
+            {
+                break;
+            }
+
+            newest++;
+        }
+    }
+
+    self->first_sequence = found ? oldest : 0;
+    self->next_sequence = found ? newest + 1 : 0;
+    self->erased_sector = LOG_SECTOR_COUNT;
+
+    // A page torn by a power loss can't be written over, so it's skipped,
+    // along with any written after it which the scan couldn't find. The
+    // sector boundary is as far as they go, as the one ahead is checked below
+    while (!log_blank(log_page_address(self->next_sequence), LOG_PAGE_SIZE))
+    {
+        self->next_sequence++;
+
+        if (self->next_sequence % LOG_PAGES_PER_SECTOR == 0)
+        {
+            break;
+        }
+    }
+
+    // A power loss could have interrupted the erase ahead, so check it again
+    if (self->next_sequence % LOG_PAGES_PER_SECTOR == 0)
+    {
+        log_erase_sector(self, log_page_sector(self->next_sequence), true);
+    }
+
+    log_erase_sector(self, log_page_sector(self->next_sequence + LOG_PAGES_PER_SECTOR), true);
+
+    log_page_reset(self);
+}
+
+/**
+ * @brief Appends a record to the buffered page, writing the page out first if
+ *        the record doesn't fit.
+ */
+static void log_append(machine_logger_obj_t *self, const uint8_t *record)
+{
+    uint8_t encoded[LOG_MAX_ENCODED_SIZE];
+    size_t len = log_encode(record, self->previous, self->record_size, encoded);
+
+    if (self->page.header.count == UINT8_MAX ||
+        self->page.header.length + len > LOG_PAGE_DATA_SIZE)
+    {
+        log_flush(self);
+        len = log_encode(record, self->previous, self->record_size, encoded);
+    }
+
+    memcpy(&self->page.data[self->page.header.length], encoded, len);
+    self->page.header.length += len;
+    self->page.header.count++;
+
+    memcpy(self->previous, record, self->record_size);
+}
+
+/**
+ * @brief Returns the logger, creating it and scanning the flash the first time
+ *        it's used. Records must all be the same size, given in bytes.
+ */
+STATIC mp_obj_t machine_logger_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args)
+{
+    mp_arg_check_num(n_args, n_kw, 1, 1, false);
+
+    mp_int_t record_size = mp_obj_get_int(all_args[0]);
+
+    if (record_size < 1 || record_size > LOG_MAX_RECORD_SIZE)
+    {
+        mp_raise_ValueError(MP_ERROR_TEXT("record size must be 1 to 64 bytes"));
+    }
+
+    machine_logger_obj_t *self = MP_OBJ_TO_PTR(MP_STATE_PORT(logger));
+
+    if (self == NULL)
+    {
+        self = m_new_obj(machine_logger_obj_t);
+        self->base.type = &machine_logger_type;
+        self->record_size = record_size;
+
+        log_mount(self);
+
+        MP_STATE_PORT(logger) = MP_OBJ_FROM_PTR(self);
+    }
+
+    // Changing the record size starts a new page, as each page has one size
+    if (self->record_size != record_size)
+    {
+        log_flush(self);
+        self->record_size = record_size;
+        log_page_reset(self);
+    }
+
+    return MP_OBJ_FROM_PTR(self);
+}
+
+/**
+ * @brief Appends a record. Records are buffered in RAM until a page is full,
+ *        so flush() should be called before powering down.
+ */
+STATIC mp_obj_t machine_logger_append(mp_obj_t self_in, mp_obj_t record_in)
+{
+    machine_logger_obj_t *self = MP_OBJ_TO_PTR(self_in);
+
+    mp_buffer_info_t record;
+    mp_get_buffer_raise(record_in, &record, MP_BUFFER_READ);
+
+    if (record.len != self->record_size)
+    {
+        mp_raise_ValueError(MP_ERROR_TEXT("wrong record size"));
+    }
+
+    log_append(self, record.buf);
+
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(machine_logger_append_obj, machine_logger_append);
+
+/**
+ * @brief Writes any buffered records to the flash. The rest of the page is
+ *        left unused.
+ */
+STATIC mp_obj_t machine_logger_flush(mp_obj_t self_in)
+{
+    log_flush(MP_OBJ_TO_PTR(self_in));
+
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(machine_logger_flush_obj, machine_logger_flush);
+
+/**
+ * @brief Returns a tuple of the oldest page stored, and the sequence number
+ *        which the next page will be written with.
+ */
+STATIC mp_obj_t machine_logger_range(mp_obj_t self_in)
+{
+    machine_logger_obj_t *self = MP_OBJ_TO_PTR(self_in);
+
+    mp_obj_t tuple[2] = {
+        mp_obj_new_int_from_uint(log_oldest(self)),
+        mp_obj_new_int_from_uint(self->next_sequence),
+    };
+
+    return mp_obj_new_tuple(2, tuple);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(machine_logger_range_obj, machine_logger_range);
+
+/**
+ * @brief Copies raw pages into a buffer for bulk transfers, such as over the
+ *        BLE bulk data service. Each page is 256 bytes, starting with its
+ *        header, and is decoded by the receiver. Pages which were lost to a
+ *        power loss, or overwritten, are detected by their sequence number.
+ * @returns The number of pages copied. 0 means there are no more pages.
+ */
+STATIC mp_obj_t machine_logger_readinto(mp_obj_t self_in, mp_obj_t sequence_in, mp_obj_t buffer_in)
+{
+    machine_logger_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    uint32_t sequence = mp_obj_get_int_truncated(sequence_in);
+
+    mp_buffer_info_t buffer;
+    mp_get_buffer_raise(buffer_in, &buffer, MP_BUFFER_WRITE);
+
+    size_t pages = buffer.len / LOG_PAGE_SIZE;
+
+    if (sequence >= self->next_sequence)
+    {
+        return MP_OBJ_NEW_SMALL_INT(0);
+    }
+
+    if (pages > self->next_sequence - sequence)
+    {
+        pages = self->next_sequence - sequence;
+    }
+
+    // Consecutive pages are only contiguous up until the end of the region
+    for (size_t i = 0; i < pages;)
+    {
+        uint32_t address = log_page_address(sequence + i);
+        size_t count = (MACHINE_FLASH_LOG_START + MACHINE_FLASH_LOG_SIZE - address) / LOG_PAGE_SIZE;
+
+        if (count > pages - i)
+        {
+            count = pages - i;
+        }
+
+        machine_flash_read(address, (uint8_t *)buffer.buf + i * LOG_PAGE_SIZE, count * LOG_PAGE_SIZE);
+
+        i += count;
+    }
+
+    return MP_OBJ_NEW_SMALL_INT(pages);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_3(machine_logger_readinto_obj, machine_logger_readinto);
+
+/**
+ * @brief Erases all of the records.
+ */
+STATIC mp_obj_t machine_logger_clear(mp_obj_t self_in)
+{
+    machine_logger_obj_t *self = MP_OBJ_TO_PTR(self_in);
+
+    machine_flash_erase_range(MACHINE_FLASH_LOG_START, MACHINE_FLASH_LOG_SIZE);
+
+    log_mount(self);
+
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(machine_logger_clear_obj, machine_logger_clear);
+
+/**
+ * @brief Returns the next record from the iterator, decoding a new page each
+ *        time the last one runs out. The records still buffered in RAM come
+ *        last.
+ */
+STATIC mp_obj_t machine_logger_iternext(mp_obj_t self_in)
+{
+    machine_logger_iter_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    machine_logger_obj_t *logger = self->logger;
+
+    for (;;)
+    {
+        while (self->remaining == 0)
+        {
+            // Skip ahead if the oldest pages were overwritten while iterating
+            uint32_t oldest = log_oldest(logger);
+
+            if (self->sequence < oldest)
+            {
+                self->sequence = oldest;
+            }
+
+            if (self->sequence > logger->next_sequence)
+            {
+                return MP_OBJ_STOP_ITERATION;
+            }
+
+            bool valid = true;
+
+            if (self->sequence == logger->next_sequence)
+            {
+                memcpy(&self->page, &logger->page, sizeof(self->page));
+            }
+            else
+            {
+                valid = log_page_read(self->sequence, &self->page);
+            }
+
+            self->sequence++;
+
+            if (valid)
+            {
+                self->remaining = self->page.header.count;
+                self->offset = 0;
+                memset(self->previous, 0, sizeof(self->previous));
+            }
+        }
+
+        size_t size = self->page.header.record_size;
+        size_t used = log_decode(&self->page.data[self->offset],
+                                 self->page.header.length - self->offset,
+                                 self->previous, size);
+
+        // A page which doesn't decode properly is skipped
+        if (used == 0)
+        {
+            self->remaining = 0;
+            continue;
+        }
+
+        self->offset += used;
+        self->remaining--;
+
+        return mp_obj_new_bytes(self->previous, size);
+    }
+}
+
+/**
+ * @brief Type of the iterator returned when iterating over the logger.
+ */
+STATIC const mp_obj_type_t machine_logger_iter_type = {
+    .base = {&mp_type_type},
+    .name = MP_QSTR_iterator,
+    .getiter = mp_identity_getiter,
+    .iternext = machine_logger_iternext,
+};
+
+/**
+ * @brief Iterates over all of the records stored, from oldest to newest, as
+ *        bytes objects.
+ */
+STATIC mp_obj_t machine_logger_getiter(mp_obj_t self_in, mp_obj_iter_buf_t *iter_buf)
+{
+    machine_logger_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    machine_logger_iter_obj_t *iter = m_new_obj(machine_logger_iter_obj_t);
+
+    iter->base.type = &machine_logger_iter_type;
+    iter->logger = self;
+    iter->sequence = log_oldest(self);
+    iter->remaining = 0;
+
+    return MP_OBJ_FROM_PTR(iter);
+}
+
+/**
+ * @brief Global module dictionary containing all of the methods for the
+ *        Logger class.
+ */
+STATIC const mp_rom_map_elem_t machine_logger_locals_dict_table[] = {
+
+    // Local methods
+    {MP_ROM_QSTR(MP_QSTR_append), MP_ROM_PTR(&machine_logger_append_obj)},
+    {MP_ROM_QSTR(MP_QSTR_flush), MP_ROM_PTR(&machine_logger_flush_obj)},
+    {MP_ROM_QSTR(MP_QSTR_range), MP_ROM_PTR(&machine_logger_range_obj)},
+    {MP_ROM_QSTR(MP_QSTR_readinto), MP_ROM_PTR(&machine_logger_readinto_obj)},
+    {MP_ROM_QSTR(MP_QSTR_clear), MP_ROM_PTR(&machine_logger_clear_obj)},
+};
+STATIC MP_DEFINE_CONST_DICT(machine_logger_locals_dict, machine_logger_locals_dict_table);
+
+/**
+ * @brief Module structure for the Logger object.
+ */
+const mp_obj_type_t machine_logger_type = {
+    .base = {&mp_type_type},
+    .name = MP_QSTR_Logger,
+    .print = NULL,
+    .make_new = machine_logger_make_new,
+    .call = NULL,
+    .getiter = machine_logger_getiter,
+    .locals_dict = (mp_obj_dict_t *)&machine_logger_locals_dict,
+};
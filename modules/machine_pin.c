@@ -27,7 +27,9 @@
 #include "py/obj.h"
 #include "py/runtime.h"
 #include "py/qstr.h"
+#include "py/mphal.h"
 #include "nrfx_gpiote.h"
+#include "modmachine.h"
 
 /**
  * @brief Pin object structure.
@@ -37,6 +39,8 @@ typedef struct _machine_pin_obj_t
     mp_obj_base_t base;
     uint32_t pin;
     mp_obj_t irq_handler;
+    bool irq_hard;
+    volatile mp_uint_t irq_time;
 } machine_pin_obj_t;
 
 /**
@@ -44,6 +48,18 @@ typedef struct _machine_pin_obj_t
  */
 const mp_obj_type_t machine_pin_type;
 
+/**
+ * @brief Calls the handler of a pin from the scheduler. Handlers take no
+ *        arguments, so this is scheduled in their place.
+ */
+STATIC mp_obj_t pin_irq_dispatch(mp_obj_t self_in)
+{
+    machine_pin_obj_t *self = MP_OBJ_TO_PTR(self_in);
+
+    return mp_call_function_0(self->irq_handler);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(pin_irq_dispatch_obj, pin_irq_dispatch);
+
 /**
  * @brief Pin IRQ handler.
  */
@@ -52,8 +68,19 @@ void pin_irq_handler(nrfx_gpiote_pin_t pin, nrfx_gpiote_trigger_t trigger, void
     // Get the pin object from the context pointer
     machine_pin_obj_t *self = (machine_pin_obj_t *)p_context;
 
-    // Issue the callback and pass the pin number
-    mp_call_function_0(self->irq_handler);
+    // Record when the interrupt happened, so the latency can be measured
+    self->irq_time = mp_hal_ticks_us();
+
+    // Hard handlers are called straight away
+    if (self->irq_hard)
+    {
+        machine_irq_call_hard(self->irq_handler, 0, NULL);
+        return;
+    }
+
+    // Otherwise the callback runs from the main thread once it's safe to
+    machine_irq_schedule(MP_OBJ_FROM_PTR(&pin_irq_dispatch_obj),
+                         MP_OBJ_FROM_PTR(self));
 }
 
 /**
@@ -242,7 +269,10 @@ STATIC mp_obj_t machine_pin_call(mp_obj_t self_in, size_t n_args, size_t n_kw, c
 
 /**
  * @brief Method for setting up a pin for interrupts. Expects format as:
- *        myPin.irq(handler, trigger=irqEdgePolarity) where trigger is optional.
+ *        myPin.irq(handler, trigger=irqEdgePolarity, hard=False) where trigger
+ *        and hard are optional. Handlers are scheduled to run from the main
+ *        thread, unless hard is True, in which case they're called from the
+ *        interrupt and must not allocate memory.
  */
 STATIC mp_obj_t machine_pin_irq(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args)
 {
@@ -250,6 +280,7 @@ STATIC mp_obj_t machine_pin_irq(size_t n_args, const mp_obj_t *pos_args, mp_map_
     static const mp_arg_t allowed_args[] = {
         {MP_QSTR_handler, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE}},
         {MP_QSTR_trigger, MP_ARG_KW_ONLY | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_INT(NRF_GPIOTE_POLARITY_TOGGLE)}},
+        {MP_QSTR_hard, MP_ARG_KW_ONLY | MP_ARG_BOOL, {.u_bool = false}},
     };
 
     // Parse args (remember the first arg is the pin ID, i.e [myPin].irq(...))
@@ -290,6 +321,11 @@ STATIC mp_obj_t machine_pin_irq(size_t n_args, const mp_obj_t *pos_args, mp_map_
 
     // Assign the handler pointer to the pin object
     self->irq_handler = args[0].u_obj;
+    self->irq_hard = args[2].u_bool;
+
+    // Keep the pin object alive while the interrupt refers to it. Pins are
+    // either 4 or 5
+    MP_STATE_PORT(pin_irq_objects)[self->pin - 4] = MP_OBJ_FROM_PTR(self);
 
     // Enable the interrupt event
     nrfx_gpiote_in_event_enable(self->pin, true);
@@ -315,6 +351,20 @@ STATIC mp_obj_t machine_pin_irq_disable(mp_obj_t self_in)
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_1(machine_pin_irq_disable_obj, machine_pin_irq_disable);
 
+/**
+ * @brief Returns the ticks_us() value of when the last interrupt happened.
+ *        Comparing this against ticks_us() from within the handler gives the
+ *        interrupt latency.
+ */
+STATIC mp_obj_t machine_pin_irq_time(mp_obj_t self_in)
+{
+    machine_pin_obj_t *self = MP_OBJ_TO_PTR(self_in);
+
+    return MP_OBJ_NEW_SMALL_INT(self->irq_time &
+                                (MICROPY_PY_UTIME_TICKS_PERIOD - 1));
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(machine_pin_irq_time_obj, machine_pin_irq_time);
+
 /**
  * @brief Local class dictionary. Contains all the methods and constants of Pin.
  */
@@ -323,6 +373,7 @@ STATIC const mp_rom_map_elem_t machine_pin_locals_dict_table[] = {
     // Class methods
     {MP_ROM_QSTR(MP_QSTR_irq), MP_ROM_PTR(&machine_pin_irq_obj)},
     {MP_ROM_QSTR(MP_QSTR_irq_disable), MP_ROM_PTR(&machine_pin_irq_disable_obj)},
+    {MP_ROM_QSTR(MP_QSTR_irq_time), MP_ROM_PTR(&machine_pin_irq_time_obj)},
 
     // Pin modes
     {MP_ROM_QSTR(MP_QSTR_IN), MP_ROM_INT(NRF_GPIO_PIN_DIR_INPUT)},
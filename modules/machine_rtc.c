@@ -24,9 +24,14 @@
  * THE SOFTWARE.
  */
 
+
 #include "py/runtime.h"
+#include "py/mphal.h"
+#include "py/objint.h"
 #include "nrfx_rtc.h"
 #include "nrf_soc.h"
+#include "modmachine.h"
+#include "main.h"
 
 /**
  * @brief Instance of the RTC1 driver. Note that RTC0 is used by the softdevice.
@@ -34,50 +39,187 @@
 static const nrfx_rtc_t rtc_instance = NRFX_RTC_INSTANCE(1);
 
 /**
- * @brief Epoch reference time in seconds. Updated every hour internally, or
- *        when RTC.time() is called with an argument.
+ * @brief The hardware counter is 24 bits wide, and wraps every 512 seconds.
+ */
+#define RTC_COUNTER_MASK 0xFFFFFF
+
+/**
+ * @brief The 64 bit tick count is built from a count of half periods of the
+ *        hardware counter, which is updated from compare 0.
+ */
+#define RTC_HALF_PERIOD_SHIFT 23
+
+/**
+ * @brief Number of half periods of the hardware counter since power on. A
+ *        single word, so it's always read whole, even from other interrupts.
+ */
+static volatile uint32_t half_periods;
+
+/**
+ * @brief Deadlines for each compare channel, in ticks. Deadlines further away
+ *        than the hardware counter can reach are re-armed until they're met.
+ */
+static uint64_t deadlines[NRF_RTC_CC_CHANNEL_COUNT(1)];
+
+/**
+ * @brief Offset in ticks between the tick count and the time set by the user
+ *        in RTC.time().
+ */
+static int64_t epoch_offset;
+
+/**
+ * @brief Timeouts used within the port. These share compare 0 with the counter
+ *        extension, so that compare 2 and 3 are free for machine.Timer.
  */
-static uint32_t epoch_time_ref;
+static struct
+{
+    bool running;
+    uint64_t deadline;
+    void (*handler)(void);
+} timeouts[MACHINE_RTC_TIMEOUT_COUNT];
 
 /**
- * @brief Flag which is set during RTC.sleep_ms()
+ * @brief The first compare channel used for machine.Timer.
  */
-static bool waiting;
+#define TIMER_FIRST_CHANNEL 2
 
 /**
  * @brief Forward declaration of the RTC class object.
  */
 const mp_obj_type_t machine_rtc_type;
 
+/**
+ * @brief Returns the number of RTC ticks since power on. Safe to call from any
+ *        context, as long as compare 0 isn't held off for over 256 seconds.
+ */
+uint64_t machine_rtc_ticks(void)
+{
+    // The half period count must be read before the counter
+    uint64_t reference = (uint64_t)half_periods << RTC_HALF_PERIOD_SHIFT;
+    uint32_t counter = nrfx_rtc_counter_get(&rtc_instance);
+
+    // Add on however far the counter has moved since the reference
+    return reference + ((counter - (uint32_t)reference) & RTC_COUNTER_MASK);
+}
+
+/**
+ * @brief Converts milliseconds to RTC ticks, rounding up so that waits are
+ *        never shorter than requested.
+ */
+uint64_t machine_rtc_ms_to_ticks(uint64_t ms)
+{
+    return (ms * MACHINE_RTC_FREQUENCY + 999) / 1000;
+}
+
+/**
+ * @brief Sets a compare channel to trigger at a deadline given in ticks.
+ */
+static void compare_set(uint32_t channel, uint64_t deadline)
+{
+    deadlines[channel] = deadline;
+
+    while (true)
+    {
+        uint64_t now = machine_rtc_ticks();
+        uint64_t target = deadline;
+
+        // The counter can't trigger on values too close to it
+        if (target < now + MACHINE_RTC_MIN_DELTA)
+        {
+            target = now + MACHINE_RTC_MIN_DELTA;
+        }
+
+        // Or values further than it can reach. These are re-armed when reached
+        if (target > now + (1 << RTC_HALF_PERIOD_SHIFT))
+        {
+            target = now + (1 << RTC_HALF_PERIOD_SHIFT);
+        }
+
+        nrfx_rtc_cc_set(&rtc_instance, channel, target & RTC_COUNTER_MASK, true);
+
+        // If we were held up for too long, the compare may have been missed
+        if (machine_rtc_ticks() + 2 <= target)
+        {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Sets compare 0 to the next half period, or to the next port timeout
+ *        if that's sooner. Must be called from the RTC interrupt, or from
+ *        within an atomic section.
+ */
+static void service_compare_update(void)
+{
+    uint64_t next = (uint64_t)(half_periods + 1) << RTC_HALF_PERIOD_SHIFT;
+
+    for (size_t i = 0; i < MACHINE_RTC_TIMEOUT_COUNT; i++)
+    {
+        if (timeouts[i].running && timeouts[i].deadline < next)
+        {
+            next = timeouts[i].deadline;
+        }
+    }
+
+    compare_set(0, next);
+}
+
 /**
  * @brief RTC IRQ handler
  */
 void rtc_irq_handler(nrfx_rtc_int_type_t int_type)
 {
-    switch (int_type)
+    uint32_t channel = int_type - NRFX_RTC_INT_COMPARE0;
+
+    // Used to extend the counter, and for the port timeouts
+    if (int_type == NRFX_RTC_INT_COMPARE0)
     {
-    // Used to increment the reference time every hour
-    case NRFX_RTC_INT_COMPARE0:
+        uint64_t now = machine_rtc_ticks();
 
-        // Increment the reference time by 1 hour
-        epoch_time_ref += 60 * 60;
+        half_periods = now >> RTC_HALF_PERIOD_SHIFT;
 
-        // Clear the counter
-        nrfx_rtc_counter_clear(&rtc_instance);
+        // Call the handlers of any timeouts which have expired
+        for (size_t i = 0; i < MACHINE_RTC_TIMEOUT_COUNT; i++)
+        {
+            if (timeouts[i].running && timeouts[i].deadline <= now)
+            {
+                timeouts[i].running = false;
+                timeouts[i].handler();
+            }
+        }
 
-        // Restart the interrupt
-        nrfx_rtc_int_enable(&rtc_instance, NRF_RTC_INT_COMPARE0_MASK);
+        // Set up for whichever comes next
+        service_compare_update();
 
-        break;
+        return;
+    }
+
+    // Ignore any other interrupts
+    if (int_type > NRFX_RTC_INT_COMPARE3)
+    {
+        return;
+    }
+
+    // Deadlines beyond the reach of the counter need to be re-armed
+    if (machine_rtc_ticks() < deadlines[channel])
+    {
+        compare_set(channel, deadlines[channel]);
+        return;
+    }
 
-    // User configurable for delay_ms function
+    switch (int_type)
+    {
+    // Used for the sleep functions, which only need waking up
     case NRFX_RTC_INT_COMPARE1:
+        break;
 
-        // Clear the waiting flag
-        waiting = false;
+    // Used for machine.Timer
+    case NRFX_RTC_INT_COMPARE2:
+    case NRFX_RTC_INT_COMPARE3:
 
-        // Disable the timer
-        nrfx_rtc_cc_disable(&rtc_instance, 1);
+        // Call the handler
+        machine_timer_irq_handler(channel - TIMER_FIRST_CHANNEL);
 
         break;
 
@@ -91,47 +233,272 @@ void rtc_irq_handler(nrfx_rtc_int_type_t int_type)
  */
 void machine_rtc_init(void)
 {
-    // Configure the RTC1 timer to a 1ms tick
+    // Configure the RTC1 timer to run at the full 32768Hz
     nrfx_rtc_config_t config = {
-        .prescaler = 32,
+        .prescaler = 0,
         .interrupt_priority = NRFX_RTC_DEFAULT_CONFIG_IRQ_PRIORITY,
-        .tick_latency = 32,
+        .tick_latency = 0,
         .reliable = false,
     };
     nrfx_rtc_init(&rtc_instance, &config, rtc_irq_handler);
 
-    // Set the compare 0 to interrupt every hour. Value here is in ms
-    nrfx_rtc_cc_set(&rtc_instance, 0, 3600000, true);
+    // Start counting from zero
+    nrfx_rtc_counter_clear(&rtc_instance);
+
+    // Set compare 0 to interrupt at the first half period
+    nrfx_rtc_cc_set(&rtc_instance, 0, 1 << RTC_HALF_PERIOD_SHIFT, true);
 
     // Enable the RTC
     nrfx_rtc_enable(&rtc_instance);
+
+    // Enable the cycle counter used by ticks_cpu()
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/**
+ * @brief Calls a handler from the RTC interrupt once a timeout expires. Calling
+ *        this again before the timeout expires restarts it.
+ */
+void machine_rtc_timeout_start(machine_rtc_timeout_t timeout,
+                               uint32_t timeout_ms,
+                               void (*handler)(void))
+{
+    mp_uint_t atomic_state = MICROPY_BEGIN_ATOMIC_SECTION();
+
+    // Set the handler and the expiry time
+    timeouts[timeout].handler = handler;
+    timeouts[timeout].deadline = machine_rtc_ticks() +
+                                 machine_rtc_ms_to_ticks(timeout_ms);
+    timeouts[timeout].running = true;
+
+    // Bring compare 0 forward if this is the next timeout
+    service_compare_update();
+
+    MICROPY_END_ATOMIC_SECTION(atomic_state);
+}
+
+/**
+ * @brief Stops a timeout started with machine_rtc_timeout_start().
+ */
+void machine_rtc_timeout_stop(machine_rtc_timeout_t timeout)
+{
+    timeouts[timeout].running = false;
+}
+
+/**
+ * @brief Sets the compare channel of a machine.Timer to trigger at a deadline.
+ */
+void machine_rtc_timer_start(uint32_t timer, uint64_t deadline)
+{
+    compare_set(TIMER_FIRST_CHANNEL + timer, deadline);
+}
+
+/**
+ * @brief Stops the compare channel of a machine.Timer.
+ */
+void machine_rtc_timer_stop(uint32_t timer)
+{
+    nrfx_rtc_cc_disable(&rtc_instance, TIMER_FIRST_CHANNEL + timer);
+}
+
+/**
+ * @brief Sleeps until the tick count reaches the deadline. BLE events and
+ *        scheduled callbacks are handled while sleeping.
+ * @returns false if the sleep was cut short by Ctrl-C.
+ */
+static bool wait_until(uint64_t deadline)
+{
+    // Set to low power mode
+    sd_power_mode_set(NRF_POWER_MODE_LOWPWR);
+
+    // Stay asleep until the deadline. This only depends on local state, so a
+    // callback run from here can sleep too without waking this one early
+    while (machine_rtc_ticks() < deadline)
+    {
+        // Stop waiting if Ctrl-C was pressed
+        if (MP_STATE_THREAD(mp_pending_exception) != MP_OBJ_NULL)
+        {
+            nrfx_rtc_cc_disable(&rtc_instance, 1);
+            return false;
+        }
+
+        // Run any scheduled callbacks while waiting
+        mp_handle_pending(true);
+
+        // Keep stdout moving. BLE writes are handled by the event handler
+        ble_send_pending_data();
+
+        // Set compare 1 to wake us at the deadline. This is set every time
+        // round, as a callback may have used it for a sleep of its own
+        compare_set(1, deadline);
+
+        // Sleep until the next interrupt. Any interrupt that happens after the
+        // deadline was checked wakes this straight away, so none can be missed
+        sd_app_evt_wait();
+    }
+
+    return true;
+}
+
+/**
+ * @brief Called while polling, such as from select.poll() which uasyncio uses
+ *        to wait for IO and its next task. Handles anything pending, and then
+ *        sleeps until an interrupt. The caller's timeout isn't passed in, so
+ *        the RTC also wakes it when ticks_ms() next moves on, which is as
+ *        soon as the caller could see its timeout expire.
+ */
+void mp_hal_poll_wait(void)
+{
+    // Raise any pending exception, such as from Ctrl-C
+    mp_handle_pending(true);
+
+    // Keep stdout moving while the poller waits
+    ble_send_pending_data();
+
+    // Wake up at the first tick of the next millisecond
+    uint64_t next_ms = machine_rtc_ticks() * 1000 / MACHINE_RTC_FREQUENCY + 1;
+
+    compare_set(1, (next_ms * MACHINE_RTC_FREQUENCY + 999) / 1000);
+
+    // Sleep until a BLE event, pin interrupt, or the RTC wakes us up
+    sd_app_evt_wait();
+}
+
+/**
+ * @brief Returns the milliseconds since power on. Used by ticks_ms().
+ */
+mp_uint_t mp_hal_ticks_ms(void)
+{
+    return (machine_rtc_ticks() * 1000) / MACHINE_RTC_FREQUENCY;
+}
+
+/**
+ * @brief Returns the microseconds since power on, with a resolution of one
+ *        RTC tick. Used by ticks_us().
+ */
+mp_uint_t mp_hal_ticks_us(void)
+{
+    return (machine_rtc_ticks() * 1000000) / MACHINE_RTC_FREQUENCY;
+}
+
+/**
+ * @brief Returns the CPU cycle count. Used by ticks_cpu().
+ */
+mp_uint_t mp_hal_ticks_cpu(void)
+{
+    return DWT->CYCCNT;
+}
+
+/**
+ * @brief Returns the time set by RTC.time() in nanoseconds. Used by time_ns().
+ */
+uint64_t mp_hal_time_ns(void)
+{
+    uint64_t ticks = machine_rtc_ticks() + epoch_offset;
+
+    // Split into whole seconds and the remaining ticks to avoid overflowing
+    uint64_t seconds = ticks / MACHINE_RTC_FREQUENCY;
+    uint64_t remainder = ticks % MACHINE_RTC_FREQUENCY;
+
+    return seconds * 1000000000ULL +
+           remainder * 1000000000ULL / MACHINE_RTC_FREQUENCY;
+}
+
+/**
+ * @brief Sleeps for a number of milliseconds. Used by sleep_ms().
+ */
+void mp_hal_delay_ms(mp_uint_t ms)
+{
+    if (ms == 0)
+    {
+        return;
+    }
+
+    // Raise the KeyboardInterrupt if Ctrl-C cut the sleep short
+    if (!wait_until(machine_rtc_ticks() + machine_rtc_ms_to_ticks(ms)))
+    {
+        mp_handle_pending(true);
+    }
+}
+
+/**
+ * @brief Sleeps for a number of milliseconds. Ctrl-C raises the
+ *        KeyboardInterrupt straight away, like time.sleep_ms().
+ */
+uint64_t machine_rtc_lightsleep(uint64_t ms)
+{
+    uint64_t start = machine_rtc_ticks();
+
+    // Raise the KeyboardInterrupt if Ctrl-C cut the sleep short
+    if (!wait_until(start + machine_rtc_ms_to_ticks(ms)))
+    {
+        mp_handle_pending(true);
+    }
+
+    return ((machine_rtc_ticks() - start) * 1000) / MACHINE_RTC_FREQUENCY;
+}
+
+/**
+ * @brief Busy waits for a number of microseconds. Used by sleep_us().
+ */
+void mp_hal_delay_us(mp_uint_t us)
+{
+    NRFX_DELAY_US(us);
+}
+
+/**
+ * @brief Returns the time set by RTC.time() in whole seconds.
+ */
+int64_t machine_rtc_time_get(void)
+{
+    int64_t ticks = (int64_t)machine_rtc_ticks() + epoch_offset;
+    int64_t seconds = ticks / MACHINE_RTC_FREQUENCY;
+
+    // Round down, even for times before the epoch
+    if (ticks % MACHINE_RTC_FREQUENCY < 0)
+    {
+        seconds--;
+    }
+
+    return seconds;
 }
 
 /**
  * @brief Returns a the current time since power on in seconds. If an argument
- *        is provided. The current time will be updated to that value. Not this
- *        won't work with the Unix Epoch time, as the micropython int size is
- *        only 2^30. A different reference should be used. Such as seconds since
- *        1st Jan 2000.
+ *        is provided. The current time will be updated to that value. Values
+ *        beyond the small int range are supported, so the Unix Epoch time can
+ *        be used.
  */
 STATIC mp_obj_t machine_rtc_time(size_t n_args, const mp_obj_t *args)
 {
-    // If no arguments are given, return the time as a tuple
+    // If no arguments are given, return the time
     if (n_args == 0)
     {
-        // Get the current counter and add the reference time
-        uint32_t time = (nrfx_rtc_counter_get(&rtc_instance) / 1000) + // (ms)
-                        epoch_time_ref;                                // (sec)
+        return mp_obj_new_int_from_ll(machine_rtc_time_get());
+    }
 
-        // Return the values
-        return MP_OBJ_NEW_SMALL_INT(time);
+    // Otherwise, if a value was provided, ensure it's an integer
+    if (!mp_obj_is_int(args[0]))
+    {
+        mp_raise_TypeError(MP_ERROR_TEXT("time must be an integer"));
     }
 
-    // Otherwise, if a value was provided, set the time
-    epoch_time_ref = mp_obj_get_int(args[0]);
+    // Get the value, which may be larger than a small int
+    int64_t time;
 
-    // Clear the current counter
-    nrfx_rtc_counter_clear(&rtc_instance);
+    if (mp_obj_is_small_int(args[0]))
+    {
+        time = MP_OBJ_SMALL_INT_VALUE(args[0]);
+    }
+    else
+    {
+        mp_obj_int_to_bytes_impl(args[0], false, sizeof(time), (byte *)&time);
+    }
+
+    // Set the time by offsetting it from the tick count
+    epoch_offset = time * MACHINE_RTC_FREQUENCY - (int64_t)machine_rtc_ticks();
 
     return mp_const_none;
 }
@@ -142,35 +509,14 @@ STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(machine_rtc_time_obj, 0, 1, machine_r
  */
 STATIC mp_obj_t machine_rtc_sleep_ms(mp_obj_t self_in)
 {
-    // Get the current counter value
-    uint32_t counter_val = nrfx_rtc_counter_get(&rtc_instance);
-
-    // Set the wake time to be the current counter value + the time requested
-    uint32_t wake_time = counter_val + mp_obj_get_int(self_in);
+    mp_int_t ms = mp_obj_get_int(self_in);
 
-    // If the wake time will be later than 1 hour, we need to deduct 1 hour to
-    // compensate for the 1 hour periodic rollover. Calculated in ms
-    if (wake_time > 3600000)
+    if (ms < 0)
     {
-        wake_time -= 3600000;
+        mp_raise_ValueError(MP_ERROR_TEXT("time cannot be negative"));
     }
 
-    // Set the compare 1 interrupt to trigger after the given time
-    nrfx_rtc_cc_set(&rtc_instance, 1, wake_time, true);
-
-    // Set the waiting flag to true
-    waiting = true;
-
-    // While waiting, stay asleep
-    while (waiting)
-    {
-        // Set to low power mode
-        sd_power_mode_set(NRF_POWER_MODE_LOWPWR);
-
-        // Wait for events to save power
-        // sd_app_evt_wait(); TODO figure out why this doesn't work
-        __WFI();
-    }
+    mp_hal_delay_ms(ms);
 
     return mp_const_none;
 }
@@ -0,0 +1,304 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 Raj Nakarja - Silicon Witchery AB
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "py/obj.h"
+#include "py/runtime.h"
+#include "modmachine.h"
+
+/**
+ * @brief Timer object structure. Deadlines are always worked out from the
+ *        start time and the number of expiries so far, rather than by adding
+ *        the period onto the last deadline, so rounding errors never build up.
+ */
+typedef struct _machine_timer_obj_t
+{
+    mp_obj_base_t base;
+    uint32_t id;
+    volatile bool running;
+    bool periodic;
+    bool hard;
+    uint32_t period;
+    uint32_t tick_hz;
+    uint64_t start;
+    uint64_t expiries;
+    volatile uint64_t deadline;
+} machine_timer_obj_t;
+
+/**
+ * @brief Forward declaration of the Timer class object.
+ */
+const mp_obj_type_t machine_timer_type;
+
+/**
+ * @brief The timer objects. One for each RTC compare channel.
+ */
+STATIC machine_timer_obj_t machine_timer_obj[MACHINE_TIMER_COUNT] = {
+    {{&machine_timer_type}, .id = 0},
+    {{&machine_timer_type}, .id = 1},
+};
+
+/**
+ * @brief Returns the deadline in RTC ticks of the nth expiry of a timer.
+ */
+static uint64_t timer_deadline(machine_timer_obj_t *self, uint64_t n)
+{
+    return self->start + (n * self->period * MACHINE_RTC_FREQUENCY) /
+                             self->tick_hz;
+}
+
+/**
+ * @brief Called from the RTC interrupt once a timer expires.
+ */
+void machine_timer_irq_handler(uint32_t timer)
+{
+    machine_timer_obj_t *self = &machine_timer_obj[timer];
+
+    if (!self->running)
+    {
+        return;
+    }
+
+    self->expiries++;
+
+    // Periodic timers are set up for the next expiry straight away. Any which
+    // were missed, such as while interrupts were held off, are skipped so the
+    // timer stays in step with its start time rather than lagging behind
+    if (self->periodic)
+    {
+        uint64_t now = machine_rtc_ticks();
+
+        while (timer_deadline(self, self->expiries + 1) <= now)
+        {
+            self->expiries++;
+        }
+
+        self->deadline = timer_deadline(self, self->expiries + 1);
+        machine_rtc_timer_start(self->id, self->deadline);
+    }
+    else
+    {
+        self->running = false;
+    }
+
+    mp_obj_t callback = MP_STATE_PORT(timer_callbacks)[self->id];
+
+    if (callback == mp_const_none)
+    {
+        return;
+    }
+
+    // Callbacks are passed the timer object
+    mp_obj_t self_obj = MP_OBJ_FROM_PTR(self);
+
+    // Hard callbacks are called straight away
+    if (self->hard)
+    {
+        machine_irq_call_hard(callback, 1, &self_obj);
+        return;
+    }
+
+    // Otherwise the callback runs from the main thread once it's safe to
+    machine_irq_schedule(callback, self_obj);
+}
+
+/**
+ * @brief Stops a timer.
+ */
+STATIC mp_obj_t machine_timer_deinit(mp_obj_t self_in)
+{
+    machine_timer_obj_t *self = MP_OBJ_TO_PTR(self_in);
+
+    self->running = false;
+    machine_rtc_timer_stop(self->id);
+
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(machine_timer_deinit_obj, machine_timer_deinit);
+
+/**
+ * @brief Starts a timer. Expects the format as:
+ *        myTimer.init(period=Period, mode=Timer.PERIODIC, tick_hz=1000,
+ *        callback=None, hard=False), where the period is in units of
+ *        1/tick_hz seconds. tick_hz can be up to 32768, and periods can be
+ *        as short as 3 RTC ticks, which is about 92us.
+ */
+STATIC mp_obj_t machine_timer_init_helper(machine_timer_obj_t *self, size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args)
+{
+    // Create the allowed arguments table
+    static const mp_arg_t allowed_args[] = {
+        {MP_QSTR_period, MP_ARG_REQUIRED | MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 0}},
+        {MP_QSTR_mode, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 1}},
+        {MP_QSTR_tick_hz, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 1000}},
+        {MP_QSTR_callback, MP_ARG_KW_ONLY | MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE}},
+        {MP_QSTR_hard, MP_ARG_KW_ONLY | MP_ARG_BOOL, {.u_bool = false}},
+    };
+
+    // Parse args
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args, pos_args, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    mp_int_t period = args[0].u_int;
+    mp_int_t tick_hz = args[2].u_int;
+
+    // If the period is invalid, throw an error
+    if (period <= 0)
+    {
+        mp_raise_ValueError(MP_ERROR_TEXT("period must be positive"));
+    }
+
+    // If the tick rate is invalid, throw an error
+    if (tick_hz <= 0 || tick_hz > MACHINE_RTC_FREQUENCY)
+    {
+        mp_raise_ValueError(MP_ERROR_TEXT("tick_hz must be between 1 and 32768"));
+    }
+
+    // The RTC can't time anything shorter than a few of its ticks
+    if ((uint64_t)period * MACHINE_RTC_FREQUENCY <
+        (uint64_t)tick_hz * MACHINE_RTC_MIN_DELTA)
+    {
+        mp_raise_ValueError(MP_ERROR_TEXT("period must be at least 3 RTC ticks"));
+    }
+
+    // If the callback isn't callable, throw an error
+    if (args[3].u_obj != mp_const_none && !mp_obj_is_callable(args[3].u_obj))
+    {
+        mp_raise_ValueError(MP_ERROR_TEXT("callback must be callable"));
+    }
+
+    // Stop the timer while it's being set up
+    machine_timer_deinit(MP_OBJ_FROM_PTR(self));
+
+    self->periodic = args[1].u_int != 0;
+    self->hard = args[4].u_bool;
+    self->period = period;
+    self->tick_hz = tick_hz;
+    MP_STATE_PORT(timer_callbacks)[self->id] = args[3].u_obj;
+
+    // Start counting from now
+    self->start = machine_rtc_ticks();
+    self->expiries = 0;
+    self->deadline = timer_deadline(self, 1);
+    self->running = true;
+
+    machine_rtc_timer_start(self->id, self->deadline);
+
+    return mp_const_none;
+}
+
+/**
+ * @brief Starts the timer. See machine_timer_init_helper() for the arguments.
+ */
+STATIC mp_obj_t machine_timer_init(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args)
+{
+    return machine_timer_init_helper(MP_OBJ_TO_PTR(pos_args[0]), n_args - 1, pos_args + 1, kw_args);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_KW(machine_timer_init_obj, 1, machine_timer_init);
+
+/**
+ * @brief Returns a timer object. Expects the format as machine.Timer(id, ...)
+ *        where any keyword arguments start the timer, as with init().
+ */
+STATIC mp_obj_t machine_timer_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args)
+{
+    mp_arg_check_num(n_args, n_kw, 1, 1, true);
+
+    // Get the timer number from the first argument
+    mp_int_t id = mp_obj_get_int(all_args[0]);
+
+    // If the timer doesn't exist, throw an error
+    if (id < 0 || id >= MACHINE_TIMER_COUNT)
+    {
+        mp_raise_msg_varg(&mp_type_ValueError, MP_ERROR_TEXT("timer %d doesn't exist"), id);
+    }
+
+    machine_timer_obj_t *self = &machine_timer_obj[id];
+
+    // Start the timer if any arguments were given
+    if (n_kw > 0)
+    {
+        mp_map_t kw_args;
+        mp_map_init_fixed_table(&kw_args, n_kw, all_args + n_args);
+        machine_timer_init_helper(self, 0, all_args + n_args, &kw_args);
+    }
+
+    return MP_OBJ_FROM_PTR(self);
+}
+
+/**
+ * @brief Returns the time left until the timer next expires, in units of
+ *        1/tick_hz seconds. Returns 0 if the timer isn't running.
+ */
+STATIC mp_obj_t machine_timer_remaining(mp_obj_t self_in)
+{
+    machine_timer_obj_t *self = MP_OBJ_TO_PTR(self_in);
+
+    // The deadline is updated from the interrupt, so read it atomically
+    mp_uint_t atomic_state = MICROPY_BEGIN_ATOMIC_SECTION();
+    bool running = self->running;
+    uint64_t deadline = self->deadline;
+    MICROPY_END_ATOMIC_SECTION(atomic_state);
+
+    uint64_t now = machine_rtc_ticks();
+
+    if (!running || deadline <= now)
+    {
+        return MP_OBJ_NEW_SMALL_INT(0);
+    }
+
+    return mp_obj_new_int_from_uint((deadline - now) * self->tick_hz /
+                                    MACHINE_RTC_FREQUENCY);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(machine_timer_remaining_obj, machine_timer_remaining);
+
+/**
+ * @brief Local class dictionary. Contains all the methods and constants of
+ *        Timer.
+ */
+STATIC const mp_rom_map_elem_t machine_timer_locals_dict_table[] = {
+
+    // Class methods
+    {MP_ROM_QSTR(MP_QSTR_init), MP_ROM_PTR(&machine_timer_init_obj)},
+    {MP_ROM_QSTR(MP_QSTR_deinit), MP_ROM_PTR(&machine_timer_deinit_obj)},
+    {MP_ROM_QSTR(MP_QSTR_remaining), MP_ROM_PTR(&machine_timer_remaining_obj)},
+
+    // Timer modes
+    {MP_ROM_QSTR(MP_QSTR_ONE_SHOT), MP_ROM_INT(0)},
+    {MP_ROM_QSTR(MP_QSTR_PERIODIC), MP_ROM_INT(1)},
+};
+STATIC MP_DEFINE_CONST_DICT(machine_timer_locals_dict, machine_timer_locals_dict_table);
+
+/**
+ * @brief Class structure for the Timer object.
+ */
+const mp_obj_type_t machine_timer_type = {
+    .base = {&mp_type_type},
+    .name = MP_QSTR_Timer,
+    .print = NULL,
+    .make_new = machine_timer_make_new,
+    .call = NULL,
+    .locals_dict = (mp_obj_dict_t *)&machine_timer_locals_dict,
+};
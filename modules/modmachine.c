@@ -25,6 +25,8 @@
  */
 
 #include "py/obj.h"
+#include "py/gc.h"
+#include "py/runtime.h"
 #include "py/objstr.h"
 #include "py/objtuple.h"
 #include "genhdr/mpversion.h"
@@ -63,6 +65,76 @@ STATIC const MP_DEFINE_STR_OBJ(mp_machine_board_name_obj, MICROPY_HW_BOARD_NAME)
  */
 STATIC const MP_DEFINE_STR_OBJ(mp_machine_mcu_name_obj, MICROPY_HW_MCU_NAME);
 
+/**
+ * @brief Counts of interrupt callbacks which were queued to the scheduler, and
+ *        which were dropped because its queue was full.
+ */
+static struct
+{
+    uint32_t queued;
+    uint32_t dropped;
+} irq_stats = {
+    .queued = 0,
+    .dropped = 0,
+};
+
+/**
+ * @brief Schedules an interrupt callback to be run from the main thread.
+ */
+void machine_irq_schedule(mp_obj_t function, mp_obj_t arg)
+{
+    if (mp_sched_schedule(function, arg))
+    {
+        irq_stats.queued++;
+    }
+    else
+    {
+        irq_stats.dropped++;
+    }
+}
+
+/**
+ * @brief Calls an interrupt callback straight away from within an interrupt.
+ */
+void machine_irq_call_hard(mp_obj_t function, size_t n_args, const mp_obj_t *args)
+{
+    // Don't allow the heap or the scheduler to be used from the callback
+    mp_sched_lock();
+    gc_lock();
+
+    // Catch any exceptions, as there's nowhere to raise them to
+    nlr_buf_t nlr;
+
+    if (nlr_push(&nlr) == 0)
+    {
+        mp_call_function_n_kw(function, n_args, 0, args);
+        nlr_pop();
+    }
+    else
+    {
+        mp_printf(MICROPY_ERROR_PRINTER, "Uncaught exception in IRQ callback\n");
+        mp_obj_print_exception(MICROPY_ERROR_PRINTER, MP_OBJ_FROM_PTR(nlr.ret_val));
+    }
+
+    gc_unlock();
+    mp_sched_unlock();
+}
+
+/**
+ * @brief Returns a tuple of how many interrupt callbacks have been queued, and
+ *        how many were dropped because too many were waiting to run.
+ */
+STATIC mp_obj_t machine_irq_stats(void)
+{
+    mp_obj_t tuple[] = {
+        mp_obj_new_int_from_uint(irq_stats.queued),
+        mp_obj_new_int_from_uint(irq_stats.dropped),
+    };
+
+    return mp_obj_new_tuple(2, tuple);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(machine_irq_stats_obj, machine_irq_stats);
+
 /**
  * @brief Prints out the 48 bit device MAC address.
  */
@@ -138,6 +210,25 @@ STATIC mp_obj_t machine_reset_cause(void)
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_0(machine_reset_cause_obj, machine_reset_cause);
 
+/**
+ * @brief Sleeps for a number of milliseconds while the BLE connection is kept
+ *        alive, and stdout keeps being sent. Ctrl-C ends the sleep early by
+ *        raising the KeyboardInterrupt, so nothing is returned then.
+ * @returns The time actually slept in milliseconds.
+ */
+STATIC mp_obj_t machine_lightsleep(mp_obj_t ms_in)
+{
+    mp_int_t ms = mp_obj_get_int(ms_in);
+
+    if (ms < 0)
+    {
+        mp_raise_ValueError(MP_ERROR_TEXT("time cannot be negative"));
+    }
+
+    return mp_obj_new_int_from_ull(machine_rtc_lightsleep(ms));
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(machine_lightsleep_obj, machine_lightsleep);
+
 /**
  * @brief Puts the nRF into system off mode. Only pin resets, or GPIO interrupts
  *        will wake up and reset the device.
@@ -163,15 +254,21 @@ STATIC const mp_rom_map_elem_t machine_module_globals_table[] = {
     {MP_ROM_QSTR(MP_QSTR_reset), MP_ROM_PTR(&machine_reset_obj)},
     {MP_ROM_QSTR(MP_QSTR_reset_cause), MP_ROM_PTR(&machine_reset_cause_obj)},
     {MP_ROM_QSTR(MP_QSTR_power_down), MP_ROM_PTR(&machine_power_down_obj)},
+    {MP_ROM_QSTR(MP_QSTR_lightsleep), MP_ROM_PTR(&machine_lightsleep_obj)},
+    {MP_ROM_QSTR(MP_QSTR_irq_stats), MP_ROM_PTR(&machine_irq_stats_obj)},
     // {MP_ROM_QSTR(MP_QSTR_bootloader), MP_ROM_PTR(&machine_bootloader_obj)},
 
     // Classes for the hardware peripherals
     {MP_ROM_QSTR(MP_QSTR_ADC), MP_ROM_PTR(&machine_adc_type)},
+    {MP_ROM_QSTR(MP_QSTR_BLE), MP_ROM_PTR(&machine_ble_type)},
     {MP_ROM_QSTR(MP_QSTR_Flash), MP_ROM_PTR(&machine_flash_type)},
     {MP_ROM_QSTR(MP_QSTR_FPGA), MP_ROM_PTR(&machine_fpga_type)},
+    {MP_ROM_QSTR(MP_QSTR_KVStore), MP_ROM_PTR(&machine_kvstore_type)},
+    {MP_ROM_QSTR(MP_QSTR_Logger), MP_ROM_PTR(&machine_logger_type)},
     {MP_ROM_QSTR(MP_QSTR_PMIC), MP_ROM_PTR(&machine_pmic_type)},
     {MP_ROM_QSTR(MP_QSTR_Pin), MP_ROM_PTR(&machine_pin_type)},
     {MP_ROM_QSTR(MP_QSTR_RTC), MP_ROM_PTR(&machine_rtc_type)},
+    {MP_ROM_QSTR(MP_QSTR_Timer), MP_ROM_PTR(&machine_timer_type)},
 
     // TODO Some extra features we can add later if there's space
     // {MP_ROM_QSTR(MP_QSTR_Temp), MP_ROM_PTR(&machine_temp_type)},
@@ -34,16 +34,85 @@
  */
 extern const mp_obj_type_t machine_adc_type;
 
+/**
+ * @brief Declaration of the BLE class.
+ */
+extern const mp_obj_type_t machine_ble_type;
+
 /**
  * @brief Declaration of the Flash class.
  */
 extern const mp_obj_type_t machine_flash_type;
 
+/**
+ * @brief Layout of the 32 Mbit flash. The FPGA bitstream is stored from the
+ *        start of the flash, and the filesystem follows it. The key-value
+ *        store and the logger take up the end of the flash.
+ */
+#define MACHINE_FLASH_SIZE (0x400000)
+#define MACHINE_FLASH_PAGE_SIZE (0x100)
+#define MACHINE_FLASH_BLOCK_SIZE (0x1000)
+#define MACHINE_FLASH_FS_START (0x100000)
+#define MACHINE_FLASH_FS_SIZE (0x200000)
+#define MACHINE_FLASH_KV_START (0x300000)
+#define MACHINE_FLASH_KV_SIZE (0x40000)
+#define MACHINE_FLASH_LOG_START (0x340000)
+#define MACHINE_FLASH_LOG_SIZE (0xC0000)
+
+/**
+ * @brief Wakes up the flash from deep sleep if needed, and pushes back the
+ *        idle timeout.
+ */
+void machine_flash_wake(void);
+
+/**
+ * @brief Waits until the last erase or program operation on the flash has
+ *        completed.
+ */
+void machine_flash_wait_ready(void);
+
+/**
+ * @brief Reads any number of bytes from any address of the flash, directly
+ *        into the buffer given.
+ * @param address: The 24bit address to read from.
+ * @param buffer: Where the data will be copied.
+ * @param len: The number of bytes to read.
+ */
+void machine_flash_read(uint32_t address, uint8_t *buffer, size_t len);
+
+/**
+ * @brief Programs any number of bytes to any address of the flash. The area
+ *        must have been erased first. The last page is left to complete in the
+ *        background.
+ * @param address: The 24bit address to write to.
+ * @param buffer: The data to write.
+ * @param len: The number of bytes to write.
+ */
+void machine_flash_program(uint32_t address, const uint8_t *buffer, size_t len);
+
+/**
+ * @brief Erases a range of the flash. The last erase is left to complete in
+ *        the background.
+ * @param address: The 24bit address to start from, aligned to 4k.
+ * @param len: The number of bytes to erase, a multiple of 4k.
+ */
+void machine_flash_erase_range(uint32_t address, uint32_t len);
+
 /**
  * @brief Declaration of the FPGA class.
  */
 extern const mp_obj_type_t machine_fpga_type;
 
+/**
+ * @brief Declaration of the KVStore class.
+ */
+extern const mp_obj_type_t machine_kvstore_type;
+
+/**
+ * @brief Declaration of the Logger class.
+ */
+extern const mp_obj_type_t machine_logger_type;
+
 /**
  * @brief Declaration of the PMIC class.
  */
@@ -59,11 +128,39 @@ extern const mp_obj_type_t machine_pin_type;
  */
 extern const mp_obj_type_t machine_rtc_type;
 
+/**
+ * @brief Declaration of the Timer class.
+ */
+extern const mp_obj_type_t machine_timer_type;
+
+/**
+ * @brief Schedules an interrupt callback to be run from the main thread, and
+ *        counts whether it was queued or dropped. Safe to call from interrupts.
+ * @param function: The function to call.
+ * @param arg: The argument to call it with.
+ */
+void machine_irq_schedule(mp_obj_t function, mp_obj_t arg);
+
+/**
+ * @brief Calls an interrupt callback straight away from within an interrupt.
+ *        The heap is locked, so the callback must not allocate.
+ * @param function: The function to call.
+ * @param n_args: The number of arguments.
+ * @param args: The arguments to call it with.
+ */
+void machine_irq_call_hard(mp_obj_t function, size_t n_args, const mp_obj_t *args);
+
 /**
  * @brief Initialises the FPGA module.
  */
 void machine_fpga_init(void);
 
+/**
+ * @brief Returns true while the FPGA is loading its image from the flash, when
+ *        nothing else may use the flash.
+ */
+bool machine_fpga_configuring(void);
+
 /**
  * @brief Initialises the PMIC module.
  */
@@ -74,4 +171,98 @@ void machine_pmic_init(void);
  */
 void machine_rtc_init(void);
 
+/**
+ * @brief The RTC runs without a prescaler, straight from the 32768Hz LFCLK.
+ */
+#define MACHINE_RTC_FREQUENCY 32768
+
+/**
+ * @brief Compare values closer than this many ticks to the counter may not
+ *        trigger, so nothing shorter can be timed.
+ */
+#define MACHINE_RTC_MIN_DELTA 3
+
+/**
+ * @brief Returns the number of 32768Hz RTC ticks since power on.
+ */
+uint64_t machine_rtc_ticks(void);
+
+/**
+ * @brief Returns the time set by RTC.time() in seconds.
+ */
+int64_t machine_rtc_time_get(void);
+
+/**
+ * @brief Converts milliseconds to RTC ticks, rounding up.
+ * @param ms: The time in milliseconds.
+ */
+uint64_t machine_rtc_ms_to_ticks(uint64_t ms);
+
+/**
+ * @brief Sleeps for a number of milliseconds. BLE events and scheduled
+ *        callbacks are handled while sleeping. Ctrl-C raises the
+ *        KeyboardInterrupt, so this only returns once the sleep is over.
+ * @param ms: The time to sleep for in milliseconds.
+ * @returns The time actually slept in milliseconds, which is never less
+ *          than ms.
+ */
+uint64_t machine_rtc_lightsleep(uint64_t ms);
+
+/**
+ * @brief Timeouts used within the port. They share one RTC compare channel,
+ *        but can all run at the same time.
+ */
+typedef enum
+{
+    MACHINE_RTC_TIMEOUT_CONN_IDLE,
+    MACHINE_RTC_TIMEOUT_TX_FLUSH,
+    MACHINE_RTC_TIMEOUT_STDOUT,
+    MACHINE_RTC_TIMEOUT_FLASH_POLL,
+    MACHINE_RTC_TIMEOUT_FLASH_IDLE,
+    MACHINE_RTC_TIMEOUT_COUNT,
+} machine_rtc_timeout_t;
+
+/**
+ * @brief Calls a handler from the RTC interrupt once a timeout expires. Calling
+ *        this again before the timeout expires restarts it.
+ * @param timeout: Which timeout to start.
+ * @param timeout_ms: The timeout in milliseconds.
+ * @param handler: The function to call.
+ */
+void machine_rtc_timeout_start(machine_rtc_timeout_t timeout,
+                               uint32_t timeout_ms,
+                               void (*handler)(void));
+
+/**
+ * @brief Stops a timeout started with machine_rtc_timeout_start().
+ * @param timeout: Which timeout to stop.
+ */
+void machine_rtc_timeout_stop(machine_rtc_timeout_t timeout);
+
+/**
+ * @brief Number of machine.Timer instances. Each one has its own RTC compare
+ *        channel.
+ */
+#define MACHINE_TIMER_COUNT 2
+
+/**
+ * @brief Sets the RTC compare channel of a timer to trigger at a deadline.
+ *        machine_timer_irq_handler() is called once it's reached.
+ * @param timer: The timer ID.
+ * @param deadline: The deadline in RTC ticks since power on.
+ */
+void machine_rtc_timer_start(uint32_t timer, uint64_t deadline);
+
+/**
+ * @brief Stops the RTC compare channel of a timer.
+ * @param timer: The timer ID.
+ */
+void machine_rtc_timer_stop(uint32_t timer);
+
+/**
+ * @brief Called from the RTC interrupt once the deadline of a timer is reached.
+ * @param timer: The timer ID.
+ */
+void machine_timer_irq_handler(uint32_t timer);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,78 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 Raj Nakarja - Silicon Witchery AB
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "py/obj.h"
+#include "extmod/utime_mphal.h"
+#include "modmachine.h"
+
+/**
+ * @brief Returns the time set by RTC.time() in seconds.
+ */
+STATIC mp_obj_t utime_time(void)
+{
+    return mp_obj_new_int_from_ll(machine_rtc_time_get());
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(utime_time_obj, utime_time);
+
+/**
+ * @brief Global module dictionary containing all of the methods for the utime
+ *        module. These are all backed by the RTC.
+ */
+STATIC const mp_rom_map_elem_t utime_module_globals_table[] = {
+
+    {MP_OBJ_NEW_QSTR(MP_QSTR___name__), MP_OBJ_NEW_QSTR(MP_QSTR_utime)},
+
+    // Delays
+    {MP_ROM_QSTR(MP_QSTR_sleep), MP_ROM_PTR(&mp_utime_sleep_obj)},
+    {MP_ROM_QSTR(MP_QSTR_sleep_ms), MP_ROM_PTR(&mp_utime_sleep_ms_obj)},
+    {MP_ROM_QSTR(MP_QSTR_sleep_us), MP_ROM_PTR(&mp_utime_sleep_us_obj)},
+
+    // Monotonic ticks
+    {MP_ROM_QSTR(MP_QSTR_ticks_ms), MP_ROM_PTR(&mp_utime_ticks_ms_obj)},
+    {MP_ROM_QSTR(MP_QSTR_ticks_us), MP_ROM_PTR(&mp_utime_ticks_us_obj)},
+    {MP_ROM_QSTR(MP_QSTR_ticks_cpu), MP_ROM_PTR(&mp_utime_ticks_cpu_obj)},
+    {MP_ROM_QSTR(MP_QSTR_ticks_add), MP_ROM_PTR(&mp_utime_ticks_add_obj)},
+    {MP_ROM_QSTR(MP_QSTR_ticks_diff), MP_ROM_PTR(&mp_utime_ticks_diff_obj)},
+
+    // Time set by RTC.time()
+    {MP_ROM_QSTR(MP_QSTR_time), MP_ROM_PTR(&utime_time_obj)},
+    {MP_ROM_QSTR(MP_QSTR_time_ns), MP_ROM_PTR(&mp_utime_time_ns_obj)},
+};
+STATIC MP_DEFINE_CONST_DICT(utime_module_globals, utime_module_globals_table);
+
+/**
+ * @brief Module structure for the utime object.
+ */
+const mp_obj_module_t utime_module = {
+    .base = {&mp_type_module},
+    .globals = (mp_obj_dict_t *)&utime_module_globals,
+};
+
+/**
+ * @brief Registration of the utime module.
+ */
+MP_REGISTER_MODULE(MP_QSTR_utime, utime_module);
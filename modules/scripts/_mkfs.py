@@ -0,0 +1,14 @@
+# Mounts the filesystem stored in the flash. If the flash doesn't contain one
+# yet, it's formatted first
+import uos
+from machine import Flash
+
+bdev = Flash()
+
+try:
+    uos.mount(bdev, "/")
+except OSError:
+    uos.VfsLfs2.mkfs(bdev)
+    uos.mount(bdev, "/")
+
+del bdev, uos, Flash
@@ -41,9 +41,55 @@
 #define MICROPY_FLOAT_IMPL (MICROPY_FLOAT_IMPL_FLOAT)
 #define MICROPY_PY_BUILTINS_COMPLEX (0)
 
+// Use 64 bit long ints, so that times such as RTC.time() can go beyond 2^30
+#define MICROPY_LONGINT_IMPL (MICROPY_LONGINT_IMPL_LONGLONG)
+
 // Enable byte arrays
 #define MICROPY_PY_BUILTINS_BYTEARRAY (1)
 
+// Window size for raw paste mode. Hosts never send more than this before the
+// REPL has consumed it, so it must fit within the BLE rx ring buffer
+#define MICROPY_REPL_STDIN_BUFFER_MAX (512)
+
+// Allow Ctrl-C to interrupt running code with a KeyboardInterrupt
+#define MICROPY_KBD_EXCEPTION (1)
+
+// Run Pin and FPGA interrupt callbacks from the main thread by default
+#define MICROPY_ENABLE_SCHEDULER (1)
+#define MICROPY_SCHEDULER_DEPTH (8)
+
+// Enable the utime module, which is also available as time
+#define MICROPY_PY_UTIME_MP_HAL (1)
+#define MICROPY_MODULE_WEAK_LINKS (1)
+
+// Enable the uselect module, which uasyncio uses to wait for IO and timeouts
+#define MICROPY_PY_USELECT (1)
+
+// Enable the filesystem stored in the flash, along with open() and importing
+// from files. Littlefs itself is enabled from the Makefile
+#define MICROPY_VFS (1)
+#define MICROPY_READER_VFS (1)
+#define MICROPY_ENABLE_EXTERNAL_IMPORT (1)
+#define MICROPY_PY_IO (1)
+#define MICROPY_PY_IO_FILEIO (1)
+#define mp_import_stat mp_vfs_import_stat
+#define mp_builtin_open_obj mp_vfs_open_obj
+
+// Allow importing .mpy files precompiled with mpy-cross. The VFS reader streams
+// them from the filesystem in small chunks, so only the loaded bytecode takes
+// up heap, rather than the source, parse tree and compiler state
+#define MICROPY_PERSISTENT_CODE_LOAD (1)
+
+// Sleep between checks while polling, rather than spinning on the CPU. The hook
+// doesn't rely on anything in the scope it's expanded in, so any user of it
+// builds. How long to sleep for is worked out within machine_rtc.c
+#define MICROPY_EVENT_POLL_HOOK                \
+    do                                         \
+    {                                          \
+        extern void mp_hal_poll_wait(void);    \
+        mp_hal_poll_wait();                    \
+    } while (0);
+
 ////////////////////////////////////////////////////////////////////////////////
 // TODO These are nice to have features. If space is needed, we can reduce them
 ////////////////////////////////////////////////////////////////////////////////
@@ -76,8 +122,32 @@ typedef int mp_int_t;           // must be pointer size
 typedef unsigned int mp_uint_t; // must be pointer size
 typedef long mp_off_t;
 
+// Critical sections which are safe to use alongside the softdevice
+mp_uint_t mp_hal_begin_atomic_section(void);
+void mp_hal_end_atomic_section(mp_uint_t state);
+
+#define MICROPY_BEGIN_ATOMIC_SECTION() mp_hal_begin_atomic_section()
+#define MICROPY_END_ATOMIC_SECTION(state) mp_hal_end_atomic_section(state)
+
+// Modules which can also be imported without the u prefix
+extern const struct _mp_obj_module_t utime_module;
+extern const struct _mp_obj_module_t mp_module_uselect;
+extern const struct _mp_obj_module_t uos_module;
+
+#define MICROPY_PORT_BUILTIN_MODULE_WEAK_LINKS                   \
+    {MP_ROM_QSTR(MP_QSTR_time), MP_ROM_PTR(&utime_module)},      \
+    {MP_ROM_QSTR(MP_QSTR_select), MP_ROM_PTR(&mp_module_uselect)}, \
+    {MP_ROM_QSTR(MP_QSTR_os), MP_ROM_PTR(&uos_module)},
+
 // Alias to port specific root pointers
 #define MP_STATE_PORT MP_STATE_VM
 
-// Root pointer for REPL history
-#define MICROPY_PORT_ROOT_POINTERS const char *readline_hist[8];
\ No newline at end of file
+// Root pointers for REPL history, and objects used by interrupts
+#define MICROPY_PORT_ROOT_POINTERS \
+    const char *readline_hist[8];  \
+    mp_obj_t pin_irq_objects[2];   \
+    mp_obj_t fpga_irq_handler;     \
+    mp_obj_t flash_irq_handler;    \
+    mp_obj_t kvstore;              \
+    mp_obj_t logger;               \
+    mp_obj_t timer_callbacks[2];
\ No newline at end of file
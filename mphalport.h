@@ -1,5 +1,4 @@
-static inline mp_uint_t mp_hal_ticks_ms(void) {
-    return 0;
-}
-static inline void mp_hal_set_interrupt_char(char c) {
-}
+// Ticks, delays and time_ns() are provided by the RTC module
+
+// Ctrl-C is picked out of the incoming REPL data in the BLE event handler
+#include "shared/runtime/interrupt_char.h"
@@ -0,0 +1,152 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 Raj Nakarja - Silicon Witchery AB
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <string.h>
+#include "ring_buffer.h"
+
+/**
+ * @brief Loads the index written by the other side. The acquire ordering makes
+ *        sure that buffer accesses can't be moved before the index is read.
+ */
+static inline uint16_t load_acquire(const uint16_t *index)
+{
+    return __atomic_load_n(index, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Publishes a new index to the other side. The release ordering makes
+ *        sure that buffer accesses are complete before the index changes.
+ */
+static inline void store_release(uint16_t *index, uint16_t value)
+{
+    __atomic_store_n(index, value, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Returns the number of bytes waiting to be read.
+ */
+size_t ring_buffer_used(const ring_buffer_t *ring)
+{
+    return (uint16_t)(load_acquire(&ring->head) - load_acquire(&ring->tail));
+}
+
+/**
+ * @brief Returns the number of bytes which can be written.
+ */
+size_t ring_buffer_free(const ring_buffer_t *ring)
+{
+    return ring->mask + 1 - ring_buffer_used(ring);
+}
+
+/**
+ * @brief Writes as much of the data as fits, in at most two copies.
+ */
+size_t ring_buffer_write(ring_buffer_t *ring, const uint8_t *data, size_t len)
+{
+    // Only the producer writes head, so it can be read directly
+    uint16_t head = ring->head;
+    uint16_t tail = load_acquire(&ring->tail);
+
+    // Clip the length to the free space
+    size_t space = ring->mask + 1 - (uint16_t)(head - tail);
+
+    if (len > space)
+    {
+        len = space;
+    }
+
+    // Copy up to the end of the buffer, and then the rest from the start
+    size_t offset = head & ring->mask;
+    size_t first = ring->mask + 1 - offset;
+
+    if (first > len)
+    {
+        first = len;
+    }
+
+    memcpy(ring->buffer + offset, data, first);
+    memcpy(ring->buffer, data + first, len - first);
+
+    // Publish the data to the consumer
+    store_release(&ring->head, head + len);
+
+    return len;
+}
+
+/**
+ * @brief Copies out up to len bytes without consuming them, in at most two
+ *        copies.
+ */
+size_t ring_buffer_peek(const ring_buffer_t *ring, uint8_t *data, size_t len)
+{
+    // Only the consumer writes tail, so it can be read directly
+    uint16_t tail = ring->tail;
+    uint16_t head = load_acquire(&ring->head);
+
+    // Clip the length to the available data
+    size_t used = (uint16_t)(head - tail);
+
+    if (len > used)
+    {
+        len = used;
+    }
+
+    // Copy up to the end of the buffer, and then the rest from the start
+    size_t offset = tail & ring->mask;
+    size_t first = ring->mask + 1 - offset;
+
+    if (first > len)
+    {
+        first = len;
+    }
+
+    memcpy(data, ring->buffer + offset, first);
+    memcpy(data + first, ring->buffer, len - first);
+
+    return len;
+}
+
+/**
+ * @brief Discards bytes from the buffer, usually after a peek.
+ */
+void ring_buffer_consume(ring_buffer_t *ring, size_t len)
+{
+    // Hand the space back to the producer
+    store_release(&ring->tail, ring->tail + len);
+}
+
+/**
+ * @brief Reads up to len bytes.
+ */
+size_t ring_buffer_read(ring_buffer_t *ring, uint8_t *data, size_t len)
+{
+    len = ring_buffer_peek(ring, data, len);
+
+    ring_buffer_consume(ring, len);
+
+    return len;
+}
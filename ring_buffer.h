@@ -0,0 +1,123 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 Raj Nakarja - Silicon Witchery AB
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef __MICROPY_INCLUDED_S1MOD_RING_BUFFER_H__
+#define __MICROPY_INCLUDED_S1MOD_RING_BUFFER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Single producer, single consumer ring buffer. The producer and
+ *        consumer may run in different contexts, i.e. one in an interrupt and
+ *        the other in thread mode, without any locking. The head is only ever
+ *        written by the producer, and the tail only by the consumer. Both are
+ *        free running, and wrap using a mask, so the size must be a power of
+ *        two, and all of it is usable.
+ */
+typedef struct
+{
+    uint8_t *buffer;
+    uint16_t mask;
+    uint16_t head;
+    uint16_t tail;
+} ring_buffer_t;
+
+/**
+ * @brief Fails the build unless the storage array size is a power of two, and
+ *        at most 32768, so that the free running indices can tell a full
+ *        buffer from an empty one. Evaluates to 0.
+ */
+#define RING_BUFFER_SIZE_CHECK(storage)                                        \
+    (0 * sizeof(struct {                                                       \
+         _Static_assert(sizeof(storage) > 0 &&                                 \
+                            (sizeof(storage) & (sizeof(storage) - 1)) == 0 &&  \
+                            sizeof(storage) <= 32768,                          \
+                        "ring buffer size must be a power of two up to 32768"); \
+         int unused;                                                           \
+     }))
+
+/**
+ * @brief Static initialiser for a ring buffer using the given storage array.
+ *        The size of the array must be a power of two, and at most 32768.
+ */
+#define RING_BUFFER_INIT(storage)                                       \
+    {                                                                   \
+        .buffer = (storage),                                            \
+        .mask = sizeof(storage) - 1 + RING_BUFFER_SIZE_CHECK(storage),  \
+        .head = 0,                                                      \
+        .tail = 0,                                                      \
+    }
+
+/**
+ * @brief Returns the number of bytes waiting to be read.
+ */
+size_t ring_buffer_used(const ring_buffer_t *ring);
+
+/**
+ * @brief Returns the number of bytes which can be written.
+ */
+size_t ring_buffer_free(const ring_buffer_t *ring);
+
+/**
+ * @brief Writes as much of the data as fits. Must only be called by the
+ *        producer.
+ * @param ring: The ring buffer.
+ * @param data: The data to write.
+ * @param len: The number of bytes to write.
+ * @returns The number of bytes written.
+ */
+size_t ring_buffer_write(ring_buffer_t *ring, const uint8_t *data, size_t len);
+
+/**
+ * @brief Copies out up to len bytes without consuming them. Must only be called
+ *        by the consumer.
+ * @param ring: The ring buffer.
+ * @param data: Where to copy the data.
+ * @param len: The maximum number of bytes to copy.
+ * @returns The number of bytes copied.
+ */
+size_t ring_buffer_peek(const ring_buffer_t *ring, uint8_t *data, size_t len);
+
+/**
+ * @brief Discards bytes from the buffer, usually after a peek. Must only be
+ *        called by the consumer.
+ * @param ring: The ring buffer.
+ * @param len: The number of bytes to discard. Must not be more than are used.
+ */
+void ring_buffer_consume(ring_buffer_t *ring, size_t len);
+
+/**
+ * @brief Reads up to len bytes. Must only be called by the consumer.
+ * @param ring: The ring buffer.
+ * @param data: Where to copy the data.
+ * @param len: The maximum number of bytes to read.
+ * @returns The number of bytes read.
+ */
+size_t ring_buffer_read(ring_buffer_t *ring, uint8_t *data, size_t len);
+
+#endif
@@ -0,0 +1,73 @@
+# A module of typical size and shape, which import_bench.py imports once from
+# source and once precompiled by mpy-cross
+
+
+class Reading:
+    def __init__(self, channel, value):
+        self.channel = channel
+        self.value = value
+
+    def scaled(self, gain, offset=0):
+        return self.value * gain + offset
+
+    def __repr__(self):
+        return "Reading({}, {})".format(self.channel, self.value)
+
+
+def average(values):
+    if not values:
+        return 0
+    return sum(values) / len(values)
+
+
+def moving_average(values, window):
+    out = []
+    total = 0
+    for i in range(len(values)):
+        total += values[i]
+        if i >= window:
+            total -= values[i - window]
+        out.append(total / min(i + 1, window))
+    return out
+
+
+def threshold(readings, level):
+    return [r for r in readings if r.value > level]
+
+
+def crc8(data, poly=0x31):
+    crc = 0xFF
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            if crc & 0x80:
+                crc = ((crc << 1) ^ poly) & 0xFF
+            else:
+                crc = (crc << 1) & 0xFF
+    return crc
+
+
+def pack(readings):
+    out = bytearray()
+    for r in readings:
+        out.append(r.channel)
+        out.extend(int(r.value).to_bytes(2, "little"))
+    out.append(crc8(out))
+    return out
+
+
+def unpack(data):
+    if crc8(data[:-1]) != data[-1]:
+        raise ValueError("bad crc")
+    return [
+        Reading(data[i], int.from_bytes(data[i + 1 : i + 3], "little"))
+        for i in range(0, len(data) - 1, 3)
+    ]
+
+
+NAMES = {
+    0: "battery",
+    1: "temperature",
+    2: "light",
+    3: "pressure",
+}
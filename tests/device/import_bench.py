@@ -0,0 +1,56 @@
+# Compares importing a module from source against importing the same module
+# precompiled by mpy-cross. This runs on the device, as the heap and time taken
+# depend on the real firmware. Build the .mpy with the mpy-cross from the
+# MicroPython submodule, then copy both files and this one to the filesystem:
+#
+#     micropython/mpy-cross/mpy-cross tests/device/bench_module.py
+#
+# and run it from the REPL with:
+#
+#     import import_bench
+import gc
+import sys
+import uos
+import utime
+
+MODULE = "bench_module"
+
+
+def measure():
+    # Start from a collected heap, and keep the collector off while importing,
+    # so that the drop in free memory counts everything the import allocated
+    sys.modules.pop(MODULE, None)
+    gc.collect()
+    free = gc.mem_free()
+    gc.disable()
+
+    start = utime.ticks_ms()
+    __import__(MODULE)
+    took = utime.ticks_diff(utime.ticks_ms(), start)
+
+    allocated = free - gc.mem_free()
+    gc.enable()
+    gc.collect()
+    kept = free - gc.mem_free()
+
+    return took, allocated, kept
+
+
+def report(name, took, allocated, kept):
+    print("{:<7} {:>5} ms {:>7} bytes allocated {:>7} bytes kept".format(name, took, allocated, kept))
+
+
+files = uos.listdir()
+
+if MODULE + ".py" not in files or MODULE + ".mpy" not in files:
+    raise OSError("copy {0}.py and {0}.mpy to the filesystem first".format(MODULE))
+
+# Import looks for the source first, so move it aside for the .mpy
+report("source", *measure())
+uos.rename(MODULE + ".py", MODULE + ".py_")
+
+try:
+    report(".mpy", *measure())
+finally:
+    uos.rename(MODULE + ".py_", MODULE + ".py")
+    sys.modules.pop(MODULE, None)
@@ -0,0 +1,28 @@
+# Measures how fast a large print() streams out over the Bluetooth REPL. stdout
+# waits for room in its 1k buffer rather than dropping data, so the time taken
+# to print follows the link, apart from the last buffer full still going out.
+# Copy this to the filesystem, connect from a central and run it with:
+#
+#     import stdout_bench
+import utime
+from machine import BLE
+
+LINES = 1024
+LINE = "0123456789abcdef" * 4
+
+# Each line goes out with \r\n on the end
+total = LINES * (len(LINE) + 2)
+
+dropped = BLE.stdout_dropped()
+start = utime.ticks_ms()
+
+for _ in range(LINES):
+    print(LINE)
+
+took = utime.ticks_diff(utime.ticks_ms(), start)
+
+print(
+    "{} bytes in {} ms, {} bytes/s, {} dropped".format(
+        total, took, total * 1000 // took, BLE.stdout_dropped() - dropped
+    )
+)
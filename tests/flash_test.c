@@ -0,0 +1,601 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 Raj Nakarja - Silicon Witchery AB
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "machine_flash.c"
+#include "flash_sim.h"
+#include "test.h"
+
+/**
+ * @brief Resets the nRF, which puts the driver back as it is at boot. The
+ *        flash itself carries on with whatever it was doing.
+ */
+static void nrf_reset(void)
+{
+    memset(&flash_power, 0, sizeof(flash_power));
+    flash_power.asleep = true;
+    flash_power.idle_timeout_ms = 50;
+    memset(&flash_op, 0, sizeof(flash_op));
+    test_fpga_configuring = false;
+}
+
+/**
+ * @brief Starts over with an erased flash, and the driver as it is at boot.
+ */
+static void flash_power_on(void)
+{
+    flash_sim_reset();
+    nrf_reset();
+}
+
+/**
+ * @brief Creates a block device over a region, as machine.Flash(start, len).
+ */
+static mp_obj_t flash_new(uint32_t start, uint32_t len)
+{
+    mp_obj_t args[] = {MP_OBJ_NEW_SMALL_INT(start), MP_OBJ_NEW_SMALL_INT(len)};
+
+    return machine_flash_make_new(&machine_flash_type, 2, 0, args);
+}
+
+static mp_obj_t ioctl(mp_obj_t flash, mp_int_t op, mp_obj_t arg)
+{
+    return machine_flash_ioctl(flash, MP_OBJ_NEW_SMALL_INT(op), arg);
+}
+
+static void readblocks(mp_obj_t flash, mp_obj_t block, mp_obj_t buf, mp_int_t offset)
+{
+    mp_obj_t args[] = {flash, block, buf, MP_OBJ_NEW_SMALL_INT(offset)};
+    machine_flash_readblocks(4, args);
+}
+
+static void writeblocks(mp_obj_t flash, mp_obj_t block, mp_obj_t buf, mp_int_t offset)
+{
+    mp_obj_t args[] = {flash, block, buf, MP_OBJ_NEW_SMALL_INT(offset)};
+    machine_flash_writeblocks(4, args);
+}
+
+/**
+ * @brief Block device accesses stay inside their region, including erases,
+ *        and ones whose block or offset would overflow the address.
+ */
+static void test_block_device_bounds(void)
+{
+    const uint32_t start = 0x10000;
+    const uint32_t len = 4 * MACHINE_FLASH_BLOCK_SIZE;
+
+    flash_power_on();
+
+    // Fill the region, and the blocks on either side of it
+    memset(&flash_sim.memory[start - MACHINE_FLASH_BLOCK_SIZE], 0x00,
+           len + 2 * MACHINE_FLASH_BLOCK_SIZE);
+
+    mp_obj_t flash = flash_new(start, len);
+
+    TEST_CHECK(ioctl(flash, MP_BLOCKDEV_IOCTL_BLOCK_COUNT, mp_const_none) == MP_OBJ_NEW_SMALL_INT(4));
+    TEST_CHECK(ioctl(flash, MP_BLOCKDEV_IOCTL_BLOCK_SIZE, mp_const_none) == MP_OBJ_NEW_SMALL_INT(MACHINE_FLASH_BLOCK_SIZE));
+
+    // Erases only touch the block given
+    ioctl(flash, MP_BLOCKDEV_IOCTL_BLOCK_ERASE, MP_OBJ_NEW_SMALL_INT(3));
+    ioctl(flash, MP_BLOCKDEV_IOCTL_SYNC, mp_const_none);
+
+    TEST_CHECK(flash_sim.memory[start + 3 * MACHINE_FLASH_BLOCK_SIZE - 1] == 0x00);
+    TEST_CHECK(flash_sim.memory[start + 3 * MACHINE_FLASH_BLOCK_SIZE] == 0xFF);
+    TEST_CHECK(flash_sim.memory[start + len - 1] == 0xFF);
+
+    // Blocks outside of the region are refused, rather than erased
+    static const mp_int_t bad_blocks[] = {-1, 4, 0x7FFFF, 0x100000, -0x100000};
+
+    for (size_t i = 0; i < MP_ARRAY_SIZE(bad_blocks); i++)
+    {
+        mp_obj_t block = MP_OBJ_NEW_SMALL_INT(bad_blocks[i]);
+        mp_obj_t buf = mp_obj_new_bytearray(16, NULL);
+
+        TEST_CHECK(test_raised(ioctl(flash, MP_BLOCKDEV_IOCTL_BLOCK_ERASE, block)) == &mp_type_ValueError);
+        TEST_CHECK(test_raised(readblocks(flash, block, buf, 0)) == &mp_type_ValueError);
+        TEST_CHECK(test_raised(writeblocks(flash, block, buf, 0)) == &mp_type_ValueError);
+    }
+
+    ioctl(flash, MP_BLOCKDEV_IOCTL_SYNC, mp_const_none);
+
+    TEST_CHECK(flash_sim.memory[start - 1] == 0x00);
+    TEST_CHECK(flash_sim.memory[start + len] == 0x00);
+
+    // Offsets and lengths must keep the access inside the region too
+    mp_obj_t one = mp_obj_new_bytearray(1, NULL);
+    mp_obj_t empty = mp_obj_new_bytearray(0, NULL);
+    mp_obj_t whole = mp_obj_new_bytearray(len, NULL);
+    mp_obj_t zero = MP_OBJ_NEW_SMALL_INT(0);
+
+    TEST_CHECK(test_raised(readblocks(flash, zero, one, -1)) == &mp_type_ValueError);
+    TEST_CHECK(test_raised(readblocks(flash, zero, one, len)) == &mp_type_ValueError);
+    TEST_CHECK(test_raised(readblocks(flash, zero, empty, len)) == &mp_type_ValueError);
+    TEST_CHECK(test_raised(readblocks(flash, MP_OBJ_NEW_SMALL_INT(1), whole, 0)) == &mp_type_ValueError);
+    TEST_CHECK(test_raised(readblocks(flash, zero, one, 0x7FFFFFFF)) == &mp_type_ValueError);
+
+    TEST_CHECK(test_raised(readblocks(flash, zero, one, len - 1)) == NULL);
+    TEST_CHECK(test_raised(readblocks(flash, zero, whole, 0)) == NULL);
+
+    // Writes with an offset land where they should
+    uint8_t data[] = {0x12, 0x34};
+    writeblocks(flash, MP_OBJ_NEW_SMALL_INT(3), mp_obj_new_bytearray(2, data), 100);
+    ioctl(flash, MP_BLOCKDEV_IOCTL_SYNC, mp_const_none);
+
+    TEST_CHECK(memcmp(&flash_sim.memory[start + 3 * MACHINE_FLASH_BLOCK_SIZE + 100], data, 2) == 0);
+    TEST_CHECK(flash_sim.stats.errors == 0);
+}
+
+/**
+ * @brief Back to back reads during an erase each suspend it, but no sooner
+ *        than tSUS after it was last resumed, so the erase still completes.
+ */
+static void test_read_during_erase(void)
+{
+    const uint32_t reads = 5000;
+
+    flash_power_on();
+    memset(flash_sim.memory, 0x00, 0x20000);
+
+    machine_flash_erase_range(0x10000, 0x10000);
+
+    for (uint32_t i = 0; i < reads; i++)
+    {
+        uint8_t buffer[16];
+        machine_flash_read(0x20000 + i * sizeof(buffer), buffer, sizeof(buffer));
+        TEST_CHECK(buffer[0] == 0xFF);
+    }
+
+    TEST_CHECK(flash_sim.stats.suspends == reads);
+
+    machine_flash_wait_ready();
+
+    TEST_CHECK(flash_sim.memory[0x10000] == 0xFF);
+    TEST_CHECK(flash_sim.memory[0x1FFFF] == 0xFF);
+    TEST_CHECK(flash_sim.memory[0xFFFF] == 0x00);
+    TEST_CHECK(flash_sim.stats.errors == 0);
+}
+
+/**
+ * @brief The CPU cycle counter which times the suspends wraps around every 67
+ *        seconds. Suspends are still spaced out when it wraps between a resume
+ *        and the next suspend, wherever the reads fall.
+ */
+static void test_suspend_spacing_across_wrap(void)
+{
+    const uint64_t wrap_ns = (1ULL << 32) * 1000 / FLASH_CPU_CYCLES_PER_US;
+
+    for (uint64_t offset_ns = 0; offset_ns < 100000; offset_ns += 250)
+    {
+        flash_power_on();
+        test_time_ns = wrap_ns - 100000 + offset_ns;
+
+        machine_flash_erase_range(0x10000, MACHINE_FLASH_BLOCK_SIZE);
+
+        for (uint32_t i = 0; i < 8; i++)
+        {
+            uint8_t buffer[16];
+            machine_flash_read(0x20000, buffer, sizeof(buffer));
+        }
+
+        machine_flash_wait_ready();
+
+        TEST_CHECK(flash_sim.stats.suspends == 8);
+        TEST_CHECK(flash_sim.stats.errors == 0);
+    }
+}
+
+/**
+ * @brief Flash.read() and Flash.write() both take byte addresses, so data
+ *        written at an address is read back from the same one.
+ */
+static void test_read_write_addresses(void)
+{
+    flash_power_on();
+
+    // Flash.read() is the same function as Flash.readinto()
+    for (size_t i = 0; i < MP_ARRAY_SIZE(machine_flash_locals_dict_table); i++)
+    {
+        if (machine_flash_locals_dict_table[i].key == MP_ROM_QSTR(MP_QSTR_read))
+        {
+            TEST_CHECK(machine_flash_locals_dict_table[i].value ==
+                       MP_ROM_PTR(&machine_flash_readinto_static_obj));
+        }
+    }
+
+    uint8_t data[300];
+
+    for (size_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = (uint8_t)(i * 13);
+    }
+
+    mp_obj_t address = MP_OBJ_NEW_SMALL_INT(0x1234);
+    mp_obj_t read = mp_obj_new_bytearray(sizeof(data), NULL);
+
+    machine_flash_write(address, mp_obj_new_bytearray(sizeof(data), data));
+    machine_flash_readinto(address, read);
+
+    TEST_CHECK(memcmp(((mp_obj_array_t *)read)->items, data, sizeof(data)) == 0);
+    TEST_CHECK(memcmp(&flash_sim.memory[0x1234], data, sizeof(data)) == 0);
+
+    // Reads and writes past the end of the flash are refused
+    mp_obj_t end = MP_OBJ_NEW_SMALL_INT(MACHINE_FLASH_SIZE - 1);
+
+    TEST_CHECK(test_raised(machine_flash_readinto(end, mp_obj_new_bytearray(2, NULL))) == &mp_type_ValueError);
+    TEST_CHECK(test_raised(machine_flash_write(end, mp_obj_new_bytearray(2, NULL))) == &mp_type_ValueError);
+    TEST_CHECK(flash_sim.stats.errors == 0);
+}
+
+/**
+ * @brief The nRF resets while an erase is running. The first use of the flash
+ *        afterwards has to wait for it, rather than talking over it.
+ */
+static void test_reset_during_erase(void)
+{
+    flash_power_on();
+    memset(flash_sim.memory, 0x00, 0x20000);
+
+    machine_flash_erase_range(0x10000, 0x10000);
+    nrf_reset();
+
+    uint8_t buffer[16];
+    machine_flash_read(0x20000, buffer, sizeof(buffer));
+
+    TEST_CHECK(buffer[0] == 0xFF);
+    TEST_CHECK(!flash_sim_busy());
+    TEST_CHECK(flash_sim.memory[0x10000] == 0xFF);
+    TEST_CHECK(flash_sim.stats.errors == 0);
+}
+
+/**
+ * @brief The nRF resets while an erase is suspended. The first use of the
+ *        flash afterwards resumes it, so that it isn't left suspended forever.
+ */
+static void test_reset_during_suspend(void)
+{
+    flash_power_on();
+    memset(flash_sim.memory, 0x00, 0x20000);
+
+    machine_flash_erase_range(0x10000, 0x10000);
+
+    uint8_t suspend_cmd = 0x75;
+    spim_tx_rx(&suspend_cmd, 1, NULL, 0, FLASH);
+    flash_sim_idle(FLASH_SIM_SUSPEND_NS);
+
+    nrf_reset();
+
+    uint8_t buffer[16];
+    machine_flash_read(0x20000, buffer, sizeof(buffer));
+    machine_flash_wait_ready();
+
+    TEST_CHECK(flash_sim.stats.resumes == 1);
+    TEST_CHECK(!flash_sim.suspended);
+    TEST_CHECK(flash_sim.memory[0x10000] == 0xFF);
+    TEST_CHECK(flash_sim.stats.errors == 0);
+}
+
+/**
+ * @brief The idle timeout leaves the flash awake, and its bus alone, while the
+ *        FPGA loads its image from it.
+ */
+static void test_idle_while_fpga_configures(void)
+{
+    flash_power_on();
+
+    uint8_t buffer[16];
+    machine_flash_read(0, buffer, sizeof(buffer));
+
+    test_fpga_configuring = true;
+    uint64_t transfers = flash_sim.stats.transfers;
+
+    flash_sim_idle(1000 * 1000000ULL);
+
+    TEST_CHECK(!flash_sim.asleep);
+    TEST_CHECK(flash_sim.stats.transfers == transfers);
+
+    // Once it's done, the flash goes to sleep as usual
+    test_fpga_configuring = false;
+    flash_sim_idle(1000 * 1000000ULL);
+
+    TEST_CHECK(flash_sim.asleep);
+    TEST_CHECK(flash_sim.stats.errors == 0);
+}
+
+static void erase_range(mp_int_t address, mp_int_t length)
+{
+    machine_flash_erase_range_method(mp_obj_new_int_from_ll(address), mp_obj_new_int_from_ll(length));
+}
+
+/**
+ * @brief Flash.erase_range() refuses ranges outside of the flash, including
+ *        ones where the end would overflow back into it.
+ */
+static void test_erase_range_bounds(void)
+{
+    const mp_int_t block = MACHINE_FLASH_BLOCK_SIZE;
+    const mp_int_t wrap = (mp_int_t)(((uintptr_t)1 << (sizeof(mp_int_t) * 8 - 1)) / block * block);
+
+    flash_power_on();
+    memset(flash_sim.memory, 0x00, MACHINE_FLASH_SIZE);
+
+    TEST_CHECK(test_raised(erase_range(-block, block)) == &mp_type_ValueError);
+    TEST_CHECK(test_raised(erase_range(0, -block)) == &mp_type_ValueError);
+    TEST_CHECK(test_raised(erase_range(MACHINE_FLASH_SIZE, block)) == &mp_type_ValueError);
+    TEST_CHECK(test_raised(erase_range(MACHINE_FLASH_SIZE - block, 2 * block)) == &mp_type_ValueError);
+    TEST_CHECK(test_raised(erase_range(block, wrap)) == &mp_type_ValueError);
+    TEST_CHECK(test_raised(erase_range(wrap - block, 2 * block)) == &mp_type_ValueError);
+
+    machine_flash_wait_ready();
+    TEST_CHECK(flash_sim.stats.erases == 0);
+
+    // The whole flash, and nothing at all, are both fine
+    TEST_CHECK(test_raised(erase_range(MACHINE_FLASH_SIZE, 0)) == NULL);
+    TEST_CHECK(test_raised(erase_range(0, MACHINE_FLASH_SIZE)) == NULL);
+
+    machine_flash_wait_ready();
+    TEST_CHECK(flash_sim.memory[0] == 0xFF);
+    TEST_CHECK(flash_sim.memory[MACHINE_FLASH_SIZE - 1] == 0xFF);
+    TEST_CHECK(flash_sim.stats.errors == 0);
+}
+
+/**
+ * @brief Flash.erase_range() erases every 4k sector of the range, whatever
+ *        its alignment, with as few erases as the 64k, 32k and 4k commands
+ *        allow. The sectors either side are left alone.
+ */
+static bool sector_filled(uint32_t sector, uint8_t value)
+{
+    for (uint32_t offset = 0; offset < MACHINE_FLASH_BLOCK_SIZE; offset++)
+    {
+        if (flash_sim.memory[sector + offset] != value)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void test_erase_range_coverage(void)
+{
+    static const struct
+    {
+        uint32_t address;
+        uint32_t length;
+        uint32_t erases;
+    } ranges[] = {
+        {0x10000, 0x10000, 1},  // One 64k block
+        {0x4000, 0xC000, 5},    // 16k aligned, 4 x 4k then 32k
+        {0x20000, 0x3000, 3},   // Odd length, 3 x 4k
+        {0x2000, 0x8000, 8},    // 8k aligned, the 32k block overruns the end
+        {0x6000, 0x1A000, 4},   // 2 x 4k, 32k, then 64k
+        {0x31000, 0x11000, 10}, // 7 x 4k, 32k, then 2 x 4k
+    };
+
+    const uint32_t block = MACHINE_FLASH_BLOCK_SIZE;
+
+    for (size_t i = 0; i < MP_ARRAY_SIZE(ranges); i++)
+    {
+        flash_power_on();
+        memset(flash_sim.memory, 0x00, MACHINE_FLASH_SIZE);
+
+        erase_range(ranges[i].address, ranges[i].length);
+        machine_flash_wait_ready();
+
+        for (uint32_t sector = ranges[i].address - block;
+             sector < ranges[i].address + ranges[i].length + block;
+             sector += block)
+        {
+            bool inside = sector >= ranges[i].address &&
+                          sector < ranges[i].address + ranges[i].length;
+
+            if (!sector_filled(sector, inside ? 0xFF : 0x00))
+            {
+                printf("flash: range 0x%05lx+0x%05lx, sector 0x%05lx is %s\n",
+                       (unsigned long)ranges[i].address, (unsigned long)ranges[i].length,
+                       (unsigned long)sector, inside ? "not erased" : "erased");
+                test_failures++;
+            }
+        }
+
+        TEST_CHECK(flash_sim.stats.erases == ranges[i].erases);
+        TEST_CHECK(flash_sim.stats.errors == 0);
+    }
+}
+
+/**
+ * @brief Times erasing 1M with one Flash.erase_range() call, against erasing
+ *        it a 4k block at a time.
+ */
+static void bench_erases(void)
+{
+    const uint32_t start = MACHINE_FLASH_FS_START;
+    const uint32_t length = 0x100000;
+
+    flash_power_on();
+
+    uint64_t start_ns = test_time_ns;
+
+    erase_range(start, length);
+    machine_flash_wait_ready();
+
+    uint64_t range_ns = test_time_ns - start_ns;
+    uint32_t range_erases = flash_sim.stats.erases;
+
+    flash_power_on();
+
+    start_ns = test_time_ns;
+
+    for (uint32_t address = start; address < start + length; address += MACHINE_FLASH_BLOCK_SIZE)
+    {
+        erase_range(address, MACHINE_FLASH_BLOCK_SIZE);
+    }
+    machine_flash_wait_ready();
+
+    uint64_t block_ns = test_time_ns - start_ns;
+
+    printf("flash: erasing 1M, %-10s %5lu erases %7.2f s on the flash\n",
+           "range", (unsigned long)range_erases, range_ns / 1e9);
+    printf("flash: erasing 1M, %-10s %5lu erases %7.2f s on the flash\n",
+           "4k blocks", (unsigned long)flash_sim.stats.erases, block_ns / 1e9);
+
+    TEST_CHECK(range_erases == length / 0x10000);
+    TEST_CHECK(range_ns * 4 < block_ns);
+    TEST_CHECK(flash_sim.stats.errors == 0);
+}
+
+/**
+ * @brief Reports the read throughput for a few read sizes at each of the SPI
+ *        clocks the flash is used at. Long FAST READs should stream at the
+ *        full clock rate, with only the command and dummy byte on top.
+ */
+static void bench_reads(void)
+{
+    static const uint32_t clocks_hz[] = {1000000, 4000000, 8000000};
+    static const size_t sizes[] = {16, 256, 4096, 65536};
+    static uint8_t buffer[65536];
+
+    flash_power_on();
+
+    for (size_t i = 0; i < sizeof(buffer); i++)
+    {
+        flash_sim.memory[i] = (uint8_t)(i * 7);
+    }
+
+    for (size_t c = 0; c < MP_ARRAY_SIZE(clocks_hz); c++)
+    {
+        TEST_CHECK(spim_frequency_set(FLASH, clocks_hz[c]));
+
+        for (size_t s = 0; s < MP_ARRAY_SIZE(sizes); s++)
+        {
+            const int reads = sizeof(buffer) / sizes[s];
+
+            // Wake the flash first, so that only the reads are timed
+            machine_flash_wake();
+
+            uint64_t start_ns = test_time_ns;
+
+            for (int r = 0; r < reads; r++)
+            {
+                machine_flash_read(r * sizes[s], buffer + r * sizes[s], sizes[s]);
+            }
+
+            double mb_per_s = sizeof(buffer) / ((test_time_ns - start_ns) / 1e3);
+
+            printf("flash: reads of %5zu bytes at %4lu kHz %7.3f MB/s\n",
+                   sizes[s], (unsigned long)(clocks_hz[c] / 1000), mb_per_s);
+
+            // The 5 byte command costs under 1% on reads of 4k or more
+            if (sizes[s] >= 4096)
+            {
+                TEST_CHECK(mb_per_s >= 0.99 * clocks_hz[c] / 8 / 1e6);
+            }
+
+            TEST_CHECK(memcmp(buffer, flash_sim.memory, sizeof(buffer)) == 0);
+            memset(buffer, 0, sizeof(buffer));
+        }
+    }
+
+    TEST_CHECK(spim_frequency_set(FLASH, 8000000));
+    TEST_CHECK(flash_sim.stats.errors == 0);
+}
+
+/**
+ * @brief Times writing 64k with one Flash.write() call, against 256 byte
+ *        calls the way Python code written for the old page API does it. The
+ *        256 byte calls are timed from the start of a page, and part way in,
+ *        where each call straddles two pages.
+ */
+static void bench_writes(void)
+{
+    static const struct
+    {
+        const char *name;
+        uint32_t address;
+        size_t chunk;
+    } runs[] = {
+        {"one call", 0x10000, 65536},
+        {"page calls", 0x10000, 256},
+        {"one call", 0x10064, 65536},
+        {"page calls", 0x10064, 256},
+    };
+    static uint8_t data[65536];
+    uint64_t flash_ns[MP_ARRAY_SIZE(runs)];
+
+    for (size_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = (uint8_t)(i * 13 + 1);
+    }
+
+    for (size_t r = 0; r < MP_ARRAY_SIZE(runs); r++)
+    {
+        flash_power_on();
+        machine_flash_wake();
+
+        uint64_t start_ns = test_time_ns;
+        double start_seconds = test_seconds();
+
+        for (size_t offset = 0; offset < sizeof(data); offset += runs[r].chunk)
+        {
+            mp_obj_t address = MP_OBJ_NEW_SMALL_INT(runs[r].address + offset);
+            machine_flash_write(address, mp_obj_new_bytes(data + offset, runs[r].chunk));
+        }
+
+        machine_flash_wait_ready();
+        flash_ns[r] = test_time_ns - start_ns;
+
+        printf("flash: writes, %-10s at 0x%05lx %7.1f kB/s on the flash, %8.1f us on the host\n",
+               runs[r].name, (unsigned long)runs[r].address,
+               sizeof(data) / (flash_ns[r] / 1e6), (test_seconds() - start_seconds) * 1e6);
+
+        TEST_CHECK(memcmp(flash_sim.memory + runs[r].address, data, sizeof(data)) == 0);
+        TEST_CHECK(flash_sim.stats.errors == 0);
+    }
+
+    // A single call is never slower, and programs each page once however the
+    // data lines up
+    TEST_CHECK(flash_ns[0] <= flash_ns[1]);
+    TEST_CHECK(flash_ns[2] <= flash_ns[3]);
+    TEST_CHECK(flash_ns[2] < flash_ns[0] + 2 * FLASH_SIM_PROGRAM_NS);
+}
+
+int main(void)
+{
+    test_block_device_bounds();
+    test_read_during_erase();
+    test_suspend_spacing_across_wrap();
+    test_read_write_addresses();
+    test_reset_during_erase();
+    test_reset_during_suspend();
+    test_idle_while_fpga_configures();
+    test_erase_range_bounds();
+    test_erase_range_coverage();
+    bench_reads();
+    bench_writes();
+    bench_erases();
+
+    return test_result("flash");
+}
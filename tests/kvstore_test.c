@@ -0,0 +1,564 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 Raj Nakarja - Silicon Witchery AB
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "machine_flash.c"
+#include "machine_kvstore.c"
+#include "flash_sim.h"
+#include "test.h"
+
+/**
+ * @brief Keys used by the tests, and the size of their values.
+ */
+#define TEST_KEYS (10)
+#define TEST_VALUE_LEN (40)
+
+/**
+ * @brief Resets the nRF, which puts the flash driver back as it is at boot,
+ *        and forgets the store, so that the next one is mounted from scratch.
+ */
+static void nrf_reset(void)
+{
+    memset(&flash_power, 0, sizeof(flash_power));
+    flash_power.asleep = true;
+    flash_power.idle_timeout_ms = 50;
+    memset(&flash_op, 0, sizeof(flash_op));
+    test_fpga_configuring = false;
+
+    // Anything which was running when the power went is gone
+    nlr_top = NULL;
+    MP_STATE_PORT(kvstore) = MP_OBJ_NULL;
+}
+
+/**
+ * @brief Mounts the store, as machine.KVStore().
+ */
+static machine_kvstore_obj_t *kv_new(void)
+{
+    return MP_OBJ_TO_PTR(machine_kvstore_make_new(&machine_kvstore_type, 0, 0, NULL));
+}
+
+/**
+ * @brief Starts over with an erased flash, and a freshly mounted store.
+ */
+static machine_kvstore_obj_t *kv_power_on(void)
+{
+    flash_sim_reset();
+    nrf_reset();
+
+    return kv_new();
+}
+
+static mp_obj_t key_obj(size_t key)
+{
+    char name[8];
+    snprintf(name, sizeof(name), "key%u", (unsigned)key);
+
+    return mp_obj_new_bytes((const byte *)name, strlen(name));
+}
+
+/**
+ * @brief Each version of a value has its own contents, so that a value which
+ *        is torn, or from the wrong version, doesn't match.
+ */
+static mp_obj_t value_obj(size_t key, int version, size_t len)
+{
+    uint8_t value[KV_MAX_VALUE_LEN];
+
+    for (size_t i = 0; i < len; i++)
+    {
+        value[i] = (uint8_t)(key * 131 + version * 7 + i);
+    }
+
+    return mp_obj_new_bytes(value, len);
+}
+
+static void kv_set(machine_kvstore_obj_t *self, size_t key, int version)
+{
+    machine_kvstore_subscr(MP_OBJ_FROM_PTR(self), key_obj(key),
+                           value_obj(key, version, TEST_VALUE_LEN));
+}
+
+static void kv_delete(machine_kvstore_obj_t *self, size_t key)
+{
+    machine_kvstore_subscr(MP_OBJ_FROM_PTR(self), key_obj(key), MP_OBJ_NULL);
+}
+
+static bool bytes_equal(mp_obj_t a, mp_obj_t b)
+{
+    mp_buffer_info_t a_info;
+    mp_buffer_info_t b_info;
+    mp_get_buffer_raise(a, &a_info, MP_BUFFER_READ);
+    mp_get_buffer_raise(b, &b_info, MP_BUFFER_READ);
+
+    return a_info.len == b_info.len && memcmp(a_info.buf, b_info.buf, a_info.len) == 0;
+}
+
+/**
+ * @brief Returns true if the store holds exactly the versions given, where a
+ *        negative version means the key is missing.
+ */
+static bool kv_holds(machine_kvstore_obj_t *self, const int *versions)
+{
+    size_t count = 0;
+
+    for (size_t key = 0; key < TEST_KEYS; key++)
+    {
+        mp_obj_t value = kv_get(self, key_obj(key));
+
+        if (versions[key] < 0)
+        {
+            if (value != MP_OBJ_NULL)
+            {
+                return false;
+            }
+
+            continue;
+        }
+
+        if (value == MP_OBJ_NULL ||
+            !bytes_equal(value, value_obj(key, versions[key], TEST_VALUE_LEN)))
+        {
+            return false;
+        }
+
+        count++;
+    }
+
+    return self->count == count;
+}
+
+/**
+ * @brief Keys and values are kept across a remount, and deleted keys stay
+ *        deleted.
+ */
+static void test_remount(void)
+{
+    machine_kvstore_obj_t *kv = kv_power_on();
+    int versions[TEST_KEYS];
+
+    for (size_t key = 0; key < TEST_KEYS; key++)
+    {
+        kv_set(kv, key, 1);
+        versions[key] = 1;
+    }
+
+    kv_set(kv, 3, 2);
+    versions[3] = 2;
+    kv_delete(kv, 5);
+    versions[5] = -1;
+
+    TEST_CHECK(kv_holds(kv, versions));
+    TEST_CHECK(test_raised(kv_delete(kv, 5)) == &mp_type_KeyError);
+
+    nrf_reset();
+    kv = kv_new();
+
+    TEST_CHECK(kv_holds(kv, versions));
+    TEST_CHECK(flash_sim.stats.errors == 0);
+}
+
+/**
+ * @brief Sectors are freed in the background after writes, one at a time, so
+ *        that writes never run out of reserved sectors or erase more than one
+ *        sector each.
+ */
+static void test_background_compaction(void)
+{
+    machine_kvstore_obj_t *kv = kv_power_on();
+
+    for (int version = 0; version < 2000; version++)
+    {
+        uint32_t erases = flash_sim.stats.erases;
+
+        kv_set(kv, version % TEST_KEYS, version);
+
+        TEST_CHECK(flash_sim.stats.erases - erases <= 1);
+        TEST_CHECK(kv_free_sectors(kv) >= KV_COMPACT_SECTORS - 1);
+    }
+
+    TEST_CHECK(kv->count == TEST_KEYS);
+    TEST_CHECK(flash_sim.stats.errors == 0);
+}
+
+/**
+ * @brief Every key can hold the biggest value, and compaction always finds room
+ *        to move them however the sectors end up fragmented.
+ */
+static void test_full(void)
+{
+    machine_kvstore_obj_t *kv = kv_power_on();
+    mp_obj_t value = value_obj(0, 0, KV_MAX_VALUE_LEN);
+    mp_obj_t keys[KV_INDEX_SIZE];
+    size_t count = 0;
+
+    for (; count < KV_INDEX_SIZE; count++)
+    {
+        char name[KV_MAX_KEY_LEN];
+        memset(name, 'a', sizeof(name));
+        memcpy(name, &count, sizeof(count));
+
+        keys[count] = mp_obj_new_bytes((const byte *)name, sizeof(name));
+
+        if (test_raised(machine_kvstore_subscr(MP_OBJ_FROM_PTR(kv), keys[count], value)) != NULL)
+        {
+            break;
+        }
+    }
+
+    // Only the index runs out, as the live data always fits
+    TEST_CHECK(count > KV_INDEX_SIZE / 2);
+    TEST_CHECK(kv->live_bytes + KV_MAX_RECORD_SIZE <=
+               (KV_SECTOR_COUNT - KV_RESERVED_SECTORS) *
+                   (KV_SECTOR_SIZE - sizeof(kv_sector_header_t) - KV_MAX_RECORD_SIZE));
+
+    // Rewriting keys goes round every sector a few times
+    for (size_t i = 0; i < 3 * KV_SECTOR_COUNT * 3; i++)
+    {
+        mp_obj_t key = keys[i % count];
+
+        TEST_CHECK(test_raised(machine_kvstore_subscr(MP_OBJ_FROM_PTR(kv), key, MP_OBJ_NULL)) == NULL);
+        TEST_CHECK(test_raised(machine_kvstore_subscr(MP_OBJ_FROM_PTR(kv), key, value)) == NULL);
+    }
+
+    nrf_reset();
+    kv = kv_new();
+
+    TEST_CHECK(kv->count == count);
+    TEST_CHECK(flash_sim.stats.errors == 0);
+}
+
+/**
+ * @brief Writes and deletions which run into a compaction, and the versions
+ *        of every key after each of them.
+ */
+static const struct
+{
+    size_t key;
+    int version;
+} torn_ops[] = {
+    {1, 10},
+    {2, -1},
+    {9, 10},
+    {8, 10},
+    {8, 11},
+    {0, 10},
+    {9, -1},
+    {8, 12},
+};
+
+static int torn_versions[MP_ARRAY_SIZE(torn_ops) + 1][TEST_KEYS];
+
+/**
+ * @brief The op being run when the power was cut.
+ */
+static size_t torn_op;
+
+static void run_torn_ops(machine_kvstore_obj_t *kv, size_t from)
+{
+    for (torn_op = from; torn_op < MP_ARRAY_SIZE(torn_ops); torn_op++)
+    {
+        if (torn_ops[torn_op].version < 0)
+        {
+            kv_delete(kv, torn_ops[torn_op].key);
+        }
+        else
+        {
+            kv_set(kv, torn_ops[torn_op].key, torn_ops[torn_op].version);
+        }
+    }
+}
+
+/**
+ * @brief Cuts the power after every byte programmed by a run of writes, which
+ *        includes a compaction. Each time, the store has to mount again with
+ *        every key either before or after the write which was cut short, and
+ *        keep working after.
+ */
+static void test_torn_writes(void)
+{
+    static uint8_t snapshot[MACHINE_FLASH_KV_SIZE];
+    static machine_kvstore_obj_t mounted;
+    const uint32_t size = kv_record_size(&(kv_record_header_t){.key_len = 4,
+                                                               .value_len = TEST_VALUE_LEN});
+    machine_kvstore_obj_t *kv = kv_power_on();
+
+    // Fill up the store until the next few writes need a compaction, which
+    // has live records to move
+    for (size_t key = 0; key < TEST_KEYS - 1; key++)
+    {
+        kv_set(kv, key, 0);
+        torn_versions[0][key] = 0;
+    }
+
+    torn_versions[0][TEST_KEYS - 1] = -1;
+
+    for (int version = 1;
+         kv_free_sectors(kv) > KV_COMPACT_SECTORS || kv->head_offset + 2 * size <= KV_SECTOR_SIZE;
+         version++)
+    {
+        kv_set(kv, 8, version);
+        torn_versions[0][8] = version;
+    }
+
+    for (size_t op = 0; op < MP_ARRAY_SIZE(torn_ops); op++)
+    {
+        memcpy(torn_versions[op + 1], torn_versions[op], sizeof(torn_versions[op]));
+        torn_versions[op + 1][torn_ops[op].key] = torn_ops[op].version;
+    }
+
+    machine_flash_wait_ready();
+    memcpy(snapshot, &flash_sim.memory[MACHINE_FLASH_KV_START], sizeof(snapshot));
+    mounted = *kv;
+
+    // Run them once without a power cut, to count the bytes programmed
+    uint64_t programmed = flash_sim.stats.bytes_programmed;
+    uint32_t erases = flash_sim.stats.erases;
+
+    run_torn_ops(kv, 0);
+
+    uint64_t total = flash_sim.stats.bytes_programmed - programmed;
+
+    TEST_CHECK(flash_sim.stats.erases > erases);
+    TEST_CHECK(kv_holds(kv, torn_versions[MP_ARRAY_SIZE(torn_ops)]));
+
+    for (uint64_t cut = 0; cut < total; cut++)
+    {
+        jmp_buf power_cut;
+
+        flash_sim_power_cycle();
+        memcpy(&flash_sim.memory[MACHINE_FLASH_KV_START], snapshot, sizeof(snapshot));
+        nrf_reset();
+
+        // Start from the store as it was, without mounting it again
+        *kv = mounted;
+        MP_STATE_PORT(kvstore) = MP_OBJ_FROM_PTR(kv);
+
+        if (setjmp(power_cut) == 0)
+        {
+            flash_sim_cut_power_after(cut, &power_cut);
+            run_torn_ops(kv, 0);
+        }
+
+        TEST_CHECK(flash_sim.power_cut == NULL);
+
+        nrf_reset();
+        kv = kv_new();
+
+        // A torn sector header mustn't be taken for the newest sector
+        TEST_CHECK(kv->next_sequence <= mounted.next_sequence + MP_ARRAY_SIZE(torn_ops));
+
+        size_t done = torn_op;
+
+        if (kv_holds(kv, torn_versions[torn_op + 1]))
+        {
+            done++;
+        }
+        else if (!kv_holds(kv, torn_versions[torn_op]))
+        {
+            printf("kvstore: wrong keys after a power cut %u bytes into %u\n",
+                   (unsigned)cut, (unsigned)total);
+            test_failures++;
+            continue;
+        }
+
+        // The rest of the writes still work, and last
+        run_torn_ops(kv, done);
+        nrf_reset();
+        kv = kv_new();
+
+        TEST_CHECK(kv_holds(kv, torn_versions[MP_ARRAY_SIZE(torn_ops)]));
+    }
+
+    TEST_CHECK(flash_sim.stats.errors == 0);
+}
+
+/**
+ * @brief Cuts the power part way through the erase which frees the oldest
+ *        sector after a compaction. The sector holds old values, and a key
+ *        which was deleted since, so it has to be treated as free at mount
+ *        however much of it was erased. Neither the old values nor the
+ *        deleted key may come back.
+ */
+static void test_compaction_erase_cut(void)
+{
+    static uint8_t snapshot[MACHINE_FLASH_KV_SIZE];
+    machine_kvstore_obj_t *kv = kv_power_on();
+    int versions[TEST_KEYS];
+
+    for (size_t key = 0; key < TEST_KEYS; key++)
+    {
+        kv_set(kv, key, 0);
+        versions[key] = 0;
+    }
+
+    // Write until the first compaction starts to erase the oldest sector,
+    // deleting a key once its old value is no longer in the head sector
+    uint16_t oldest = kv->head;
+    int version = 1;
+
+    while (flash_sim.stats.erases == 0)
+    {
+        if (kv->head != oldest && versions[9] >= 0)
+        {
+            kv_delete(kv, 9);
+            versions[9] = -1;
+            continue;
+        }
+
+        kv_set(kv, version % 9, version);
+        versions[version % 9] = version;
+        version++;
+    }
+
+    TEST_CHECK(flash_sim.op.kind == FLASH_SIM_ERASING);
+    TEST_CHECK(flash_sim.op.address == kv_address(oldest, 0));
+    TEST_CHECK(kv_holds(kv, versions));
+
+    memcpy(snapshot, &flash_sim.memory[MACHINE_FLASH_KV_START], sizeof(snapshot));
+    uint64_t start_ns = test_time_ns;
+    uint64_t duration_ns = flash_sim.op.duration_ns;
+
+    // Most cuts are early on, where the sector still reads much as it did
+    for (int cut = 0; cut < 400; cut++)
+    {
+        memcpy(&flash_sim.memory[MACHINE_FLASH_KV_START], snapshot, sizeof(snapshot));
+        test_time_ns = start_ns;
+        flash_sim.op.kind = FLASH_SIM_ERASING;
+        flash_sim.op.address = kv_address(oldest, 0);
+        flash_sim.op.size = KV_SECTOR_SIZE;
+        flash_sim.op.duration_ns = duration_ns;
+        flash_sim.op.end_ns = start_ns + duration_ns;
+        flash_sim.suspended = false;
+
+        uint64_t cut_ns = cut < 300 ? duration_ns * (cut % 30) / 1000
+                                    : duration_ns * (cut - 300) / 100;
+        test_time_ns += cut_ns;
+        flash_sim_power_cycle();
+
+        nrf_reset();
+        kv = kv_new();
+
+        if (!kv_holds(kv, versions))
+        {
+            printf("kvstore: wrong keys after a power cut %.1f%% into an erase\n",
+                   cut_ns * 100.0 / duration_ns);
+            test_failures++;
+            continue;
+        }
+
+        // Writes after the mount last too
+        int expected[TEST_KEYS];
+        memcpy(expected, versions, sizeof(expected));
+        kv_set(kv, 0, version);
+        expected[0] = version;
+
+        nrf_reset();
+        kv = kv_new();
+
+        TEST_CHECK(kv_holds(kv, expected));
+    }
+
+    // Go round the ring until the head reaches the sector again, which has to
+    // be erased properly before it's reused
+    versions[0] = version++;
+
+    while (kv->head != oldest)
+    {
+        kv_set(kv, version % 9, version);
+        versions[version % 9] = version;
+        version++;
+    }
+
+    nrf_reset();
+    kv = kv_new();
+
+    TEST_CHECK(kv->head == oldest);
+    TEST_CHECK(kv_holds(kv, versions));
+    TEST_CHECK(flash_sim.stats.errors == 0);
+}
+
+/**
+ * @brief Reports how many writes and reads a second the store manages, both
+ *        on the simulated flash and on the host.
+ */
+static void bench_ops(void)
+{
+    const int writes = 5000;
+    const int reads = 5000;
+    machine_kvstore_obj_t *kv = kv_power_on();
+
+    uint64_t start_ns = test_time_ns;
+    double start_seconds = test_seconds();
+
+    for (int version = 0; version < writes; version++)
+    {
+        kv_set(kv, version % TEST_KEYS, version);
+    }
+
+    machine_flash_wait_ready();
+
+    printf("kvstore: %-12s %9.1f ops/s on the flash, %11.1f ops/s on the host\n",
+           "writes", writes / ((test_time_ns - start_ns) / 1e9),
+           writes / (test_seconds() - start_seconds));
+
+    start_ns = test_time_ns;
+    start_seconds = test_seconds();
+
+    for (int i = 0; i < reads; i++)
+    {
+        TEST_CHECK(kv_get(kv, key_obj(i % TEST_KEYS)) != MP_OBJ_NULL);
+    }
+
+    printf("kvstore: %-12s %9.1f ops/s on the flash, %11.1f ops/s on the host\n",
+           "reads", reads / ((test_time_ns - start_ns) / 1e9),
+           reads / (test_seconds() - start_seconds));
+
+    start_ns = test_time_ns;
+    start_seconds = test_seconds();
+
+    nrf_reset();
+    kv = kv_new();
+
+    printf("kvstore: %-12s %9.1f ms on the flash, %11.1f ms on the host\n",
+           "mount", (test_time_ns - start_ns) / 1e6,
+           (test_seconds() - start_seconds) * 1e3);
+
+    TEST_CHECK(kv->count == TEST_KEYS);
+    TEST_CHECK(flash_sim.stats.errors == 0);
+}
+
+int main(void)
+{
+    test_remount();
+    test_background_compaction();
+    test_full();
+    test_torn_writes();
+    test_compaction_erase_cut();
+    bench_ops();
+
+    return test_result("kvstore");
+}
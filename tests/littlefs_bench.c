@@ -0,0 +1,252 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 Raj Nakarja - Silicon Witchery AB
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "machine_flash.c"
+#include "flash_sim.h"
+#include "lfs2.h"
+#include "test.h"
+
+/**
+ * @brief The filesystem is set up as VfsLfs2 does on the device, with its
+ *        default read, program and lookahead sizes.
+ */
+#define LFS_READ_SIZE (32)
+#define LFS_PROG_SIZE (32)
+#define LFS_LOOKAHEAD_SIZE (32)
+#define LFS_CACHE_SIZE (4 * MAX(LFS_READ_SIZE, LFS_PROG_SIZE))
+
+static uint32_t read_buffer[LFS_CACHE_SIZE / 4];
+static uint32_t prog_buffer[LFS_CACHE_SIZE / 4];
+static uint32_t lookahead_buffer[LFS_LOOKAHEAD_SIZE / 4];
+static uint32_t file_buffer[LFS_CACHE_SIZE / 4];
+
+/**
+ * @brief The block device calls go through the Flash object, as they do from
+ *        VfsLfs2 with the extended block device protocol.
+ */
+static int bench_read(const struct lfs2_config *c, lfs2_block_t block,
+                      lfs2_off_t off, void *buffer, lfs2_size_t size)
+{
+    mp_obj_t args[] = {
+        c->context,
+        MP_OBJ_NEW_SMALL_INT(block),
+        mp_obj_new_bytearray_by_ref(size, buffer),
+        MP_OBJ_NEW_SMALL_INT(off),
+    };
+    machine_flash_readblocks(4, args);
+
+    return 0;
+}
+
+static int bench_prog(const struct lfs2_config *c, lfs2_block_t block,
+                      lfs2_off_t off, const void *buffer, lfs2_size_t size)
+{
+    mp_obj_t args[] = {
+        c->context,
+        MP_OBJ_NEW_SMALL_INT(block),
+        mp_obj_new_bytearray_by_ref(size, (void *)buffer),
+        MP_OBJ_NEW_SMALL_INT(off),
+    };
+    machine_flash_writeblocks(4, args);
+
+    return 0;
+}
+
+static int bench_erase(const struct lfs2_config *c, lfs2_block_t block)
+{
+    machine_flash_ioctl(c->context, MP_OBJ_NEW_SMALL_INT(MP_BLOCKDEV_IOCTL_BLOCK_ERASE),
+                        MP_OBJ_NEW_SMALL_INT(block));
+
+    return 0;
+}
+
+static int bench_sync(const struct lfs2_config *c)
+{
+    machine_flash_ioctl(c->context, MP_OBJ_NEW_SMALL_INT(MP_BLOCKDEV_IOCTL_SYNC),
+                        mp_const_none);
+
+    return 0;
+}
+
+/**
+ * @brief Time taken by one part of the benchmark, both on the simulated flash
+ *        and on the host.
+ */
+typedef struct
+{
+    uint64_t start_ns;
+    double start_seconds;
+} bench_timer_t;
+
+static bench_timer_t bench_start(void)
+{
+    return (bench_timer_t){test_time_ns, test_seconds()};
+}
+
+static void bench_report(bench_timer_t timer, const char *what, double amount, const char *unit)
+{
+    double device = (test_time_ns - timer.start_ns) / 1e9;
+    double host = test_seconds() - timer.start_seconds;
+
+    printf("littlefs: %-28s %9.1f %s/s on the flash, %11.1f %s/s on the host\n",
+           what, amount / device, unit, amount / host, unit);
+}
+
+static uint8_t pattern(size_t position)
+{
+    return (uint8_t)(position * 7 + (position >> 11));
+}
+
+int main(void)
+{
+    const size_t file_size = 256 * 1024;
+    const size_t chunk_size = 512;
+    const size_t small_files = 200;
+
+    flash_sim_reset();
+    flash_power.asleep = true;
+
+    mp_obj_t region[] = {
+        MP_OBJ_NEW_SMALL_INT(MACHINE_FLASH_FS_START),
+        MP_OBJ_NEW_SMALL_INT(MACHINE_FLASH_FS_SIZE),
+    };
+
+    const struct lfs2_config config = {
+        .context = machine_flash_make_new(&machine_flash_type, 2, 0, region),
+        .read = bench_read,
+        .prog = bench_prog,
+        .erase = bench_erase,
+        .sync = bench_sync,
+        .read_size = LFS_READ_SIZE,
+        .prog_size = LFS_PROG_SIZE,
+        .block_size = MACHINE_FLASH_BLOCK_SIZE,
+        .block_count = MACHINE_FLASH_FS_SIZE / MACHINE_FLASH_BLOCK_SIZE,
+        .block_cycles = 100,
+        .cache_size = LFS_CACHE_SIZE,
+        .lookahead_size = LFS_LOOKAHEAD_SIZE,
+        .read_buffer = read_buffer,
+        .prog_buffer = prog_buffer,
+        .lookahead_buffer = lookahead_buffer,
+    };
+
+    const struct lfs2_file_config file_config = {
+        .buffer = file_buffer,
+    };
+
+    static lfs2_t lfs;
+    static lfs2_file_t file;
+    static uint8_t chunk[512];
+
+    // Format and mount
+    bench_timer_t timer = bench_start();
+
+    TEST_CHECK(lfs2_format(&lfs, &config) == 0);
+    TEST_CHECK(lfs2_mount(&lfs, &config) == 0);
+
+    bench_report(timer, "format and mount", 1, "mounts");
+
+    // Write one large file in chunks, as a logger or download would
+    timer = bench_start();
+
+    TEST_CHECK(lfs2_file_opencfg(&lfs, &file, "large", LFS2_O_WRONLY | LFS2_O_CREAT,
+                                 &file_config) == 0);
+
+    for (size_t written = 0; written < file_size; written += chunk_size)
+    {
+        for (size_t i = 0; i < chunk_size; i++)
+        {
+            chunk[i] = pattern(written + i);
+        }
+
+        TEST_CHECK(lfs2_file_write(&lfs, &file, chunk, chunk_size) == (lfs2_ssize_t)chunk_size);
+    }
+
+    TEST_CHECK(lfs2_file_close(&lfs, &file) == 0);
+
+    bench_report(timer, "write 256KB in 512B chunks", file_size / 1024.0, "KB");
+
+    // Read it back
+    timer = bench_start();
+
+    TEST_CHECK(lfs2_file_opencfg(&lfs, &file, "large", LFS2_O_RDONLY, &file_config) == 0);
+
+    for (size_t read = 0; read < file_size; read += chunk_size)
+    {
+        TEST_CHECK(lfs2_file_read(&lfs, &file, chunk, chunk_size) == (lfs2_ssize_t)chunk_size);
+
+        for (size_t i = 0; i < chunk_size; i++)
+        {
+            TEST_CHECK(chunk[i] == pattern(read + i));
+        }
+    }
+
+    TEST_CHECK(lfs2_file_close(&lfs, &file) == 0);
+
+    bench_report(timer, "read 256KB in 512B chunks", file_size / 1024.0, "KB");
+
+    // Create and remove many small files, as settings or state would be
+    timer = bench_start();
+
+    for (size_t i = 0; i < small_files; i++)
+    {
+        char name[16];
+        snprintf(name, sizeof(name), "small%u", (unsigned)i);
+
+        TEST_CHECK(lfs2_file_opencfg(&lfs, &file, name,
+                                     LFS2_O_WRONLY | LFS2_O_CREAT | LFS2_O_TRUNC,
+                                     &file_config) == 0);
+        TEST_CHECK(lfs2_file_write(&lfs, &file, chunk, 64) == 64);
+        TEST_CHECK(lfs2_file_close(&lfs, &file) == 0);
+    }
+
+    bench_report(timer, "create 64B files", small_files, "files");
+
+    timer = bench_start();
+
+    for (size_t i = 0; i < small_files; i++)
+    {
+        char name[16];
+        snprintf(name, sizeof(name), "small%u", (unsigned)i);
+
+        TEST_CHECK(lfs2_remove(&lfs, name) == 0);
+    }
+
+    bench_report(timer, "remove 64B files", small_files, "files");
+
+    // Everything survives a remount
+    TEST_CHECK(lfs2_unmount(&lfs) == 0);
+    TEST_CHECK(lfs2_mount(&lfs, &config) == 0);
+    TEST_CHECK(lfs2_file_opencfg(&lfs, &file, "large", LFS2_O_RDONLY, &file_config) == 0);
+    TEST_CHECK(lfs2_file_read(&lfs, &file, chunk, chunk_size) == (lfs2_ssize_t)chunk_size);
+    TEST_CHECK(chunk[chunk_size - 1] == pattern(chunk_size - 1));
+    TEST_CHECK(lfs2_file_close(&lfs, &file) == 0);
+    TEST_CHECK(lfs2_unmount(&lfs) == 0);
+
+    TEST_CHECK(flash_sim.stats.errors == 0);
+
+    return test_result("littlefs");
+}
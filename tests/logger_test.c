@@ -0,0 +1,417 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 Raj Nakarja - Silicon Witchery AB
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "machine_flash.c"
+#include "machine_logger.c"
+#include "flash_sim.h"
+#include "test.h"
+
+/**
+ * @brief Size of the records logged by the tests. Most of their bytes change
+ *        each time, so a page holds about 16 of them.
+ */
+#define TEST_RECORD_SIZE (16)
+
+/**
+ * @brief Records which are read back with the wrong contents.
+ */
+#define TEST_CORRUPT (UINT32_MAX)
+
+/**
+ * @brief Resets the nRF, which puts the flash driver back as it is at boot,
+ *        and forgets the logger, so that the next one is mounted from scratch.
+ */
+static void nrf_reset(void)
+{
+    memset(&flash_power, 0, sizeof(flash_power));
+    flash_power.asleep = true;
+    flash_power.idle_timeout_ms = 50;
+    memset(&flash_op, 0, sizeof(flash_op));
+    test_fpga_configuring = false;
+
+    // Anything which was running when the power went is gone
+    nlr_top = NULL;
+    MP_STATE_PORT(logger) = MP_OBJ_NULL;
+}
+
+/**
+ * @brief Mounts the logger, as machine.Logger(TEST_RECORD_SIZE).
+ */
+static machine_logger_obj_t *logger_new(void)
+{
+    mp_obj_t args[] = {MP_OBJ_NEW_SMALL_INT(TEST_RECORD_SIZE)};
+
+    return MP_OBJ_TO_PTR(machine_logger_make_new(&machine_logger_type, 1, 0, args));
+}
+
+/**
+ * @brief Starts over with an erased flash, and a freshly mounted logger.
+ */
+static machine_logger_obj_t *logger_power_on(void)
+{
+    flash_sim_reset();
+    nrf_reset();
+
+    return logger_new();
+}
+
+/**
+ * @brief Each record holds its index, followed by bytes made from it, so that
+ *        a record which decodes wrongly doesn't match.
+ */
+static void make_record(uint32_t index, uint8_t *record)
+{
+    memcpy(record, &index, sizeof(index));
+
+    for (size_t i = sizeof(index); i < TEST_RECORD_SIZE; i++)
+    {
+        record[i] = (uint8_t)(index * 7 + i * 31);
+    }
+}
+
+static void free_bytes(mp_obj_t bytes)
+{
+    free(((mp_obj_array_t *)MP_OBJ_TO_PTR(bytes))->items);
+    free(MP_OBJ_TO_PTR(bytes));
+}
+
+static void append(machine_logger_obj_t *logger, uint32_t index)
+{
+    uint8_t record[TEST_RECORD_SIZE];
+    make_record(index, record);
+
+    mp_obj_t bytes = mp_obj_new_bytes(record, sizeof(record));
+    machine_logger_append(MP_OBJ_FROM_PTR(logger), bytes);
+    free_bytes(bytes);
+}
+
+/**
+ * @brief Iterates over the logger, giving the index of each record, or
+ *        TEST_CORRUPT for one which doesn't hold what it should.
+ * @returns The number of records.
+ */
+static size_t read_all(machine_logger_obj_t *logger, uint32_t *indexes, size_t max)
+{
+    mp_obj_t iter = machine_logger_getiter(MP_OBJ_FROM_PTR(logger), NULL);
+    size_t count = 0;
+
+    for (mp_obj_t item; (item = machine_logger_iternext(iter)) != MP_OBJ_STOP_ITERATION;)
+    {
+        mp_obj_array_t *bytes = MP_OBJ_TO_PTR(item);
+        uint8_t expected[TEST_RECORD_SIZE];
+        uint32_t index;
+
+        memcpy(&index, bytes->items, sizeof(index));
+        make_record(index, expected);
+
+        if (count < max)
+        {
+            indexes[count] = bytes->len == TEST_RECORD_SIZE &&
+                                     memcmp(bytes->items, expected, TEST_RECORD_SIZE) == 0
+                                 ? index
+                                 : TEST_CORRUPT;
+        }
+
+        count++;
+        free_bytes(item);
+    }
+
+    free(MP_OBJ_TO_PTR(iter));
+
+    return count;
+}
+
+/**
+ * @brief Returns true if the records read back are numbered from first on.
+ */
+static bool numbered(const uint32_t *indexes, size_t count, uint32_t first)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (indexes[i] != first + i)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Records are kept across a remount, including the ones which were
+ *        still buffered when flush() was called.
+ */
+static void test_remount(void)
+{
+    static uint32_t indexes[1000];
+    machine_logger_obj_t *logger = logger_power_on();
+
+    for (uint32_t i = 0; i < MP_ARRAY_SIZE(indexes); i++)
+    {
+        append(logger, i);
+    }
+
+    machine_logger_flush(MP_OBJ_FROM_PTR(logger));
+
+    nrf_reset();
+    logger = logger_new();
+
+    TEST_CHECK(read_all(logger, indexes, MP_ARRAY_SIZE(indexes)) == MP_ARRAY_SIZE(indexes));
+    TEST_CHECK(numbered(indexes, MP_ARRAY_SIZE(indexes), 0));
+    TEST_CHECK(flash_sim.stats.errors == 0);
+}
+
+/**
+ * @brief A page whose header was damaged after it was written is skipped as a
+ *        whole, rather than giving the wrong number of records.
+ */
+static void test_damaged_header(void)
+{
+    uint32_t indexes[64];
+    machine_logger_obj_t *logger = logger_power_on();
+
+    // The second page ends up with 13 records, so losing a bit leaves some
+    for (uint32_t i = 0; i < 40; i++)
+    {
+        append(logger, i);
+
+        if (i == 28 || i == 39)
+        {
+            machine_logger_flush(MP_OBJ_FROM_PTR(logger));
+        }
+    }
+
+    // Bits can only be cleared, as if the page was written over
+    log_page_header_t *first = (log_page_header_t *)&flash_sim.memory[log_page_address(0)];
+    log_page_header_t *second = (log_page_header_t *)&flash_sim.memory[log_page_address(1)];
+    uint8_t first_of_second = first->count;
+    uint8_t count = second->count;
+    uint16_t length = second->length;
+
+    TEST_CHECK(count == 13);
+
+    second->count &= count - 1;
+
+    nrf_reset();
+    logger = logger_new();
+
+    size_t read = read_all(logger, indexes, MP_ARRAY_SIZE(indexes));
+
+    TEST_CHECK(read == 40 - count);
+    TEST_CHECK(numbered(indexes, first_of_second, 0));
+    TEST_CHECK(numbered(&indexes[first_of_second], read - first_of_second, first_of_second + count));
+
+    // The same goes for the length
+    second->count = count;
+    second->length &= length - 1;
+
+    nrf_reset();
+    logger = logger_new();
+
+    TEST_CHECK(read_all(logger, indexes, MP_ARRAY_SIZE(indexes)) == 40 - count);
+    TEST_CHECK(flash_sim.stats.errors == 0);
+}
+
+/**
+ * @brief A page torn so early that not even its sequence number made it reads
+ *        back as neither blank nor written. It's skipped, rather than written
+ *        over.
+ */
+static void test_torn_sequence(void)
+{
+    uint32_t indexes[128];
+    machine_logger_obj_t *logger = logger_power_on();
+
+    for (uint32_t i = 0; i < 40; i++)
+    {
+        append(logger, i);
+    }
+
+    machine_logger_flush(MP_OBJ_FROM_PTR(logger));
+
+    uint32_t next = logger->next_sequence;
+    memset(&flash_sim.memory[log_page_address(next)], 0x00, sizeof(uint32_t));
+
+    nrf_reset();
+    logger = logger_new();
+
+    TEST_CHECK(logger->next_sequence == next + 1);
+
+    for (uint32_t i = 0; i < 40; i++)
+    {
+        append(logger, 1000 + i);
+    }
+
+    machine_logger_flush(MP_OBJ_FROM_PTR(logger));
+    nrf_reset();
+    logger = logger_new();
+
+    TEST_CHECK(read_all(logger, indexes, MP_ARRAY_SIZE(indexes)) == 80);
+    TEST_CHECK(numbered(indexes, 40, 0));
+    TEST_CHECK(numbered(&indexes[40], 40, 1000));
+    TEST_CHECK(flash_sim.stats.errors == 0);
+}
+
+/**
+ * @brief Records known to be on the flash, as the pages holding them have been
+ *        written, when the power was cut.
+ */
+static uint32_t torn_written;
+
+/**
+ * @brief Logs enough records to go into the second sector, keeping track of
+ *        which ones have made it to the flash.
+ */
+static void log_torn_records(machine_logger_obj_t *logger)
+{
+    torn_written = 0;
+
+    for (uint32_t i = 0; i < 300; i++)
+    {
+        append(logger, i);
+        torn_written = i + 1 - logger->page.header.count;
+    }
+
+    machine_logger_flush(MP_OBJ_FROM_PTR(logger));
+    torn_written = 300;
+}
+
+/**
+ * @brief Cuts the power after every byte programmed while logging, including
+ *        the first page of a new sector. Each time, the logger has to mount
+ *        again with every record which was written, in order, plus at most the
+ *        page which was torn. Records logged after that have to last too,
+ *        rather than being written over the torn page.
+ */
+static void test_torn_pages(void)
+{
+    static uint32_t indexes[512];
+    machine_logger_obj_t *logger = logger_power_on();
+
+    // Run once without a power cut, to count the bytes programmed
+    log_torn_records(logger);
+
+    uint64_t total = flash_sim.stats.bytes_programmed;
+
+    TEST_CHECK(logger->next_sequence > LOG_PAGES_PER_SECTOR);
+
+    for (uint64_t cut = 0; cut < total; cut++)
+    {
+        jmp_buf power_cut;
+
+        flash_sim_power_cycle();
+        memset(&flash_sim.memory[MACHINE_FLASH_LOG_START], 0xFF, 4 * LOG_SECTOR_SIZE);
+        nrf_reset();
+        logger = logger_new();
+
+        if (setjmp(power_cut) == 0)
+        {
+            flash_sim_cut_power_after(cut, &power_cut);
+            log_torn_records(logger);
+        }
+
+        TEST_CHECK(flash_sim.power_cut == NULL);
+
+        nrf_reset();
+        logger = logger_new();
+
+        size_t read = read_all(logger, indexes, MP_ARRAY_SIZE(indexes));
+
+        if (read < torn_written || read > torn_written + LOG_PAGE_DATA_SIZE ||
+            !numbered(indexes, read, 0))
+        {
+            printf("logger: wrong records after a power cut %u bytes into %u\n",
+                   (unsigned)cut, (unsigned)total);
+            test_failures++;
+            continue;
+        }
+
+        // Logging carries on after the records which survived
+        for (uint32_t i = 0; i < 50; i++)
+        {
+            append(logger, 1000 + i);
+        }
+
+        machine_logger_flush(MP_OBJ_FROM_PTR(logger));
+        nrf_reset();
+        logger = logger_new();
+
+        TEST_CHECK(read_all(logger, indexes, MP_ARRAY_SIZE(indexes)) == read + 50);
+        TEST_CHECK(numbered(indexes, read, 0));
+        TEST_CHECK(numbered(&indexes[read], 50, 1000));
+    }
+
+    TEST_CHECK(flash_sim.stats.errors == 0);
+}
+
+/**
+ * @brief Reports how many records a second can be logged and read back, both
+ *        on the simulated flash and on the host.
+ */
+static void bench_records(void)
+{
+    const uint32_t records = 100000;
+    machine_logger_obj_t *logger = logger_power_on();
+
+    uint64_t start_ns = test_time_ns;
+    double start_seconds = test_seconds();
+
+    for (uint32_t i = 0; i < records; i++)
+    {
+        append(logger, i);
+    }
+
+    machine_logger_flush(MP_OBJ_FROM_PTR(logger));
+    machine_flash_wait_ready();
+
+    printf("logger: %-12s %11.1f records/s on the flash, %11.1f records/s on the host\n",
+           "appends", records / ((test_time_ns - start_ns) / 1e9),
+           records / (test_seconds() - start_seconds));
+
+    start_ns = test_time_ns;
+    start_seconds = test_seconds();
+
+    size_t read = read_all(logger, NULL, 0);
+
+    printf("logger: %-12s %11.1f records/s on the flash, %11.1f records/s on the host\n",
+           "reads", read / ((test_time_ns - start_ns) / 1e9),
+           read / (test_seconds() - start_seconds));
+
+    TEST_CHECK(read > 0 && read <= records);
+    TEST_CHECK(flash_sim.stats.errors == 0);
+}
+
+int main(void)
+{
+    test_remount();
+    test_damaged_header();
+    test_torn_sequence();
+    test_torn_pages();
+    bench_records();
+
+    return test_result("logger");
+}
@@ -0,0 +1,269 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 Raj Nakarja - Silicon Witchery AB
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include "ring_buffer.h"
+#include "test.h"
+
+/**
+ * @brief Storage for the ring under test.
+ */
+static uint8_t storage[256];
+
+/**
+ * @brief Fills a buffer with a counting pattern starting from a given value.
+ */
+static void pattern(uint8_t *data, size_t len, uint32_t start)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        data[i] = (uint8_t)((start + i) * 7);
+    }
+}
+
+/**
+ * @brief An empty ring reports all of its space as free.
+ */
+static void test_empty(void)
+{
+    ring_buffer_t ring = RING_BUFFER_INIT(storage);
+    uint8_t data[8];
+
+    TEST_CHECK(ring_buffer_used(&ring) == 0);
+    TEST_CHECK(ring_buffer_free(&ring) == sizeof(storage));
+    TEST_CHECK(ring_buffer_read(&ring, data, sizeof(data)) == 0);
+    TEST_CHECK(ring_buffer_peek(&ring, data, sizeof(data)) == 0);
+}
+
+/**
+ * @brief The whole of the storage is usable, and writes beyond it are clipped.
+ */
+static void test_full(void)
+{
+    ring_buffer_t ring = RING_BUFFER_INIT(storage);
+    uint8_t in[300];
+    uint8_t out[300];
+
+    pattern(in, sizeof(in), 0);
+
+    TEST_CHECK(ring_buffer_write(&ring, in, sizeof(in)) == sizeof(storage));
+    TEST_CHECK(ring_buffer_used(&ring) == sizeof(storage));
+    TEST_CHECK(ring_buffer_free(&ring) == 0);
+    TEST_CHECK(ring_buffer_write(&ring, in, 1) == 0);
+
+    TEST_CHECK(ring_buffer_read(&ring, out, sizeof(out)) == sizeof(storage));
+    TEST_CHECK(memcmp(in, out, sizeof(storage)) == 0);
+    TEST_CHECK(ring_buffer_used(&ring) == 0);
+}
+
+/**
+ * @brief Peeking leaves the data in place until it's consumed.
+ */
+static void test_peek_consume(void)
+{
+    ring_buffer_t ring = RING_BUFFER_INIT(storage);
+    uint8_t in[100];
+    uint8_t out[100];
+
+    pattern(in, sizeof(in), 3);
+    ring_buffer_write(&ring, in, sizeof(in));
+
+    TEST_CHECK(ring_buffer_peek(&ring, out, 40) == 40);
+    TEST_CHECK(ring_buffer_peek(&ring, out, 40) == 40);
+    TEST_CHECK(memcmp(in, out, 40) == 0);
+    TEST_CHECK(ring_buffer_used(&ring) == sizeof(in));
+
+    ring_buffer_consume(&ring, 40);
+
+    TEST_CHECK(ring_buffer_used(&ring) == 60);
+    TEST_CHECK(ring_buffer_read(&ring, out, sizeof(out)) == 60);
+    TEST_CHECK(memcmp(in + 40, out, 60) == 0);
+}
+
+/**
+ * @brief Data split across the end of the storage comes back in order, over
+ *        enough traffic for the free running indices to wrap many times.
+ */
+static void test_wrap(void)
+{
+    ring_buffer_t ring = RING_BUFFER_INIT(storage);
+    uint8_t in[200];
+    uint8_t out[200];
+    uint32_t written = 0;
+    uint32_t read = 0;
+
+    for (int i = 0; i < 100000; i++)
+    {
+        size_t len = 1 + (i * 37) % sizeof(in);
+
+        pattern(in, len, written);
+        size_t done = ring_buffer_write(&ring, in, len);
+        TEST_CHECK(done == len || done == ring.mask + 1 - (written - read));
+        written += done;
+
+        len = 1 + (i * 53) % sizeof(out);
+        size_t got = ring_buffer_read(&ring, out, len);
+
+        uint8_t expected[200];
+        pattern(expected, got, read);
+        TEST_CHECK(memcmp(expected, out, got) == 0);
+        read += got;
+
+        TEST_CHECK(ring_buffer_used(&ring) == written - read);
+    }
+
+    TEST_CHECK(written > 0x10000 * 4);
+}
+
+/**
+ * @brief Arguments for the producer thread.
+ */
+typedef struct
+{
+    ring_buffer_t *ring;
+    uint32_t total;
+} stream_t;
+
+/**
+ * @brief Producer which writes a counting stream in varying chunk sizes.
+ */
+static void *producer(void *arg)
+{
+    stream_t *stream = arg;
+    uint8_t chunk[97];
+    uint32_t sent = 0;
+
+    while (sent < stream->total)
+    {
+        size_t len = 1 + sent % sizeof(chunk);
+
+        if (len > stream->total - sent)
+        {
+            len = stream->total - sent;
+        }
+
+        for (size_t i = 0; i < len; i++)
+        {
+            chunk[i] = (uint8_t)(sent + i);
+        }
+
+        size_t done = 0;
+
+        // Let the consumer run while the ring is full
+        while (done < len)
+        {
+            done += ring_buffer_write(stream->ring, chunk + done, len - done);
+            sched_yield();
+        }
+
+        sent += len;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief A producer and consumer on separate threads never see a torn or out
+ *        of order byte, which checks the acquire and release ordering.
+ */
+static void test_threads(void)
+{
+    ring_buffer_t ring = RING_BUFFER_INIT(storage);
+    stream_t stream = {.ring = &ring, .total = 2000000};
+    pthread_t thread;
+    uint8_t out[61];
+    uint32_t received = 0;
+    uint32_t errors = 0;
+
+    pthread_create(&thread, NULL, producer, &stream);
+
+    while (received < stream.total)
+    {
+        size_t got = ring_buffer_read(&ring, out, sizeof(out));
+
+        if (got == 0)
+        {
+            sched_yield();
+        }
+
+        for (size_t i = 0; i < got; i++)
+        {
+            errors += out[i] != (uint8_t)(received + i);
+        }
+
+        received += got;
+    }
+
+    pthread_join(thread, NULL);
+
+    TEST_CHECK(errors == 0);
+    TEST_CHECK(ring_buffer_used(&ring) == 0);
+}
+
+/**
+ * @brief Measures write then read throughput for a few chunk sizes, such as a
+ *        single character, a BLE notification and a full raw paste window.
+ */
+static void benchmark(void)
+{
+    static const size_t sizes[] = {1, 16, 244, 512};
+    static uint8_t big[1024];
+    static uint8_t data[512];
+    ring_buffer_t ring = RING_BUFFER_INIT(big);
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        size_t len = sizes[i];
+        size_t total = 0;
+        double start = test_seconds();
+
+        for (int chunk = 0; chunk < 5000000; chunk++)
+        {
+            ring_buffer_write(&ring, data, len);
+            total += ring_buffer_read(&ring, data, len);
+        }
+
+        double elapsed = test_seconds() - start;
+
+        printf("ring_buffer: %3zu byte chunks, %7.1f MB/s, %5.1f ns per chunk\n",
+               len, total / elapsed / 1e6, elapsed * 1e9 / 5000000);
+    }
+}
+
+int main(void)
+{
+    test_empty();
+    test_full();
+    test_peek_consume();
+    test_wrap();
+    test_threads();
+    benchmark();
+
+    return test_result("ring_buffer");
+}
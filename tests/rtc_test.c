@@ -0,0 +1,474 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 Raj Nakarja - Silicon Witchery AB
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "machine_rtc.c"
+#include "test.h"
+
+/**
+ * @brief Simulated RTC1. The counter is the low 24 bits of the simulated time
+ *        in ticks. Compare events are latched when the counter reaches them,
+ *        and their interrupt runs after a random latency, as it would when
+ *        held off by other interrupts.
+ */
+static struct
+{
+    uint64_t now;
+    uint32_t max_latency;
+    nrfx_rtc_handler_t handler;
+    struct
+    {
+        bool enabled;
+        bool pending;
+        uint32_t value;
+    } cc[4];
+} sim;
+
+nrfx_err_t nrfx_rtc_init(const nrfx_rtc_t *rtc, const nrfx_rtc_config_t *config,
+                         nrfx_rtc_handler_t handler)
+{
+    sim.handler = handler;
+    return 0;
+}
+
+void nrfx_rtc_enable(const nrfx_rtc_t *rtc)
+{
+}
+
+void nrfx_rtc_counter_clear(const nrfx_rtc_t *rtc)
+{
+    sim.now = 0;
+}
+
+uint32_t nrfx_rtc_counter_get(const nrfx_rtc_t *rtc)
+{
+    return sim.now & RTC_COUNTER_MASK;
+}
+
+nrfx_err_t nrfx_rtc_cc_set(const nrfx_rtc_t *rtc, uint32_t channel, uint32_t val, bool enable_irq)
+{
+    sim.cc[channel].enabled = enable_irq;
+    sim.cc[channel].pending = false;
+    sim.cc[channel].value = val & RTC_COUNTER_MASK;
+    return 0;
+}
+
+nrfx_err_t nrfx_rtc_cc_disable(const nrfx_rtc_t *rtc, uint32_t channel)
+{
+    sim.cc[channel].enabled = false;
+    sim.cc[channel].pending = false;
+    return 0;
+}
+
+CoreDebug_Type test_core_debug;
+DWT_Type test_dwt;
+
+/**
+ * @brief Returns when a compare channel next matches the counter.
+ */
+static uint64_t sim_next_match(uint32_t channel)
+{
+    uint64_t delta = (sim.cc[channel].value - sim.now) & RTC_COUNTER_MASK;
+
+    return sim.now + (delta ? delta : RTC_COUNTER_MASK + 1);
+}
+
+/**
+ * @brief Returns when the next compare event happens, or UINT64_MAX if none
+ *        are enabled.
+ */
+static uint64_t sim_next_event(void)
+{
+    uint64_t next = UINT64_MAX;
+
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        if (sim.cc[i].enabled && sim_next_match(i) < next)
+        {
+            next = sim_next_match(i);
+        }
+    }
+
+    return next;
+}
+
+/**
+ * @brief Checks the tick count against the simulated time. Called while
+ *        events are latched but not yet handled too, which is when the
+ *        counter extension is most likely to slip.
+ */
+static uint64_t probes;
+
+static void probe(void)
+{
+    probes++;
+
+    TEST_CHECK(machine_rtc_ticks() == sim.now);
+    TEST_CHECK(mp_hal_ticks_ms() == (mp_uint_t)(sim.now * 1000 / MACHINE_RTC_FREQUENCY));
+    TEST_CHECK(mp_hal_ticks_us() == (mp_uint_t)(sim.now * 1000000 / MACHINE_RTC_FREQUENCY));
+}
+
+/**
+ * @brief Runs the simulation up to a time, handling interrupts on the way.
+ */
+static void sim_run_until(uint64_t target)
+{
+    while (true)
+    {
+        // Handle latched events, one interrupt at a time
+        bool handled = false;
+
+        for (uint32_t i = 0; i < 4 && !handled; i++)
+        {
+            if (sim.cc[i].enabled && sim.cc[i].pending)
+            {
+                probe();
+                sim.cc[i].pending = false;
+                sim.handler(NRFX_RTC_INT_COMPARE0 + i);
+                handled = true;
+            }
+        }
+
+        if (handled)
+        {
+            continue;
+        }
+
+        uint64_t next = sim_next_event();
+
+        if (next > target)
+        {
+            sim.now = target;
+            return;
+        }
+
+        // The interrupt runs some time after the event. Any other events in
+        // between are latched too
+        uint64_t run = next + (sim.max_latency ? rand() % (sim.max_latency + 1) : 0);
+
+        for (uint32_t i = 0; i < 4; i++)
+        {
+            if (sim.cc[i].enabled && sim_next_match(i) <= run)
+            {
+                sim.cc[i].pending = true;
+            }
+        }
+
+        sim.now = run;
+    }
+}
+
+/**
+ * @brief Waiting for an event runs the simulation until the next interrupt.
+ */
+uint32_t sd_app_evt_wait(void)
+{
+    uint64_t next = sim_next_event();
+
+    if (next == UINT64_MAX)
+    {
+        printf("sd_app_evt_wait() would never return\n");
+        abort();
+    }
+
+    sim_run_until(next);
+
+    return 0;
+}
+
+uint32_t sd_power_mode_set(uint8_t power_mode)
+{
+    return 0;
+}
+
+void ble_send_pending_data(void)
+{
+}
+
+void machine_timer_irq_handler(uint32_t timer)
+{
+}
+
+/**
+ * @brief Starts over from power on, with the simulated time at zero.
+ */
+static void rtc_power_on(uint32_t max_latency)
+{
+    memset(&sim, 0, sizeof(sim));
+    half_periods = 0;
+    epoch_offset = 0;
+    memset(deadlines, 0, sizeof(deadlines));
+    memset(timeouts, 0, sizeof(timeouts));
+
+    sim.max_latency = max_latency;
+    machine_rtc_init();
+}
+
+/**
+ * @brief Sets RTC.time() as it would be from Python.
+ */
+static void rtc_time_set(int64_t time)
+{
+    mp_obj_t arg = mp_obj_new_int_from_ll(time);
+    machine_rtc_time(1, &arg);
+}
+
+/**
+ * @brief Returns RTC.time() as it would be to Python.
+ */
+static int64_t rtc_time(void)
+{
+    return mp_obj_get_ll(machine_rtc_time(0, NULL));
+}
+
+/**
+ * @brief The tick count, ticks_ms(), ticks_us() and RTC.time() track the
+ *        simulated time exactly over several days, with interrupts held off
+ *        by up to 100ms at a time. Any drift or lost ticks would show up here.
+ */
+static void test_no_drift(void)
+{
+    const uint64_t days = 3;
+    const int64_t epoch = 1700000000;
+    uint64_t end = days * 86400 * MACHINE_RTC_FREQUENCY;
+
+    rtc_power_on(MACHINE_RTC_FREQUENCY / 10);
+    rtc_time_set(epoch);
+
+    while (sim.now < end)
+    {
+        // Mostly short steps, with the odd one of several seconds
+        uint64_t step = 1 + (rand() % 8 == 0 ? rand() % (1 << 20) : rand() % 4096);
+
+        sim_run_until(MIN(sim.now + step, end));
+        probe();
+
+        TEST_CHECK(rtc_time() == epoch + (int64_t)(sim.now / MACHINE_RTC_FREQUENCY));
+    }
+
+    TEST_CHECK(mp_hal_ticks_ms() == days * 86400 * 1000);
+    TEST_CHECK(mp_hal_time_ns() == (uint64_t)(epoch + days * 86400) * 1000000000ULL);
+    TEST_CHECK(rtc_time() == epoch + (int64_t)(days * 86400));
+
+    printf("rtc: %llu ticks over %llu days with %llu checks, no drift\n",
+           (unsigned long long)sim.now, (unsigned long long)days,
+           (unsigned long long)probes);
+}
+
+/**
+ * @brief Times before the epoch still round down to whole seconds.
+ */
+static void test_negative_time(void)
+{
+    rtc_power_on(0);
+
+    rtc_time_set(-1);
+    TEST_CHECK(rtc_time() == -1);
+
+    sim_run_until(sim.now + MACHINE_RTC_FREQUENCY / 2);
+    TEST_CHECK(rtc_time() == -1);
+
+    sim_run_until(sim.now + MACHINE_RTC_FREQUENCY / 2);
+    TEST_CHECK(rtc_time() == 0);
+
+    rtc_time_set(-100000);
+    sim_run_until(sim.now + 1);
+    TEST_CHECK(rtc_time() == -100000);
+}
+
+/**
+ * @brief Port timeouts fire once their deadline is reached, including ones
+ *        beyond the reach of the 24 bit counter.
+ */
+static uint64_t timeout_fired;
+
+static void timeout_handler(void)
+{
+    timeout_fired = sim.now;
+}
+
+static void test_timeouts(void)
+{
+    static const uint32_t timeouts_ms[] = {1, 10, 1000, 600000};
+
+    rtc_power_on(50);
+
+    for (size_t i = 0; i < MP_ARRAY_SIZE(timeouts_ms); i++)
+    {
+        uint64_t start = sim.now;
+        uint64_t deadline = start + machine_rtc_ms_to_ticks(timeouts_ms[i]);
+
+        timeout_fired = 0;
+        machine_rtc_timeout_start(MACHINE_RTC_TIMEOUT_TX_FLUSH, timeouts_ms[i], timeout_handler);
+        sim_run_until(deadline + 2 * MACHINE_RTC_FREQUENCY);
+
+        TEST_CHECK(timeout_fired >= deadline);
+        TEST_CHECK(timeout_fired <= deadline + MACHINE_RTC_MIN_DELTA + sim.max_latency);
+    }
+}
+
+/**
+ * @brief sleep_ms() lasts at least as long as asked, and not much longer.
+ */
+static void test_sleep(void)
+{
+    static const uint32_t sleeps_ms[] = {1, 20, 1500, 700000};
+
+    rtc_power_on(50);
+
+    for (size_t i = 0; i < MP_ARRAY_SIZE(sleeps_ms); i++)
+    {
+        uint64_t start = sim.now;
+        uint64_t deadline = start + machine_rtc_ms_to_ticks(sleeps_ms[i]);
+
+        mp_hal_delay_ms(sleeps_ms[i]);
+
+        TEST_CHECK(sim.now >= deadline);
+        TEST_CHECK(sim.now <= deadline + MACHINE_RTC_MIN_DELTA + sim.max_latency);
+    }
+}
+
+/**
+ * @brief A callback run while sleeping sleeps itself, as a scheduled Python
+ *        callback could. Neither sleep may end early, or overrun.
+ */
+static uint32_t nested_sleep_ms;
+static uint64_t nested_end;
+
+static void nested_sleep(void)
+{
+    // Only the first callback sleeps, or this would recurse forever
+    mp_handle_pending_hook = NULL;
+
+    uint64_t deadline = sim.now + machine_rtc_ms_to_ticks(nested_sleep_ms);
+
+    mp_hal_delay_ms(nested_sleep_ms);
+    nested_end = sim.now;
+
+    TEST_CHECK(nested_end >= deadline);
+}
+
+static void test_nested_sleep(void)
+{
+    static const struct
+    {
+        uint32_t outer_ms;
+        uint32_t inner_ms;
+    } sleeps[] = {{1000, 50}, {20, 100}, {600000, 599000}};
+
+    rtc_power_on(50);
+
+    for (size_t i = 0; i < MP_ARRAY_SIZE(sleeps); i++)
+    {
+        uint64_t deadline = sim.now + machine_rtc_ms_to_ticks(sleeps[i].outer_ms);
+
+        nested_sleep_ms = sleeps[i].inner_ms;
+        nested_end = 0;
+        mp_handle_pending_hook = nested_sleep;
+
+        mp_hal_delay_ms(sleeps[i].outer_ms);
+
+        TEST_CHECK(nested_end != 0);
+        TEST_CHECK(sim.now >= deadline);
+
+        // An inner sleep which outlasts the outer one only delays it until
+        // the inner sleep ends
+        uint64_t latest = MAX(deadline, nested_end) + MACHINE_RTC_MIN_DELTA + sim.max_latency;
+        TEST_CHECK(sim.now <= latest);
+    }
+}
+
+/**
+ * @brief lightsleep() returns at least the time asked for. Ctrl-C, pressed
+ *        from an interrupt part way through, raises the KeyboardInterrupt
+ *        straight away instead of being left pending after a return.
+ */
+static void press_ctrl_c(void)
+{
+    MP_STATE_THREAD(mp_pending_exception) = mp_obj_new_exception_arg1(&mp_type_KeyboardInterrupt, mp_const_none);
+}
+
+static void test_lightsleep_interrupt(void)
+{
+    rtc_power_on(50);
+
+    TEST_CHECK(machine_rtc_lightsleep(250) >= 250);
+
+    uint64_t start = sim.now;
+    machine_rtc_timeout_start(MACHINE_RTC_TIMEOUT_TX_FLUSH, 100, press_ctrl_c);
+
+    TEST_CHECK(test_raised(machine_rtc_lightsleep(5000)) == &mp_type_KeyboardInterrupt);
+    TEST_CHECK(MP_STATE_THREAD(mp_pending_exception) == MP_OBJ_NULL);
+
+    // The sleep ended with the interrupt, not at its deadline
+    uint64_t slept = sim.now - start;
+    TEST_CHECK(slept >= machine_rtc_ms_to_ticks(100));
+    TEST_CHECK(slept <= machine_rtc_ms_to_ticks(100) + MACHINE_RTC_MIN_DELTA + sim.max_latency);
+}
+
+/**
+ * @brief Polls the way select.poll() does, with the hook in a loop which
+ *        checks ticks_ms() against the timeout. Each poll has to end in the
+ *        millisecond its timeout expires, rather than sleeping on past it.
+ */
+static void test_poll_wait(void)
+{
+    static const mp_uint_t timeouts_ms[] = {0, 1, 2, 7, 100, 1000, 5000};
+
+    rtc_power_on(0);
+
+    for (size_t i = 0; i < MP_ARRAY_SIZE(timeouts_ms); i++)
+    {
+        mp_uint_t timeout = timeouts_ms[i];
+        mp_uint_t start_tick = mp_hal_ticks_ms();
+        mp_uint_t wakes = 0;
+
+        while (mp_hal_ticks_ms() - start_tick < timeout)
+        {
+            mp_hal_poll_wait();
+            wakes++;
+        }
+
+        TEST_CHECK(mp_hal_ticks_ms() - start_tick == timeout);
+        TEST_CHECK(wakes <= timeout);
+
+        // Start the next poll part way through a millisecond
+        sim_run_until(sim.now + 13);
+    }
+}
+
+int main(void)
+{
+    test_no_drift();
+    test_negative_time();
+    test_timeouts();
+    test_sleep();
+    test_nested_sleep();
+    test_lightsleep_interrupt();
+    test_poll_wait();
+
+    return test_result("rtc");
+}
@@ -0,0 +1,40 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 Raj Nakarja - Silicon Witchery AB
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef __MICROPY_INCLUDED_S1MOD_TEST_STUBS_EXTMOD_VFS_H__
+#define __MICROPY_INCLUDED_S1MOD_TEST_STUBS_EXTMOD_VFS_H__
+
+// Block device ioctl numbers, as used by the filesystems
+
+#define MP_BLOCKDEV_IOCTL_INIT (1)
+#define MP_BLOCKDEV_IOCTL_DEINIT (2)
+#define MP_BLOCKDEV_IOCTL_SYNC (3)
+#define MP_BLOCKDEV_IOCTL_BLOCK_COUNT (4)
+#define MP_BLOCKDEV_IOCTL_BLOCK_SIZE (5)
+#define MP_BLOCKDEV_IOCTL_BLOCK_ERASE (6)
+
+#endif
@@ -0,0 +1,570 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 Raj Nakarja - Silicon Witchery AB
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "py/runtime.h"
+#include "py/mphal.h"
+#include "flash_sim.h"
+#include "main.h"
+#include "nrfx_glue.h"
+
+flash_sim_t flash_sim;
+
+/**
+ * @brief The SPI clock of each device, which sets how long transfers take.
+ */
+static uint32_t spim_hz[] = {8000000, 8000000};
+
+/**
+ * @brief The command being decoded while the chip select is held.
+ */
+static struct
+{
+    size_t index;
+    uint8_t opcode;
+    uint32_t address;
+    bool ignored;
+    uint8_t data[MACHINE_FLASH_PAGE_SIZE];
+    size_t data_len;
+} command;
+
+static void sim_error(const char *what)
+{
+    if (flash_sim.stats.errors++ < 10)
+    {
+        printf("flash_sim: %s at %llu us\n", what,
+               (unsigned long long)(test_time_ns / 1000));
+    }
+}
+
+/**
+ * @brief Completes the operation in progress, once its time is up.
+ */
+static void sim_update(void)
+{
+    if (flash_sim.op.kind == FLASH_SIM_IDLE || flash_sim.suspended ||
+        test_time_ns < flash_sim.op.end_ns)
+    {
+        return;
+    }
+
+    if (flash_sim.op.kind == FLASH_SIM_ERASING)
+    {
+        memset(&flash_sim.memory[flash_sim.op.address], 0xFF, flash_sim.op.size);
+    }
+
+    flash_sim.op.kind = FLASH_SIM_IDLE;
+}
+
+bool flash_sim_busy(void)
+{
+    sim_update();
+
+    // A suspended operation reads as busy until the suspend takes effect
+    if (flash_sim.suspended)
+    {
+        return test_time_ns < flash_sim.suspended_ns + FLASH_SIM_SUSPEND_NS;
+    }
+
+    return flash_sim.op.kind != FLASH_SIM_IDLE;
+}
+
+static void sim_op_start(flash_sim_op_t kind, uint32_t address, uint32_t size, uint64_t ns)
+{
+    flash_sim.op.kind = kind;
+    flash_sim.op.address = address;
+    flash_sim.op.size = size;
+    flash_sim.op.duration_ns = ns;
+    flash_sim.op.end_ns = test_time_ns + ns;
+    flash_sim.write_enabled = false;
+}
+
+/**
+ * @brief Programs one byte, cutting the power first if its time has come.
+ */
+static void sim_program_byte(uint32_t address, uint8_t value)
+{
+    if (flash_sim.power_cut && flash_sim.power_cut_bytes-- == 0)
+    {
+        jmp_buf *at = flash_sim.power_cut;
+
+        // Only some of the bits of the last byte make it
+        flash_sim.memory[address] &= value | 0x5A;
+
+        flash_sim.power_cut = NULL;
+        flash_sim_power_cycle();
+        command.index = 0;
+        longjmp(*at, 1);
+    }
+
+    // Programming can only clear bits
+    flash_sim.memory[address] &= value;
+    flash_sim.stats.bytes_programmed++;
+}
+
+/**
+ * @brief Acts on a command once the chip select is released.
+ */
+static void sim_command_end(void)
+{
+    if (command.ignored || command.index == 0)
+    {
+        return;
+    }
+
+    bool busy = flash_sim_busy();
+
+    switch (command.opcode)
+    {
+    case 0x06:
+        if (busy)
+        {
+            sim_error("write enable while busy");
+        }
+        flash_sim.write_enabled = true;
+        break;
+
+    case 0x04:
+        flash_sim.write_enabled = false;
+        break;
+
+    case 0x02:
+        if (busy || flash_sim.op.kind != FLASH_SIM_IDLE || !flash_sim.write_enabled)
+        {
+            sim_error("page program while busy or not write enabled");
+            break;
+        }
+
+        // Data wraps around within the page
+        for (size_t i = 0; i < command.data_len; i++)
+        {
+            uint32_t page = command.address & ~(MACHINE_FLASH_PAGE_SIZE - 1);
+            uint32_t offset = (command.address + i) & (MACHINE_FLASH_PAGE_SIZE - 1);
+            sim_program_byte(page + offset, command.data[i]);
+        }
+
+        flash_sim.stats.programs++;
+        sim_op_start(FLASH_SIM_PROGRAMMING, command.address, 0, FLASH_SIM_PROGRAM_NS);
+        break;
+
+    case 0x20:
+    case 0x52:
+    case 0xD8:
+    case 0x60:
+    case 0xC7:
+    {
+        if (busy || flash_sim.op.kind != FLASH_SIM_IDLE || !flash_sim.write_enabled)
+        {
+            sim_error("erase while busy or not write enabled");
+            break;
+        }
+
+        uint32_t size = MACHINE_FLASH_SIZE;
+        uint64_t ns = FLASH_SIM_ERASE_CHIP_NS;
+
+        if (command.opcode == 0x20)
+        {
+            size = 0x1000;
+            ns = FLASH_SIM_ERASE_4K_NS;
+        }
+        else if (command.opcode == 0x52)
+        {
+            size = 0x8000;
+            ns = FLASH_SIM_ERASE_32K_NS;
+        }
+        else if (command.opcode == 0xD8)
+        {
+            size = 0x10000;
+            ns = FLASH_SIM_ERASE_64K_NS;
+        }
+
+        flash_sim.stats.erases++;
+        sim_op_start(FLASH_SIM_ERASING, command.address & ~(size - 1), size, ns);
+        break;
+    }
+
+    case 0x75:
+        if (flash_sim.op.kind != FLASH_SIM_ERASING || flash_sim.suspended)
+        {
+            break;
+        }
+
+        if (flash_sim.stats.resumes &&
+            test_time_ns < flash_sim.resumed_ns + FLASH_SIM_SUSPEND_NS)
+        {
+            sim_error("suspend too soon after resume");
+        }
+
+        flash_sim.suspended = true;
+        flash_sim.suspended_ns = test_time_ns;
+        flash_sim.op.remaining_ns = flash_sim.op.end_ns - test_time_ns;
+        flash_sim.stats.suspends++;
+        break;
+
+    case 0x7A:
+        if (!flash_sim.suspended)
+        {
+            break;
+        }
+
+        flash_sim.suspended = false;
+        flash_sim.resumed_ns = test_time_ns;
+        flash_sim.op.end_ns = test_time_ns + flash_sim.op.remaining_ns;
+        flash_sim.stats.resumes++;
+        break;
+
+    case 0xB9:
+        if (busy)
+        {
+            sim_error("deep sleep while busy");
+            break;
+        }
+        flash_sim.asleep = true;
+        flash_sim.stats.sleeps++;
+        break;
+
+    case 0xAB:
+        // Ignored while busy, as the flash can't be asleep then
+        if (busy)
+        {
+            break;
+        }
+        flash_sim.asleep = false;
+        flash_sim.ready_ns = test_time_ns + FLASH_SIM_WAKE_NS;
+        flash_sim.stats.wakes++;
+        break;
+
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Clocks one byte through the chip, returning what it sends back.
+ */
+static uint8_t sim_byte(uint8_t mosi)
+{
+    size_t index = command.index++;
+
+    if (index == 0)
+    {
+        command.opcode = mosi;
+        command.address = 0;
+        command.data_len = 0;
+        command.ignored = false;
+
+        sim_update();
+
+        if (flash_sim.asleep && mosi != 0xAB)
+        {
+            sim_error("command while in deep sleep");
+            command.ignored = true;
+        }
+        else if (test_time_ns < flash_sim.ready_ns)
+        {
+            sim_error("command before waking up");
+            command.ignored = true;
+        }
+        else if (flash_sim_busy() && mosi != 0x05 && mosi != 0x35 &&
+                 mosi != 0x75 && mosi != 0x7A && mosi != 0x06 && mosi != 0xAB)
+        {
+            sim_error("command while busy");
+            command.ignored = true;
+        }
+
+        return 0xFF;
+    }
+
+    if (command.ignored)
+    {
+        return 0xFF;
+    }
+
+    switch (command.opcode)
+    {
+    case 0x05:
+        return (flash_sim_busy() ? 0x01 : 0) | (flash_sim.write_enabled ? 0x02 : 0);
+
+    case 0x35:
+        return flash_sim.suspended ? 0x80 : 0;
+
+    case 0x9F:
+        return index == 1 ? 0xEF : index == 2 ? 0x40 : 0x16;
+
+    case 0x03:
+    case 0x0B:
+    {
+        size_t header = command.opcode == 0x0B ? 5 : 4;
+
+        if (index < 4)
+        {
+            command.address = (command.address << 8) | mosi;
+        }
+
+        if (index < header)
+        {
+            return 0xFF;
+        }
+
+        uint32_t address = (command.address + index - header) % MACHINE_FLASH_SIZE;
+
+        if (flash_sim.suspended && address >= flash_sim.op.address &&
+            address < flash_sim.op.address + flash_sim.op.size)
+        {
+            sim_error("read from a block which is being erased");
+        }
+
+        flash_sim.stats.bytes_read++;
+        return flash_sim.memory[address];
+    }
+
+    case 0x02:
+    case 0x20:
+    case 0x52:
+    case 0xD8:
+        if (index < 4)
+        {
+            command.address = (command.address << 8) | mosi;
+        }
+        else if (command.opcode == 0x02 && command.data_len < sizeof(command.data))
+        {
+            command.data[command.data_len++] = mosi;
+        }
+        return 0xFF;
+
+    default:
+        return 0xFF;
+    }
+}
+
+/**
+ * @brief Clocks bytes through the chip, while the chip select is held.
+ */
+static void sim_xfer(spi_device_t device, const uint8_t *tx, size_t tx_len,
+                     uint8_t *rx, size_t rx_len)
+{
+    size_t len = tx_len > rx_len ? tx_len : rx_len;
+
+    test_time_ns += len * 8 * 1000000000ULL / spim_hz[device];
+
+    if (device != FLASH)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < len; i++)
+    {
+        uint8_t miso = sim_byte(i < tx_len ? tx[i] : 0xFF);
+
+        if (i < rx_len)
+        {
+            rx[i] = miso;
+        }
+    }
+}
+
+void spim_tx_rx(uint8_t *tx_buffer, size_t tx_len,
+                uint8_t *rx_buffer, size_t rx_len, spi_device_t device)
+{
+    flash_sim.stats.transfers++;
+
+    command.index = 0;
+    sim_xfer(device, tx_buffer, tx_len, rx_buffer, rx_len);
+
+    if (device == FLASH)
+    {
+        sim_command_end();
+    }
+}
+
+void spim_command(const uint8_t *command_buffer, size_t command_len,
+                  const uint8_t *tx_data, uint8_t *rx_data, size_t len,
+                  spi_device_t device)
+{
+    flash_sim.stats.transfers++;
+
+    command.index = 0;
+    sim_xfer(device, command_buffer, command_len, NULL, 0);
+    sim_xfer(device, tx_data, tx_data ? len : 0, rx_data, tx_data ? 0 : len);
+
+    if (device == FLASH)
+    {
+        sim_command_end();
+    }
+}
+
+uint32_t spim_frequency_get(spi_device_t device)
+{
+    return spim_hz[device];
+}
+
+bool spim_frequency_set(spi_device_t device, uint32_t hz)
+{
+    for (uint32_t supported = 125000; supported <= 8000000; supported *= 2)
+    {
+        if (hz == supported)
+        {
+            spim_hz[device] = hz;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void flash_sim_reset(void)
+{
+    memset(&flash_sim, 0, sizeof(flash_sim));
+    memset(flash_sim.memory, 0xFF, sizeof(flash_sim.memory));
+}
+
+void flash_sim_power_cycle(void)
+{
+    // An erase whose time is up has completed
+    sim_update();
+
+    // Bits of a half erased block may have been set, or not
+    if (flash_sim.op.kind == FLASH_SIM_ERASING)
+    {
+        uint64_t remaining_ns = flash_sim.suspended
+                                    ? flash_sim.op.remaining_ns
+                                    : flash_sim.op.end_ns - test_time_ns;
+        uint64_t done = (flash_sim.op.duration_ns - remaining_ns) * 1024 /
+                        flash_sim.op.duration_ns;
+
+        for (uint32_t i = 0; i < flash_sim.op.size; i++)
+        {
+            for (int bit = 0; bit < 8; bit++)
+            {
+                if ((uint64_t)(rand() % 1024) < done)
+                {
+                    flash_sim.memory[flash_sim.op.address + i] |= 1 << bit;
+                }
+            }
+        }
+    }
+
+    flash_sim.op.kind = FLASH_SIM_IDLE;
+    flash_sim.asleep = false;
+    flash_sim.write_enabled = false;
+    flash_sim.suspended = false;
+    flash_sim.ready_ns = 0;
+}
+
+void flash_sim_cut_power_after(uint64_t bytes, jmp_buf *at)
+{
+    flash_sim.power_cut = at;
+    flash_sim.power_cut_bytes = bytes;
+}
+
+// The parts of the RTC, FPGA and scheduler which the flash driver uses, with
+// the RTC running on the simulated time. Scheduled callbacks run as soon as
+// their timeout does
+
+static struct
+{
+    bool running;
+    uint64_t deadline_ns;
+    void (*handler)(void);
+} timeouts[MACHINE_RTC_TIMEOUT_COUNT];
+
+// The cycle counter is 32 bits, so it wraps around like the real one does
+mp_uint_t mp_hal_ticks_cpu(void)
+{
+    return (uint32_t)(test_time_ns * 64 / 1000);
+}
+
+bool test_fpga_configuring;
+
+bool machine_fpga_configuring(void)
+{
+    return test_fpga_configuring;
+}
+
+uint64_t machine_rtc_ticks(void)
+{
+    return test_time_ns * MACHINE_RTC_FREQUENCY / 1000000000ULL;
+}
+
+void machine_rtc_timeout_start(machine_rtc_timeout_t timeout,
+                               uint32_t timeout_ms,
+                               void (*handler)(void))
+{
+    timeouts[timeout].running = true;
+    timeouts[timeout].deadline_ns = test_time_ns + timeout_ms * 1000000ULL;
+    timeouts[timeout].handler = handler;
+}
+
+void machine_rtc_timeout_stop(machine_rtc_timeout_t timeout)
+{
+    timeouts[timeout].running = false;
+}
+
+void machine_irq_schedule(mp_obj_t function, mp_obj_t arg)
+{
+    mp_call_function_1(function, arg);
+}
+
+void flash_sim_idle(uint64_t ns)
+{
+    uint64_t end = test_time_ns + ns;
+
+    while (true)
+    {
+        // Run the timeout which expires first
+        machine_rtc_timeout_t next = MACHINE_RTC_TIMEOUT_COUNT;
+
+        for (size_t i = 0; i < MACHINE_RTC_TIMEOUT_COUNT; i++)
+        {
+            if (timeouts[i].running && timeouts[i].deadline_ns <= end &&
+                (next == MACHINE_RTC_TIMEOUT_COUNT ||
+                 timeouts[i].deadline_ns < timeouts[next].deadline_ns))
+            {
+                next = i;
+            }
+        }
+
+        if (next == MACHINE_RTC_TIMEOUT_COUNT)
+        {
+            break;
+        }
+
+        if (timeouts[next].deadline_ns > test_time_ns)
+        {
+            test_time_ns = timeouts[next].deadline_ns;
+        }
+
+        timeouts[next].running = false;
+        timeouts[next].handler();
+    }
+
+    if (end > test_time_ns)
+    {
+        test_time_ns = end;
+    }
+}
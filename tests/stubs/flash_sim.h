@@ -0,0 +1,136 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 Raj Nakarja - Silicon Witchery AB
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef __MICROPY_INCLUDED_S1MOD_TEST_STUBS_FLASH_SIM_H__
+#define __MICROPY_INCLUDED_S1MOD_TEST_STUBS_FLASH_SIM_H__
+
+// A simulated SPI flash, which stands in for the real chip behind spim_tx_rx()
+// and spim_command(). It decodes the same commands as the real chip, with its
+// typical timings, and counts anything which the real chip would ignore or
+// get wrong as an error. The simulated time only moves on with SPI transfers
+// and busy waits, or when a test calls flash_sim_idle()
+
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "modmachine.h"
+
+// Typical timings of the chip, in nanoseconds
+#define FLASH_SIM_PROGRAM_NS (400000ULL)
+#define FLASH_SIM_ERASE_4K_NS (45000000ULL)
+#define FLASH_SIM_ERASE_32K_NS (120000000ULL)
+#define FLASH_SIM_ERASE_64K_NS (150000000ULL)
+#define FLASH_SIM_ERASE_CHIP_NS (10000000000ULL)
+#define FLASH_SIM_SUSPEND_NS (20000ULL)
+#define FLASH_SIM_WAKE_NS (3000ULL)
+
+typedef enum
+{
+    FLASH_SIM_IDLE,
+    FLASH_SIM_PROGRAMMING,
+    FLASH_SIM_ERASING,
+} flash_sim_op_t;
+
+typedef struct
+{
+    uint8_t memory[MACHINE_FLASH_SIZE];
+
+    // State of the chip
+    bool asleep;
+    bool write_enabled;
+    bool suspended;
+    uint64_t ready_ns;
+    uint64_t suspended_ns;
+    uint64_t resumed_ns;
+
+    struct
+    {
+        flash_sim_op_t kind;
+        uint32_t address;
+        uint32_t size;
+        uint64_t duration_ns;
+        uint64_t end_ns;
+        uint64_t remaining_ns;
+    } op;
+
+    // What the driver has done so far
+    struct
+    {
+        uint64_t transfers;
+        uint64_t bytes_read;
+        uint64_t bytes_programmed;
+        uint32_t programs;
+        uint32_t erases;
+        uint32_t suspends;
+        uint32_t resumes;
+        uint32_t sleeps;
+        uint32_t wakes;
+        uint32_t errors;
+    } stats;
+
+    // Where to jump to when the power is cut, and how many more bytes can be
+    // programmed before then
+    jmp_buf *power_cut;
+    uint64_t power_cut_bytes;
+} flash_sim_t;
+
+extern flash_sim_t flash_sim;
+
+// Set by tests while the FPGA is meant to be loading its image
+extern bool test_fpga_configuring;
+
+/**
+ * @brief Starts over with a new chip, which is fully erased and awake.
+ */
+void flash_sim_reset(void);
+
+/**
+ * @brief Cuts the power to the chip and restores it. Any erase which was in
+ *        progress leaves its block half erased. Each bit of the block has been
+ *        set with a chance which grows as the erase goes on, so a block which
+ *        is cut off early still reads much as it did.
+ */
+void flash_sim_power_cycle(void);
+
+/**
+ * @brief Cuts the power once the number of bytes given have been programmed,
+ *        partly programming the next one, and then jumps to the buffer given.
+ */
+void flash_sim_cut_power_after(uint64_t bytes, jmp_buf *at);
+
+/**
+ * @brief Lets the simulated time move on, running the port timeouts which
+ *        expire on the way.
+ */
+void flash_sim_idle(uint64_t ns);
+
+/**
+ * @brief Returns true while an erase or program is in progress.
+ */
+bool flash_sim_busy(void);
+
+#endif
@@ -0,0 +1,97 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 Raj Nakarja - Silicon Witchery AB
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef __MICROPY_INCLUDED_S1MOD_TEST_STUBS_NRFX_RTC_H__
+#define __MICROPY_INCLUDED_S1MOD_TEST_STUBS_NRFX_RTC_H__
+
+// The RTC driver API, along with the few core peripherals which machine_rtc.c
+// touches. The driver itself is simulated by the test
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "nrfx_glue.h"
+
+typedef int nrfx_err_t;
+
+typedef struct
+{
+    uint8_t instance_id;
+} nrfx_rtc_t;
+
+#define NRFX_RTC_INSTANCE(id) {.instance_id = (id)}
+#define NRF_RTC_CC_CHANNEL_COUNT(id) (4)
+#define NRFX_RTC_DEFAULT_CONFIG_IRQ_PRIORITY (6)
+
+typedef enum
+{
+    NRFX_RTC_INT_COMPARE0,
+    NRFX_RTC_INT_COMPARE1,
+    NRFX_RTC_INT_COMPARE2,
+    NRFX_RTC_INT_COMPARE3,
+    NRFX_RTC_INT_TICK,
+    NRFX_RTC_INT_OVERFLOW,
+} nrfx_rtc_int_type_t;
+
+typedef struct
+{
+    uint16_t prescaler;
+    uint8_t interrupt_priority;
+    uint8_t tick_latency;
+    bool reliable;
+} nrfx_rtc_config_t;
+
+typedef void (*nrfx_rtc_handler_t)(nrfx_rtc_int_type_t int_type);
+
+nrfx_err_t nrfx_rtc_init(const nrfx_rtc_t *rtc, const nrfx_rtc_config_t *config,
+                         nrfx_rtc_handler_t handler);
+void nrfx_rtc_enable(const nrfx_rtc_t *rtc);
+void nrfx_rtc_counter_clear(const nrfx_rtc_t *rtc);
+uint32_t nrfx_rtc_counter_get(const nrfx_rtc_t *rtc);
+nrfx_err_t nrfx_rtc_cc_set(const nrfx_rtc_t *rtc, uint32_t channel, uint32_t val, bool enable_irq);
+nrfx_err_t nrfx_rtc_cc_disable(const nrfx_rtc_t *rtc, uint32_t channel);
+
+typedef struct
+{
+    uint32_t DEMCR;
+} CoreDebug_Type;
+
+typedef struct
+{
+    uint32_t CTRL;
+    uint32_t CYCCNT;
+} DWT_Type;
+
+extern CoreDebug_Type test_core_debug;
+extern DWT_Type test_dwt;
+
+#define CoreDebug (&test_core_debug)
+#define DWT (&test_dwt)
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+#define DWT_CTRL_CYCCNTENA_Msk (1UL << 0)
+
+
+#endif
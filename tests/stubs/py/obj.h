@@ -0,0 +1,238 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 Raj Nakarja - Silicon Witchery AB
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef __MICROPY_INCLUDED_S1MOD_TEST_STUBS_PY_OBJ_H__
+#define __MICROPY_INCLUDED_S1MOD_TEST_STUBS_PY_OBJ_H__
+
+// A small stand-in for the MicroPython object model, with just enough of it
+// for the port modules to be built and called on the host. Objects are plain
+// heap allocations which are never freed, and qstrs are a generated enum
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "genhdr/qstrdefs.h"
+
+#define STATIC static
+#define NORETURN __attribute__((noreturn))
+#define MP_ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+#define MP_ERROR_TEXT(x) (x)
+
+typedef unsigned char byte;
+typedef intptr_t mp_int_t;
+typedef uintptr_t mp_uint_t;
+typedef void *mp_obj_t;
+typedef const void *mp_const_obj_t;
+typedef struct _mp_obj_type_t mp_obj_type_t;
+
+typedef struct _mp_obj_base_t
+{
+    const mp_obj_type_t *type;
+} mp_obj_base_t;
+
+// Small ints are tagged in the lowest bit, as they are on the target
+#define MP_OBJ_NULL ((mp_obj_t)NULL)
+#define MP_OBJ_STOP_ITERATION ((mp_obj_t)NULL)
+#define MP_OBJ_SENTINEL ((mp_obj_t)(uintptr_t)4)
+#define MP_OBJ_FROM_PTR(p) ((mp_obj_t)(p))
+#define MP_OBJ_TO_PTR(o) ((void *)(o))
+#define MP_OBJ_NEW_SMALL_INT(v) ((mp_obj_t)((((mp_uint_t)(v)) << 1) | 1))
+#define MP_OBJ_SMALL_INT_VALUE(o) (((mp_int_t)(o)) >> 1)
+#define mp_obj_is_small_int(o) ((((mp_uint_t)(o)) & 1) != 0)
+#define mp_obj_is_type(o, t) (!mp_obj_is_small_int(o) && (o) != MP_OBJ_NULL && \
+                              ((mp_obj_base_t *)(o))->type == (t))
+#define mp_obj_is_int(o) (mp_obj_is_small_int(o) || mp_obj_is_type(o, &mp_type_int))
+
+extern const mp_obj_base_t mp_const_none_obj;
+extern const mp_obj_base_t mp_const_true_obj;
+extern const mp_obj_base_t mp_const_false_obj;
+#define mp_const_none ((mp_obj_t)&mp_const_none_obj)
+#define mp_const_true ((mp_obj_t)&mp_const_true_obj)
+#define mp_const_false ((mp_obj_t)&mp_const_false_obj)
+
+// ROM tables
+typedef struct
+{
+    mp_obj_t key;
+    mp_obj_t value;
+} mp_rom_map_elem_t;
+
+typedef struct
+{
+    const mp_rom_map_elem_t *table;
+    size_t len;
+} mp_obj_dict_t;
+
+#define MP_ROM_QSTR(q) ((mp_obj_t)(uintptr_t)(q))
+#define MP_ROM_PTR(p) ((mp_obj_t)(p))
+#define MP_ROM_INT(i) MP_OBJ_NEW_SMALL_INT(i)
+#define MP_ROM_NONE mp_const_none
+
+#define MP_DEFINE_CONST_DICT(name, table) \
+    const mp_obj_dict_t name = {table, MP_ARRAY_SIZE(table)}
+
+// Function objects hold the C function, and how many arguments it takes so
+// that tests can call it through mp_call_function_*(). Variable numbers of
+// arguments are marked with -1
+typedef struct
+{
+    mp_obj_base_t base;
+    int n_args;
+    const void *fun;
+} mp_obj_fun_builtin_t;
+
+extern const mp_obj_type_t mp_type_fun_builtin;
+
+#define MP_DEFINE_CONST_FUN_OBJ_0(name, f) const mp_obj_fun_builtin_t name = {{&mp_type_fun_builtin}, 0, (const void *)f}
+#define MP_DEFINE_CONST_FUN_OBJ_1(name, f) const mp_obj_fun_builtin_t name = {{&mp_type_fun_builtin}, 1, (const void *)f}
+#define MP_DEFINE_CONST_FUN_OBJ_2(name, f) const mp_obj_fun_builtin_t name = {{&mp_type_fun_builtin}, 2, (const void *)f}
+#define MP_DEFINE_CONST_FUN_OBJ_3(name, f) const mp_obj_fun_builtin_t name = {{&mp_type_fun_builtin}, 3, (const void *)f}
+#define MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(name, min, max, f) const mp_obj_fun_builtin_t name = {{&mp_type_fun_builtin}, -1, (const void *)f}
+#define MP_DEFINE_CONST_FUN_OBJ_KW(name, min, f) const mp_obj_fun_builtin_t name = {{&mp_type_fun_builtin}, -1, (const void *)f}
+#define MP_DEFINE_CONST_STATICMETHOD_OBJ(name, f) const mp_obj_fun_builtin_t name = {{&mp_type_fun_builtin}, -2, (const void *)f}
+
+bool mp_obj_is_callable(mp_obj_t obj);
+
+// Argument parsing, for integer and object arguments
+#define MP_ARG_BOOL (0x001)
+#define MP_ARG_INT (0x002)
+#define MP_ARG_OBJ (0x003)
+#define MP_ARG_KIND_MASK (0x0ff)
+#define MP_ARG_REQUIRED (0x100)
+#define MP_ARG_KW_ONLY (0x200)
+
+typedef union
+{
+    bool u_bool;
+    mp_int_t u_int;
+    mp_obj_t u_obj;
+} mp_arg_val_t;
+
+typedef struct
+{
+    uint16_t qst;
+    uint16_t flags;
+    mp_arg_val_t defval;
+} mp_arg_t;
+
+// Types
+typedef enum
+{
+    MP_UNARY_OP_BOOL,
+    MP_UNARY_OP_LEN,
+} mp_unary_op_t;
+
+typedef enum
+{
+    MP_BINARY_OP_CONTAINS,
+} mp_binary_op_t;
+
+typedef struct
+{
+    mp_obj_t buf[4];
+} mp_obj_iter_buf_t;
+
+typedef struct _mp_print_t mp_print_t;
+typedef enum
+{
+    PRINT_STR,
+    PRINT_REPR,
+} mp_print_kind_t;
+
+struct _mp_obj_type_t
+{
+    mp_obj_base_t base;
+    uint16_t name;
+    void (*print)(const mp_print_t *print, mp_obj_t o, mp_print_kind_t kind);
+    mp_obj_t (*make_new)(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *args);
+    mp_obj_t (*call)(mp_obj_t fun, size_t n_args, size_t n_kw, const mp_obj_t *args);
+    mp_obj_t (*unary_op)(mp_unary_op_t op, mp_obj_t o);
+    mp_obj_t (*binary_op)(mp_binary_op_t op, mp_obj_t lhs, mp_obj_t rhs);
+    mp_obj_t (*subscr)(mp_obj_t self, mp_obj_t index, mp_obj_t value);
+    mp_obj_t (*getiter)(mp_obj_t self, mp_obj_iter_buf_t *iter_buf);
+    mp_obj_t (*iternext)(mp_obj_t self);
+    const mp_obj_dict_t *locals_dict;
+};
+
+extern const mp_obj_type_t mp_type_type;
+extern const mp_obj_type_t mp_type_int;
+extern const mp_obj_type_t mp_type_bytes;
+extern const mp_obj_type_t mp_type_bytearray;
+extern const mp_obj_type_t mp_type_tuple;
+extern const mp_obj_type_t mp_type_list;
+extern const mp_obj_type_t mp_type_KeyError;
+extern const mp_obj_type_t mp_type_KeyboardInterrupt;
+extern const mp_obj_type_t mp_type_OSError;
+extern const mp_obj_type_t mp_type_TypeError;
+extern const mp_obj_type_t mp_type_ValueError;
+
+// Buffers
+#define MP_BUFFER_READ (1)
+#define MP_BUFFER_WRITE (2)
+#define MP_BUFFER_RW (MP_BUFFER_READ | MP_BUFFER_WRITE)
+
+typedef struct
+{
+    void *buf;
+    size_t len;
+    int typecode;
+} mp_buffer_info_t;
+
+void mp_get_buffer_raise(mp_obj_t obj, mp_buffer_info_t *bufinfo, mp_uint_t flags);
+
+// Bytes, bytearrays, tuples and lists all share one layout
+typedef struct
+{
+    mp_obj_base_t base;
+    size_t len;
+    void *items;
+} mp_obj_array_t;
+
+mp_obj_t mp_obj_new_bool(mp_int_t value);
+mp_obj_t mp_obj_new_bytes(const byte *data, size_t len);
+mp_obj_t mp_obj_new_bytearray(size_t len, const void *items);
+mp_obj_t mp_obj_new_bytearray_by_ref(size_t len, void *items);
+mp_obj_t mp_obj_new_tuple(size_t n, const mp_obj_t *items);
+mp_obj_t mp_obj_new_list(size_t n, mp_obj_t *items);
+void mp_obj_list_append(mp_obj_t list, mp_obj_t item);
+mp_obj_t mp_obj_new_int_from_uint(mp_uint_t value);
+mp_obj_t mp_obj_new_int_from_ll(long long value);
+mp_obj_t mp_obj_new_int_from_ull(unsigned long long value);
+mp_int_t mp_obj_get_int(mp_const_obj_t obj);
+mp_int_t mp_obj_get_int_truncated(mp_const_obj_t obj);
+long long mp_obj_get_ll(mp_const_obj_t obj);
+mp_obj_t mp_identity_getiter(mp_obj_t self, mp_obj_iter_buf_t *iter_buf);
+
+// Allocation
+#define m_new(type, num) ((type *)calloc((num), sizeof(type)))
+#define m_new_obj(type) m_new(type, 1)
+void *calloc(size_t num, size_t size);
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 Raj Nakarja - Silicon Witchery AB
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef __MICROPY_INCLUDED_S1MOD_TEST_STUBS_PY_RUNTIME_H__
+#define __MICROPY_INCLUDED_S1MOD_TEST_STUBS_PY_RUNTIME_H__
+
+#include <setjmp.h>
+#include "py/obj.h"
+
+// Port root pointers and thread state, kept together in one structure
+typedef struct
+{
+    mp_obj_t pin_irq_objects[2];
+    mp_obj_t fpga_irq_handler;
+    mp_obj_t flash_irq_handler;
+    mp_obj_t kvstore;
+    mp_obj_t logger;
+    mp_obj_t timer_callbacks[2];
+    mp_obj_t mp_pending_exception;
+} mp_state_t;
+
+extern mp_state_t mp_state;
+
+#define MP_STATE_PORT(x) (mp_state.x)
+#define MP_STATE_VM(x) (mp_state.x)
+#define MP_STATE_THREAD(x) (mp_state.x)
+
+// Nothing on the host interrupts the code under test
+#define MICROPY_BEGIN_ATOMIC_SECTION() (0)
+#define MICROPY_END_ATOMIC_SECTION(state) ((void)(state))
+
+// Exceptions unwind with setjmp and longjmp, as with MICROPY_NLR_SETJMP
+typedef struct _nlr_buf_t
+{
+    struct _nlr_buf_t *prev;
+    void *ret_val;
+    jmp_buf jmpbuf;
+} nlr_buf_t;
+
+extern nlr_buf_t *nlr_top;
+
+#define nlr_push(buf) (nlr_push_tail(buf), setjmp((buf)->jmpbuf))
+#define nlr_raise(val) nlr_jump(MP_OBJ_TO_PTR(val))
+
+void nlr_push_tail(nlr_buf_t *buf);
+void nlr_pop(void);
+NORETURN void nlr_jump(void *val);
+
+typedef struct
+{
+    mp_obj_base_t base;
+    const char *msg;
+    mp_obj_t arg;
+} mp_obj_exception_t;
+
+mp_obj_t mp_obj_new_exception_arg1(const mp_obj_type_t *type, mp_obj_t arg);
+NORETURN void mp_raise_msg(const mp_obj_type_t *type, const char *msg);
+NORETURN void mp_raise_msg_varg(const mp_obj_type_t *type, const char *fmt, ...);
+NORETURN void mp_raise_ValueError(const char *msg);
+NORETURN void mp_raise_TypeError(const char *msg);
+NORETURN void mp_raise_OSError(int errno_);
+
+void mp_arg_check_num(size_t n_args, size_t n_kw, size_t n_args_min, size_t n_args_max, bool takes_kw);
+void mp_arg_parse_all_kw_array(size_t n_pos, size_t n_kw, const mp_obj_t *args,
+                               size_t n_allowed, const mp_arg_t *allowed, mp_arg_val_t *out_vals);
+
+mp_obj_t mp_call_function_0(mp_obj_t fun);
+mp_obj_t mp_call_function_1(mp_obj_t fun, mp_obj_t arg);
+
+// Runs a statement, and evaluates to the type of exception which it raised, or
+// NULL if it returned normally
+#define test_raised(statement)                                   \
+    ({                                                           \
+        nlr_buf_t nlr_;                                          \
+        const mp_obj_type_t *raised_ = NULL;                     \
+        if (nlr_push(&nlr_) == 0)                                \
+        {                                                        \
+            statement;                                           \
+            nlr_pop();                                           \
+        }                                                        \
+        else                                                     \
+        {                                                        \
+            raised_ = ((mp_obj_base_t *)nlr_.ret_val)->type;     \
+        }                                                        \
+        raised_;                                                 \
+    })
+
+// Scheduling. Tests can hook into mp_handle_pending() to run their own
+// callbacks, as the scheduler would
+extern void (*mp_handle_pending_hook)(void);
+void mp_handle_pending(bool raise_exc);
+bool mp_sched_schedule(mp_obj_t function, mp_obj_t arg);
+
+#endif
@@ -0,0 +1,381 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 Raj Nakarja - Silicon Witchery AB
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "py/objint.h"
+#include "py/objstr.h"
+#include "py/runtime.h"
+
+// Singletons and types. Only their addresses matter
+const mp_obj_base_t mp_const_none_obj = {NULL};
+const mp_obj_base_t mp_const_true_obj = {NULL};
+const mp_obj_base_t mp_const_false_obj = {NULL};
+
+const mp_obj_type_t mp_type_type = {.name = MP_QSTR_type};
+const mp_obj_type_t mp_type_int = {.name = MP_QSTR_int};
+const mp_obj_type_t mp_type_bytes = {.name = MP_QSTR_bytes};
+const mp_obj_type_t mp_type_bytearray = {.name = MP_QSTR_bytearray};
+const mp_obj_type_t mp_type_tuple = {.name = MP_QSTR_tuple};
+const mp_obj_type_t mp_type_list = {.name = MP_QSTR_list};
+const mp_obj_type_t mp_type_KeyError = {.name = MP_QSTR_KeyError};
+const mp_obj_type_t mp_type_KeyboardInterrupt = {.name = MP_QSTR_KeyboardInterrupt};
+const mp_obj_type_t mp_type_OSError = {.name = MP_QSTR_OSError};
+const mp_obj_type_t mp_type_TypeError = {.name = MP_QSTR_TypeError};
+const mp_obj_type_t mp_type_ValueError = {.name = MP_QSTR_ValueError};
+const mp_obj_type_t mp_type_fun_builtin = {.name = MP_QSTR_function};
+
+mp_state_t mp_state;
+
+uint64_t test_time_ns;
+
+nlr_buf_t *nlr_top;
+
+void nlr_push_tail(nlr_buf_t *buf)
+{
+    buf->prev = nlr_top;
+    nlr_top = buf;
+}
+
+void nlr_pop(void)
+{
+    nlr_top = nlr_top->prev;
+}
+
+void nlr_jump(void *val)
+{
+    nlr_buf_t *top = nlr_top;
+
+    if (top == NULL)
+    {
+        mp_obj_exception_t *exc = val;
+        printf("uncaught exception: %s\n", exc->msg ? exc->msg : "");
+        abort();
+    }
+
+    top->ret_val = val;
+    nlr_top = top->prev;
+    longjmp(top->jmpbuf, 1);
+}
+
+static mp_obj_t exception_new(const mp_obj_type_t *type, const char *msg, mp_obj_t arg)
+{
+    mp_obj_exception_t *exc = m_new_obj(mp_obj_exception_t);
+    exc->base.type = type;
+    exc->msg = msg;
+    exc->arg = arg;
+
+    return MP_OBJ_FROM_PTR(exc);
+}
+
+mp_obj_t mp_obj_new_exception_arg1(const mp_obj_type_t *type, mp_obj_t arg)
+{
+    return exception_new(type, NULL, arg);
+}
+
+void mp_raise_msg(const mp_obj_type_t *type, const char *msg)
+{
+    nlr_raise(exception_new(type, msg, MP_OBJ_NULL));
+}
+
+void mp_raise_msg_varg(const mp_obj_type_t *type, const char *fmt, ...)
+{
+    nlr_raise(exception_new(type, fmt, MP_OBJ_NULL));
+}
+
+void mp_raise_ValueError(const char *msg)
+{
+    mp_raise_msg(&mp_type_ValueError, msg);
+}
+
+void mp_raise_TypeError(const char *msg)
+{
+    mp_raise_msg(&mp_type_TypeError, msg);
+}
+
+void mp_raise_OSError(int errno_)
+{
+    nlr_raise(exception_new(&mp_type_OSError, NULL, MP_OBJ_NEW_SMALL_INT(errno_)));
+}
+
+void mp_arg_check_num(size_t n_args, size_t n_kw, size_t n_args_min, size_t n_args_max, bool takes_kw)
+{
+    if (n_args < n_args_min || n_args > n_args_max || (n_kw && !takes_kw))
+    {
+        mp_raise_TypeError("wrong number of arguments");
+    }
+}
+
+void mp_arg_parse_all_kw_array(size_t n_pos, size_t n_kw, const mp_obj_t *args,
+                               size_t n_allowed, const mp_arg_t *allowed, mp_arg_val_t *out_vals)
+{
+    if (n_pos > n_allowed)
+    {
+        mp_raise_TypeError("too many positional arguments");
+    }
+
+    for (size_t i = 0; i < n_allowed; i++)
+    {
+        mp_obj_t given = i < n_pos ? args[i] : MP_OBJ_NULL;
+
+        // Keyword arguments follow the positional ones as key, value pairs
+        for (size_t j = 0; j < n_kw; j++)
+        {
+            if ((uintptr_t)args[n_pos + 2 * j] == allowed[i].qst)
+            {
+                given = args[n_pos + 2 * j + 1];
+            }
+        }
+
+        if (given == MP_OBJ_NULL)
+        {
+            if (allowed[i].flags & MP_ARG_REQUIRED)
+            {
+                mp_raise_TypeError("missing required argument");
+            }
+
+            out_vals[i] = allowed[i].defval;
+        }
+        else if ((allowed[i].flags & MP_ARG_KIND_MASK) == MP_ARG_INT)
+        {
+            out_vals[i].u_int = mp_obj_get_int(given);
+        }
+        else if ((allowed[i].flags & MP_ARG_KIND_MASK) == MP_ARG_BOOL)
+        {
+            out_vals[i].u_bool = mp_obj_get_int(given) != 0;
+        }
+        else
+        {
+            out_vals[i].u_obj = given;
+        }
+    }
+}
+
+bool mp_obj_is_callable(mp_obj_t obj)
+{
+    return mp_obj_is_type(obj, &mp_type_fun_builtin);
+}
+
+mp_obj_t mp_call_function_0(mp_obj_t fun)
+{
+    const mp_obj_fun_builtin_t *self = MP_OBJ_TO_PTR(fun);
+
+    return ((mp_obj_t(*)(void))self->fun)();
+}
+
+mp_obj_t mp_call_function_1(mp_obj_t fun, mp_obj_t arg)
+{
+    const mp_obj_fun_builtin_t *self = MP_OBJ_TO_PTR(fun);
+
+    return ((mp_obj_t(*)(mp_obj_t))self->fun)(arg);
+}
+
+void (*mp_handle_pending_hook)(void);
+
+void mp_handle_pending(bool raise_exc)
+{
+    if (mp_handle_pending_hook)
+    {
+        mp_handle_pending_hook();
+    }
+
+    // Raise a pending exception, such as a KeyboardInterrupt from Ctrl-C
+    mp_obj_t exc = MP_STATE_THREAD(mp_pending_exception);
+    if (raise_exc && exc != MP_OBJ_NULL)
+    {
+        MP_STATE_THREAD(mp_pending_exception) = MP_OBJ_NULL;
+        nlr_raise(exc);
+    }
+}
+
+bool mp_sched_schedule(mp_obj_t function, mp_obj_t arg)
+{
+    return true;
+}
+
+static mp_obj_t array_new(const mp_obj_type_t *type, size_t len, size_t item_size, const void *items)
+{
+    mp_obj_array_t *array = m_new_obj(mp_obj_array_t);
+    array->base.type = type;
+    array->len = len;
+    array->items = calloc(len ? len : 1, item_size);
+
+    if (items)
+    {
+        memcpy(array->items, items, len * item_size);
+    }
+
+    return MP_OBJ_FROM_PTR(array);
+}
+
+mp_obj_t mp_obj_new_bool(mp_int_t value)
+{
+    return value ? mp_const_true : mp_const_false;
+}
+
+mp_obj_t mp_obj_new_bytes(const byte *data, size_t len)
+{
+    return array_new(&mp_type_bytes, len, 1, data);
+}
+
+mp_obj_t mp_obj_new_bytearray(size_t len, const void *items)
+{
+    return array_new(&mp_type_bytearray, len, 1, items);
+}
+
+mp_obj_t mp_obj_new_bytearray_by_ref(size_t len, void *items)
+{
+    mp_obj_array_t *array = m_new_obj(mp_obj_array_t);
+    array->base.type = &mp_type_bytearray;
+    array->len = len;
+    array->items = items;
+
+    return MP_OBJ_FROM_PTR(array);
+}
+
+mp_obj_t mp_obj_new_tuple(size_t n, const mp_obj_t *items)
+{
+    return array_new(&mp_type_tuple, n, sizeof(mp_obj_t), items);
+}
+
+mp_obj_t mp_obj_new_list(size_t n, mp_obj_t *items)
+{
+    return array_new(&mp_type_list, n, sizeof(mp_obj_t), items);
+}
+
+void mp_obj_list_append(mp_obj_t list, mp_obj_t item)
+{
+    mp_obj_array_t *array = MP_OBJ_TO_PTR(list);
+    array->items = realloc(array->items, (array->len + 1) * sizeof(mp_obj_t));
+    ((mp_obj_t *)array->items)[array->len++] = item;
+}
+
+void vstr_init_len(vstr_t *vstr, size_t len)
+{
+    vstr->alloc = len + 1;
+    vstr->len = len;
+    vstr->buf = calloc(1, vstr->alloc);
+}
+
+mp_obj_t mp_obj_new_str_from_vstr(const mp_obj_type_t *type, vstr_t *vstr)
+{
+    mp_obj_array_t *array = m_new_obj(mp_obj_array_t);
+    array->base.type = type;
+    array->len = vstr->len;
+    array->items = vstr->buf;
+
+    return MP_OBJ_FROM_PTR(array);
+}
+
+void mp_get_buffer_raise(mp_obj_t obj, mp_buffer_info_t *bufinfo, mp_uint_t flags)
+{
+    if (!mp_obj_is_type(obj, &mp_type_bytes) && !mp_obj_is_type(obj, &mp_type_bytearray))
+    {
+        mp_raise_TypeError("object with buffer protocol required");
+    }
+
+    if ((flags & MP_BUFFER_WRITE) && !mp_obj_is_type(obj, &mp_type_bytearray))
+    {
+        mp_raise_TypeError("object with buffer protocol required");
+    }
+
+    mp_obj_array_t *array = MP_OBJ_TO_PTR(obj);
+    bufinfo->buf = array->items;
+    bufinfo->len = array->len;
+    bufinfo->typecode = 'B';
+}
+
+// Small ints have the same 31 bit range that they do on the target
+mp_obj_t mp_obj_new_int_from_ll(long long value)
+{
+    if (value >= -(1LL << 30) && value < (1LL << 30))
+    {
+        return MP_OBJ_NEW_SMALL_INT(value);
+    }
+
+    mp_obj_int_t *obj = m_new_obj(mp_obj_int_t);
+    obj->base.type = &mp_type_int;
+    obj->val = value;
+
+    return MP_OBJ_FROM_PTR(obj);
+}
+
+mp_obj_t mp_obj_new_int_from_ull(unsigned long long value)
+{
+    return mp_obj_new_int_from_ll((long long)value);
+}
+
+mp_obj_t mp_obj_new_int_from_uint(mp_uint_t value)
+{
+    return mp_obj_new_int_from_ll((long long)value);
+}
+
+long long mp_obj_get_ll(mp_const_obj_t obj)
+{
+    if (mp_obj_is_small_int(obj))
+    {
+        return MP_OBJ_SMALL_INT_VALUE(obj);
+    }
+
+    if (obj == mp_const_true || obj == mp_const_false)
+    {
+        return obj == mp_const_true;
+    }
+
+    if (!mp_obj_is_type(obj, &mp_type_int))
+    {
+        mp_raise_TypeError("can't convert to int");
+    }
+
+    return ((const mp_obj_int_t *)obj)->val;
+}
+
+mp_int_t mp_obj_get_int(mp_const_obj_t obj)
+{
+    return mp_obj_get_ll(obj);
+}
+
+mp_int_t mp_obj_get_int_truncated(mp_const_obj_t obj)
+{
+    return mp_obj_get_ll(obj);
+}
+
+void mp_obj_int_to_bytes_impl(mp_obj_t self_in, bool big_endian, size_t len, byte *buf)
+{
+    long long value = mp_obj_get_ll(self_in);
+
+    for (size_t i = 0; i < len; i++)
+    {
+        buf[big_endian ? len - 1 - i : i] = (byte)(value >> (8 * (i < 8 ? i : 7)));
+    }
+}
+
+mp_obj_t mp_identity_getiter(mp_obj_t self, mp_obj_iter_buf_t *iter_buf)
+{
+    return self;
+}
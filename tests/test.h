@@ -0,0 +1,77 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2022 Raj Nakarja - Silicon Witchery AB
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef __MICROPY_INCLUDED_S1MOD_TEST_H__
+#define __MICROPY_INCLUDED_S1MOD_TEST_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * @brief Number of failed checks, which becomes the exit status of the test.
+ */
+static int test_failures;
+
+/**
+ * @brief Checks a condition, and reports where it failed without stopping the
+ *        test.
+ */
+#define TEST_CHECK(condition)                                       \
+    do                                                              \
+    {                                                               \
+        if (!(condition))                                           \
+        {                                                           \
+            printf("%s:%d: check failed: %s\n",                     \
+                   __FILE__, __LINE__, #condition);                 \
+            test_failures++;                                        \
+        }                                                           \
+    } while (0)
+
+/**
+ * @brief Prints the outcome, and returns the exit status for main().
+ */
+static inline int test_result(const char *name)
+{
+    printf("%s: %s\n", name, test_failures ? "FAILED" : "passed");
+
+    return test_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**
+ * @brief Monotonic time in seconds, for benchmarks.
+ */
+static inline double test_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+#endif